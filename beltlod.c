@@ -0,0 +1,270 @@
+#include "stdio.h"
+#include "stdlib.h"
+#include "string.h"
+#include "math.h"
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+#include "GL/glew.h"
+
+#include "source/Matrix.h"
+#include "utils.h"
+#include "beltlod.h"
+#include "glstate.h"
+
+BeltLodStats beltLodStats;
+
+void InitBeltLod(BeltLod* lod, int capacity, float* sphere)
+{
+    lod->impostorPixelRadius = 8.;
+    lod->pointPixelRadius = 1.5;
+    memcpy(lod->sphere, sphere, 4*sizeof(float));
+    lod->capacity = capacity;
+    lod->instances = NULL;
+    glGenVertexArrays(1, &lod->VAO);
+    ResetBeltLod(lod);
+}
+
+/******************************************************************
+ * viewAxes
+ * Direction from the mesh to the camera of a view of the atlas, and
+ * the directions of the right and the top of its image. The views are
+ * spread evenly over longitudes and latitudes; the same as viewAxes
+ * in impostor.vs
+ *******************************************************************/
+static void viewAxes(int column, int row, float* direction, float* right, float* up)
+{
+    float longitude = 2. * M_PI * (column + .5) / impostorColumns;
+    float latitude = M_PI * (row + .5) / impostorRows - M_PI / 2.;
+    direction[0] = cosf(latitude) * cosf(longitude);
+    direction[1] = sinf(latitude);
+    direction[2] = cosf(latitude) * sinf(longitude);
+
+    // right = cross(y, direction), never 0 as no view looks along y
+    float length = sqrtf(direction[0]*direction[0] + direction[2]*direction[2]);
+    right[0] = direction[2] / length;
+    right[1] = 0.;
+    right[2] = -direction[0] / length;
+    CrossProduct(direction, right, up);
+}
+
+static GLuint createAtlasTexture(int width, int height)
+{
+    GLuint texture;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    // the cells stay apart down to one texel each
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, log2(impostorCellSize));
+    return texture;
+}
+
+/******************************************************************
+ * BakeBeltImpostors
+ * Draws the mesh into every cell of the atlas, orthographic and
+ * unlit: its texture color with full coverage in alpha, and its object
+ * space normals, so the impostors can be lit like the mesh. The bounding
+ * sphere fills the cell. The average color is kept for the points.
+ * Changes the viewport, the caller has to restore it
+ *******************************************************************/
+void BakeBeltImpostors(BeltLod* lod, GLuint program, GLuint texture, GLuint VBO, GLuint CBO, GLuint IBO,
+        GLuint NBO, GLuint UVBO, GLsizei indexCount)
+{
+    double start = milliseconds();
+    int width = impostorColumns * impostorCellSize;
+    int height = impostorRows * impostorCellSize;
+
+    lod->atlas = createAtlasTexture(width, height);
+    lod->normalAtlas = createAtlasTexture(width, height);
+
+    GLuint depth;
+    glGenRenderbuffers(1, &depth);
+    glBindRenderbuffer(GL_RENDERBUFFER, depth);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+
+    GLuint framebuffer;
+    glGenFramebuffers(1, &framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, lod->atlas, 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, lod->normalAtlas, 0);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depth);
+    GLenum attachments[2] = {GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1};
+    glDrawBuffers(2, attachments);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        fprintf(stderr, "Impostor Framebuffer not complete!\n");
+        exit(-1);
+    }
+
+    glClearColor(0., 0., 0., 0.);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    glUseProgram(program);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    EnableTexture("tex", program, 0);
+    BindBuffers(VBO, CBO, IBO, NBO, UVBO);
+
+    float* c = lod->sphere;
+    float r = lod->sphere[3];
+    for (int row = 0; row < impostorRows; row++) {
+        for (int column = 0; column < impostorColumns; column++) {
+            float direction[3], right[3], up[3];
+            viewAxes(column, row, direction, right, up);
+
+            // orthographic view of the sphere, from the side of direction
+            float bake[16] = {
+                right[0] / r, right[1] / r, right[2] / r, -(right[0]*c[0] + right[1]*c[1] + right[2]*c[2]) / r,
+                up[0] / r, up[1] / r, up[2] / r, -(up[0]*c[0] + up[1]*c[1] + up[2]*c[2]) / r,
+                -direction[0] / r, -direction[1] / r, -direction[2] / r,
+                (direction[0]*c[0] + direction[1]*c[1] + direction[2]*c[2]) / r,
+                0., 0., 0., 1.,
+            };
+            BindUniform4f("BakeMatrix", program, bake);
+            glViewport(column * impostorCellSize, row * impostorCellSize, impostorCellSize, impostorCellSize);
+            glDrawElements(GL_TRIANGLES, indexCount, GL_UNSIGNED_INT, 0);
+        }
+    }
+
+    // average of the covered texels, weighted by their coverage
+    unsigned char* texels = malloc(width * height * 4);
+    glBindTexture(GL_TEXTURE_2D, lod->atlas);
+    glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_UNSIGNED_BYTE, texels);
+    double sum[4] = {0., 0., 0., 0.};
+    for (int i = 0; i < width * height; i++) {
+        for (int j = 0; j < 4; j++) {
+            sum[j] += texels[4*i + j] * (j < 3 ? texels[4*i + 3] / 255. : 1.);
+        }
+    }
+    for (int j = 0; j < 3; j++) {
+        lod->color[j] = sum[3] > 0 ? sum[j] / sum[3] : 0.;
+    }
+    free(texels);
+
+    glGenerateMipmap(GL_TEXTURE_2D);
+    glBindTexture(GL_TEXTURE_2D, lod->normalAtlas);
+    glGenerateMipmap(GL_TEXTURE_2D);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glDeleteFramebuffers(1, &framebuffer);
+    glDeleteRenderbuffers(1, &depth);
+    glClearColor(0., 0., 0., 1.);
+    InvalidateGLState();
+
+    beltLodStats.bakeTime = milliseconds() - start;
+}
+
+/* The instances of this frame are written to mapped memory, starting
+ * at offset of buffer. Has to be set before any instance of the frame */
+void SetBeltInstanceBuffer(BeltLod* lod, BeltInstance* instances, GLuint buffer, GLintptr offset)
+{
+    lod->instances = instances;
+    lod->buffer = buffer;
+    lod->offset = offset;
+}
+
+void ResetBeltLod(BeltLod* lod)
+{
+    memset(lod->counts, 0, sizeof(lod->counts));
+    memset(beltLodStats.counts, 0, sizeof(beltLodStats.counts));
+    beltLodStats.draws = 0;
+}
+
+/* Band of an asteroid with the given radius on screen */
+int SelectBeltBand(BeltLod* lod, float pixelRadius)
+{
+    if (pixelRadius >= lod->impostorPixelRadius) {
+        return bandMesh;
+    }
+    return pixelRadius >= lod->pointPixelRadius ? bandImpostor : bandPoint;
+}
+
+/* Adds a visible asteroid to the impostors or the points; meshes are
+ * only counted, they are drawn by the caller */
+void AddBeltInstance(BeltLod* lod, int band, float* transformation)
+{
+    beltLodStats.counts[band]++;
+    if (band == bandMesh) {
+        return;
+    }
+
+    int count = lod->counts[bandImpostor] + lod->counts[bandPoint];
+    if (count == lod->capacity) {
+        fprintf(stderr, "Too many impostors and points in the belt\n");
+        exit(-1);
+    }
+
+    int index = band == bandImpostor ? lod->counts[bandImpostor] : lod->capacity - 1 - lod->counts[bandPoint];
+    memcpy(lod->instances[index].rows, transformation, sizeof(BeltInstance));
+    lod->counts[band]++;
+}
+
+/* Points the instanced attributes at the instances, starting at first */
+static void bindInstances(BeltLod* lod, int first)
+{
+    StateBindVertexArray(lod->VAO);
+    StateBindBuffer(GL_ARRAY_BUFFER, lod->buffer);
+    GLintptr start = lod->offset + first * sizeof(BeltInstance);
+    int rows[3] = {vTransformRow0, vTransformRow1, vTransformRow2};
+    for (int i = 0; i < 3; i++) {
+        glEnableVertexAttribArray(rows[i]);
+        glVertexAttribPointer(rows[i], 4, GL_FLOAT, GL_FALSE, sizeof(BeltInstance),
+                (void*)(start + i * 4 * sizeof(float)));
+        glVertexAttribDivisor(rows[i], 1);
+    }
+}
+
+/******************************************************************
+ * DrawBeltImpostors
+ * Draws all impostors of the frame in one instanced call, four
+ * vertices each, generated from gl_VertexID. The caller sets the
+ * camera and light uniforms of the program
+ *******************************************************************/
+void DrawBeltImpostors(BeltLod* lod, GLuint program)
+{
+    if (lod->counts[bandImpostor] == 0) {
+        return;
+    }
+
+    ActivateTexture(0, lod->atlas);
+    EnableTexture("atlas", program, 0);
+    ActivateTexture(1, lod->normalAtlas);
+    EnableTexture("normalAtlas", program, 1);
+    glUniform4fv(glGetUniformLocation(program, "Sphere"), 1, lod->sphere);
+
+    GLuint previousVAO = StateVertexArray();
+    bindInstances(lod, 0);
+    glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, lod->counts[bandImpostor]);
+    StateBindVertexArray(previousVAO);
+    beltLodStats.draws++;
+}
+
+/******************************************************************
+ * DrawBeltPoints
+ * Draws all points of the frame in one instanced call, a point sprite
+ * each. The caller sets the camera and light uniforms of the program
+ *******************************************************************/
+void DrawBeltPoints(BeltLod* lod, GLuint program)
+{
+    if (lod->counts[bandPoint] == 0) {
+        return;
+    }
+
+    glUniform4fv(glGetUniformLocation(program, "Sphere"), 1, lod->sphere);
+    BindUniform3f("Albedo", program, lod->color);
+
+    GLuint previousVAO = StateVertexArray();
+    bindInstances(lod, lod->capacity - lod->counts[bandPoint]);
+    glDrawArraysInstanced(GL_POINTS, 0, 1, lod->counts[bandPoint]);
+    StateBindVertexArray(previousVAO);
+    beltLodStats.draws++;
+}
+
+void PrintBeltLodStats()
+{
+    printf("belt: %d meshes, %d impostors, %d points in %d draws, atlas baked in %.2f ms\n",
+            beltLodStats.counts[bandMesh], beltLodStats.counts[bandImpostor], beltLodStats.counts[bandPoint],
+            beltLodStats.draws, beltLodStats.bakeTime);
+}
@@ -0,0 +1,67 @@
+#ifndef SOLAR_SYSTEM_BELT_LOD
+#define SOLAR_SYSTEM_BELT_LOD
+
+/* Levels of detail of the asteroid belt, by the radius on screen: close
+ * asteroids are meshes, drawn like before. Smaller ones are impostors,
+ * a quad with one of the views of the mesh baked into an atlas at
+ * startup, and the smallest ones are point sprites. Impostors and
+ * points are collected every frame and drawn with one call each,
+ * however many asteroids there are */
+
+/* Views of the atlas: longitudes times latitudes, around the mesh; in
+ * sync with impostor.vs */
+#define impostorColumns 8
+#define impostorRows 4
+#define impostorCellSize 32
+
+/* Vertex attributes of the impostors and points: the first three rows
+ * of the transformation of the asteroid, one per instance */
+enum BeltLodIndices {vTransformRow0 = 0, vTransformRow1 = 1, vTransformRow2 = 2};
+
+enum BeltBand {bandMesh, bandImpostor, bandPoint, beltBands};
+
+typedef struct beltInstance {
+    float rows[12];
+} BeltInstance;
+
+typedef struct beltLod {
+    // radius in pixels below which the next band is used
+    float impostorPixelRadius;
+    float pointPixelRadius;
+
+    float sphere[4]; // bounding sphere of the mesh, object space
+    GLuint atlas; // color and coverage of every view
+    GLuint normalAtlas; // object space normals of every view
+    float color[3]; // average color of the mesh, of the points
+
+    // written every frame into the buffer range set by SetBeltInstanceBuffer:
+    // impostors from the front, points from the back
+    BeltInstance* instances;
+    GLuint buffer;
+    GLintptr offset;
+    int capacity;
+    int counts[beltBands];
+
+    GLuint VAO;
+} BeltLod;
+
+typedef struct beltLodStats {
+    int counts[beltBands]; // asteroids in every band, last frame
+    int draws;
+    double bakeTime; // milliseconds for the atlas
+} BeltLodStats;
+
+extern BeltLodStats beltLodStats;
+
+void InitBeltLod(BeltLod* lod, int capacity, float* sphere);
+void BakeBeltImpostors(BeltLod* lod, GLuint program, GLuint texture, GLuint VBO, GLuint CBO, GLuint IBO,
+        GLuint NBO, GLuint UVBO, GLsizei indexCount);
+void SetBeltInstanceBuffer(BeltLod* lod, BeltInstance* instances, GLuint buffer, GLintptr offset);
+void ResetBeltLod(BeltLod* lod);
+int SelectBeltBand(BeltLod* lod, float pixelRadius);
+void AddBeltInstance(BeltLod* lod, int band, float* transformation);
+void DrawBeltImpostors(BeltLod* lod, GLuint program);
+void DrawBeltPoints(BeltLod* lod, GLuint program);
+void PrintBeltLodStats();
+
+#endif
@@ -0,0 +1,266 @@
+#include "stdio.h"
+#include "stdlib.h"
+#include "string.h"
+#include "GL/glew.h"
+
+#include "utils.h"
+#include "bloom.h"
+#include "glstate.h"
+
+BloomStats bloomStats;
+
+/* levels used by every BloomQuality: down to 1/4, 1/16 and 1/64 */
+static const int qualityLevels[bloomQualities] = {2, 4, 6};
+
+/* Creates level i at width x height, with a framebuffer drawing into it */
+static void createLevel(Bloom* bloom, int i, int width, int height)
+{
+    bloom->width[i] = width;
+    bloom->height[i] = height;
+
+    glGenTextures(1, &bloom->textures[i]);
+    glBindTexture(GL_TEXTURE_2D, bloom->textures[i]);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, width, height, 0, GL_RGBA, GL_FLOAT, NULL);
+    // the filters rely on linear filtering, and must not wrap around
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    glGenFramebuffers(1, &bloom->framebuffers[i]);
+    glBindFramebuffer(GL_FRAMEBUFFER, bloom->framebuffers[i]);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, bloom->textures[i], 0);
+
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        fprintf(stderr, "Bloom Framebuffer not complete!\n");
+        exit(-1);
+    }
+}
+
+static void createLevels(Bloom* bloom, int width, int height)
+{
+    for (int i = 0; i < maxBloomLevels; i++) {
+        width = width > 3 ? width / 2 : 1;
+        height = height > 3 ? height / 2 : 1;
+        createLevel(bloom, i, width, height);
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+/* Allocates all levels for a source image of width x height */
+void InitBloom(Bloom* bloom, int width, int height)
+{
+    createLevels(bloom, width, height);
+
+    for (int i = 0; i < bloomQueryFrames; i++) {
+        glGenQueries(maxBloomPasses, bloom->queries[i]);
+        bloom->issued[i] = 0;
+    }
+    bloom->frame = 0;
+
+    glGenQueries(bloomQueryFrames, bloom->fxaaQueries);
+    memset(bloom->fxaaIssued, 0, sizeof(bloom->fxaaIssued));
+    bloom->fxaaFrame = 0;
+}
+
+/* Reallocates all levels for a source image of the new size. Binds
+ * directly, the caller has to invalidate the GL state cache */
+void ResizeBloom(Bloom* bloom, int width, int height)
+{
+    glDeleteFramebuffers(maxBloomLevels, bloom->framebuffers);
+    glDeleteTextures(maxBloomLevels, bloom->textures);
+    createLevels(bloom, width, height);
+}
+
+/* How far the bloom of a single pixel reaches, in pixels of the source.
+ * Every level about doubles it, measured it stays below this bound */
+int BloomRadius(int quality)
+{
+    return 4 << qualityLevels[quality];
+}
+
+/* Reads the timer queries of the set, if the GPU is done with them */
+static void readQueries(Bloom* bloom, int set)
+{
+    int passes = bloom->issued[set];
+    if (passes == 0) {
+        return;
+    }
+
+    GLuint available = GL_FALSE;
+    glGetQueryObjectuiv(bloom->queries[set][passes - 1], GL_QUERY_RESULT_AVAILABLE, &available);
+    if (!available) {
+        return;
+    }
+
+    for (int i = 0; i < passes; i++) {
+        GLuint64 nanoseconds = 0;
+        glGetQueryObjectui64v(bloom->queries[set][i], GL_QUERY_RESULT, &nanoseconds);
+        bloomStats.time[i] = nanoseconds / 1000000.;
+    }
+    bloomStats.passes = passes;
+}
+
+/******************************************************************
+ * levelRect
+ * Region of level i covering the rect of the source, rounded outwards.
+ * With a border, grown by that many texels on every side
+ *******************************************************************/
+static void levelRect(Bloom* bloom, int* rect, int i, int border, int* result)
+{
+    int scale = 2 << i;
+    int x0 = rect[0] / scale - border;
+    int y0 = rect[1] / scale - border;
+    int x1 = (rect[0] + rect[2] + scale - 1) / scale + border;
+    int y1 = (rect[1] + rect[3] + scale - 1) / scale + border;
+
+    x0 = x0 < 0 ? 0 : x0;
+    y0 = y0 < 0 ? 0 : y0;
+    x1 = x1 > bloom->width[i] ? bloom->width[i] : x1;
+    y1 = y1 > bloom->height[i] ? bloom->height[i] : y1;
+
+    result[0] = x0;
+    result[1] = y0;
+    result[2] = x1 - x0;
+    result[3] = y1 - y0;
+}
+
+/* Draws the source texture into the rect of level target, with the
+ * current program */
+static void filterPass(Bloom* bloom, int pass, GLuint source, int target, int* rect)
+{
+    StateBindFramebuffer(GL_FRAMEBUFFER, bloom->framebuffers[target]);
+    glViewport(0, 0, bloom->width[target], bloom->height[target]);
+    StateBindTexture(GL_TEXTURE_2D, source);
+
+    int region[4];
+    levelRect(bloom, rect, target, 0, region);
+    glScissor(region[0], region[1], region[2], region[3]);
+
+    glBeginQuery(GL_TIME_ELAPSED, bloom->queries[bloom->frame][pass]);
+    DrawFrontScreen();
+    glEndQuery(GL_TIME_ELAPSED);
+
+    bloomStats.width[pass] = bloom->width[target];
+    bloomStats.height[pass] = bloom->height[target];
+}
+
+/******************************************************************
+ * ApplyBloom
+ * Blurs the source texture with the levels of the quality and returns
+ * the texture holding the result, at half the size of the source.
+ * Only rect (x, y, width, height in pixels of the source) is blurred,
+ * it has to include the bloom radius around everything bright; the
+ * result is undefined outside of it.
+ * Changes the viewport, the caller has to restore it
+ *******************************************************************/
+GLuint ApplyBloom(Bloom* bloom, int quality, GLuint downProgram, GLuint upProgram, GLuint source, int* rect)
+{
+    int levels = qualityLevels[quality];
+    int pass = 0;
+
+    readQueries(bloom, bloom->frame);
+    StateActiveTexture(0);
+    StateEnable(GL_SCISSOR_TEST);
+
+    // the taps at the edge of the rect read up to two texels beyond it,
+    // left from earlier frames: clear them first
+    glClearColor(0.0, 0.0, 0.0, 1.0);
+    for (int i = 0; i < levels; i++) {
+        int region[4];
+        levelRect(bloom, rect, i, 2, region);
+        StateBindFramebuffer(GL_FRAMEBUFFER, bloom->framebuffers[i]);
+        glScissor(region[0], region[1], region[2], region[3]);
+        glClear(GL_COLOR_BUFFER_BIT);
+    }
+
+    // downsample: the source into the first level, each level into the next
+    StateUseProgram(downProgram);
+    EnableTexture("image", downProgram, 0);
+    for (int i = 0; i < levels; i++) {
+        filterPass(bloom, pass++, i == 0 ? source : bloom->textures[i - 1], i, rect);
+    }
+
+    // upsample back, each level replaces the larger one it was made of
+    StateUseProgram(upProgram);
+    EnableTexture("image", upProgram, 0);
+    for (int i = levels - 1; i > 0; i--) {
+        filterPass(bloom, pass++, bloom->textures[i], i - 1, rect);
+    }
+    StateDisable(GL_SCISSOR_TEST);
+
+    bloomStats.skipped = 0;
+    memcpy(bloomStats.rect, rect, sizeof(bloomStats.rect));
+
+    bloom->issued[bloom->frame] = pass;
+    bloom->frame = (bloom->frame + 1) % bloomQueryFrames;
+
+    return bloom->textures[0];
+}
+
+/* Called instead of ApplyBloom in frames without anything bright */
+void SkipBloom()
+{
+    bloomStats.skipped = 1;
+}
+
+/******************************************************************
+ * ApplyFXAA
+ * Anti-aliases the tone mapped source, with its luma in alpha, into
+ * the bound framebuffer; quality 1 is low, 2 high, see fxaa.fs
+ *******************************************************************/
+void ApplyFXAA(Bloom* bloom, int quality, GLuint program, GLuint source)
+{
+    int set = bloom->fxaaFrame;
+    if (bloom->fxaaIssued[set]) {
+        GLuint available = GL_FALSE;
+        glGetQueryObjectuiv(bloom->fxaaQueries[set], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (available) {
+            GLuint64 nanoseconds = 0;
+            glGetQueryObjectui64v(bloom->fxaaQueries[set], GL_QUERY_RESULT, &nanoseconds);
+            bloomStats.fxaaTime = nanoseconds / 1000000.;
+        }
+    }
+
+    StateUseProgram(program);
+    ActivateTexture(0, source);
+    EnableTexture("image", program, 0);
+    BindUniform1i("quality", program, quality);
+
+    glBeginQuery(GL_TIME_ELAPSED, bloom->fxaaQueries[set]);
+    DrawFrontScreen();
+    glEndQuery(GL_TIME_ELAPSED);
+
+    bloomStats.fxaaSkipped = 0;
+    bloom->fxaaIssued[set] = 1;
+    bloom->fxaaFrame = (set + 1) % bloomQueryFrames;
+}
+
+/* Called instead of ApplyFXAA in frames without anti-aliasing */
+void SkipFXAA()
+{
+    bloomStats.fxaaSkipped = 1;
+}
+
+void PrintBloomStats()
+{
+    if (bloomStats.fxaaSkipped) {
+        printf("fxaa: off\n");
+    } else {
+        printf("fxaa: %.3f ms on the GPU\n", bloomStats.fxaaTime);
+    }
+
+    if (bloomStats.skipped) {
+        printf("bloom: skipped, nothing bright on screen\n");
+        return;
+    }
+    printf("bloom: region %dx%d at (%d, %d)\n", bloomStats.rect[2], bloomStats.rect[3],
+            bloomStats.rect[0], bloomStats.rect[1]);
+
+    double total = 0;
+    for (int i = 0; i < bloomStats.passes; i++) {
+        printf("bloom pass %d: %dx%d, %.3f ms\n", i, bloomStats.width[i], bloomStats.height[i], bloomStats.time[i]);
+        total += bloomStats.time[i];
+    }
+    printf("bloom: %d passes, %.3f ms on the GPU\n", bloomStats.passes, total);
+}
@@ -0,0 +1,55 @@
+#ifndef SOLAR_SYSTEM_BLOOM
+#define SOLAR_SYSTEM_BLOOM
+
+/* Bloom of the bright color attachment, as a dual filter: the image is
+ * downsampled level by level to 1/2, 1/4, ... of its size, then
+ * upsampled back to the first level. The taps of both shaders sit
+ * between texels, so linear filtering averages several texels per tap.
+ * More levels blur wider, the quality selects how many are used */
+#define maxBloomLevels 6
+#define maxBloomPasses (2*maxBloomLevels - 1)
+
+enum BloomQuality {bloomLow, bloomMedium, bloomHigh, bloomQualities};
+
+/* Timer queries of the passes, one set per frame in flight */
+#define bloomQueryFrames 3
+
+typedef struct bloom {
+    GLuint textures[maxBloomLevels];
+    GLuint framebuffers[maxBloomLevels];
+    int width[maxBloomLevels];
+    int height[maxBloomLevels];
+
+    GLuint queries[bloomQueryFrames][maxBloomPasses];
+    int issued[bloomQueryFrames]; // passes measured by the set
+    int frame; // set used by the current frame
+
+    // the anti-aliasing of the merged image, timed the same way
+    GLuint fxaaQueries[bloomQueryFrames];
+    int fxaaIssued[bloomQueryFrames];
+    int fxaaFrame;
+} Bloom;
+
+typedef struct bloomStats {
+    int skipped; // nothing bright on screen in the last frame
+    int rect[4]; // region of the source blurred in the last frame, x, y, width, height
+    int passes;
+    int width[maxBloomPasses]; // size of the target of the pass
+    int height[maxBloomPasses];
+    double time[maxBloomPasses]; // milliseconds on the GPU
+    int fxaaSkipped; // anti-aliasing off in the last frame
+    double fxaaTime;
+} BloomStats;
+
+extern BloomStats bloomStats;
+
+void InitBloom(Bloom* bloom, int width, int height);
+void ResizeBloom(Bloom* bloom, int width, int height);
+int BloomRadius(int quality);
+GLuint ApplyBloom(Bloom* bloom, int quality, GLuint downProgram, GLuint upProgram, GLuint source, int* rect);
+void SkipBloom();
+void ApplyFXAA(Bloom* bloom, int quality, GLuint program, GLuint source);
+void SkipFXAA();
+void PrintBloomStats();
+
+#endif
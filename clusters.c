@@ -0,0 +1,276 @@
+#include "stdio.h"
+#include "stdlib.h"
+#include "string.h"
+#include "math.h"
+#include "GL/glew.h"
+
+#include "utils.h"
+#include "clusters.h"
+#include "glstate.h"
+
+Clusters clusters;
+ClusterStats clusterStats;
+
+/* texture units of the cluster data, after the texture of the body */
+#define clusterDataUnit 1
+#define clusterLightUnit 2
+
+// kept apart from the mapped frame data, which should only be written
+static unsigned int counts[clusterCount];
+static unsigned int offsets[clusterCount];
+static unsigned int filled[clusterCount];
+static float view[maxPointLights][3];
+static int visible[maxPointLights];
+
+static int clampi(int val, int min, int max)
+{
+    return val < min ? min : (val > max ? max : val);
+}
+
+/* Bytes of the cluster grid and the light index list, for one frame */
+GLsizeiptr ClusterDataSize()
+{
+    return (2*clusterCount + maxClusterIndices) * sizeof(GLuint);
+}
+
+/* Bytes of the visible point lights, for one frame */
+GLsizeiptr ClusterLightDataSize()
+{
+    return maxPointLights * 8 * sizeof(float);
+}
+
+/******************************************************************
+ * InitClusters
+ * Creates the buffer textures the shaders read the clusters from.
+ * Both view the whole buffer holding the frame data; the sections of
+ * the current frame are selected by offsets
+ *******************************************************************/
+void InitClusters(GLuint buffer)
+{
+    GLint size = 0;
+    GLint maxTexels = 0;
+    StateBindBuffer(GL_TEXTURE_BUFFER, buffer);
+    glGetBufferParameteriv(GL_TEXTURE_BUFFER, GL_BUFFER_SIZE, &size);
+    glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &maxTexels);
+    if (size / sizeof(GLuint) > maxTexels) {
+        fprintf(stderr, "Frame data buffer too large for a buffer texture (%d bytes)\n", size);
+        exit(-1);
+    }
+
+    StateActiveTexture(clusterDataUnit);
+    glGenTextures(1, &clusters.dataTexture);
+    StateBindTexture(GL_TEXTURE_BUFFER, clusters.dataTexture);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_R32UI, buffer);
+
+    StateActiveTexture(clusterLightUnit);
+    glGenTextures(1, &clusters.lightTexture);
+    StateBindTexture(GL_TEXTURE_BUFFER, clusters.lightTexture);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, buffer);
+
+    clusters.count = 0;
+}
+
+/* Adds a light, returns its index or -1 if there is no room left */
+int AddPointLight(float* position, float* color, float radius)
+{
+    if (clusters.count == maxPointLights) {
+        return -1;
+    }
+
+    PointLight* light = &clusters.lights[clusters.count];
+    memcpy(light->position, position, 3*sizeof(float));
+    memcpy(light->color, color, 3*sizeof(float));
+    light->radius = radius;
+
+    return clusters.count++;
+}
+
+void SetPointLightPosition(int index, float* position)
+{
+    memcpy(clusters.lights[index].position, position, 3*sizeof(float));
+}
+
+/* Where the next assignment is written to: pointers into the mapped
+ * frame data, and the offsets of the same ranges in the buffer */
+void SetClusterBuffers(void* data, GLintptr dataOffset, void* lightData, GLintptr lightDataOffset)
+{
+    clusters.data = data;
+    clusters.dataOffset = dataOffset;
+    clusters.lightData = lightData;
+    clusters.lightDataOffset = lightDataOffset;
+}
+
+/******************************************************************
+ * tileRange
+ * Tiles covered by the box [center - radius, center + radius] between
+ * two view space depths, along one screen axis. The projected
+ * coordinate x/depth is extreme at the corners of the box.
+ * Returns 0 if the box is outside of the screen
+ *******************************************************************/
+static int tileRange(float center, float radius, float nearDepth, float farDepth,
+        float projection, int tiles, int* first, int* last)
+{
+    float low = fminf((center - radius) / nearDepth, (center - radius) / farDepth) * projection;
+    float high = fmaxf((center + radius) / nearDepth, (center + radius) / farDepth) * projection;
+    if (low > 1. || high < -1.) {
+        return 0;
+    }
+
+    *first = clampi((int)floorf((low*.5 + .5) * tiles), 0, tiles - 1);
+    *last = clampi((int)floorf((high*.5 + .5) * tiles), 0, tiles - 1);
+    return 1;
+}
+
+/******************************************************************
+ * forEachCluster
+ * Calls the visitor for every cluster touched by the light at the
+ * view space position, slice by slice. Returns the number of clusters
+ *******************************************************************/
+static int forEachCluster(float* view, float radius, float* sliceDepth, float* projectionMatrix,
+        void (*visit)(int cluster, int light), int light)
+{
+    float depth = -view[2];
+    float nearest = fmaxf(depth - radius, sliceDepth[0]);
+    float farthest = fminf(depth + radius, sliceDepth[clusterSlices]);
+    if (nearest > farthest) {
+        return 0;
+    }
+
+    int firstSlice = clampi((int)(logf(nearest) * clusters.sliceScale + clusters.sliceBias), 0, clusterSlices - 1);
+    int lastSlice = clampi((int)(logf(farthest) * clusters.sliceScale + clusters.sliceBias), 0, clusterSlices - 1);
+
+    int touched = 0;
+    for (int z = firstSlice; z <= lastSlice; z++) {
+        float sliceNear = fmaxf(nearest, sliceDepth[z]);
+        float sliceFar = fminf(farthest, sliceDepth[z + 1]);
+
+        int x0, x1, y0, y1;
+        if (!tileRange(view[0], radius, sliceNear, sliceFar, projectionMatrix[0], clusterTilesX, &x0, &x1)
+                || !tileRange(view[1], radius, sliceNear, sliceFar, projectionMatrix[5], clusterTilesY, &y0, &y1)) {
+            continue;
+        }
+
+        for (int y = y0; y <= y1; y++) {
+            for (int x = x0; x <= x1; x++) {
+                visit(x + clusterTilesX * (y + clusterTilesY * z), light);
+                touched++;
+            }
+        }
+    }
+    return touched;
+}
+
+static void countLight(int cluster, int light)
+{
+    counts[cluster]++;
+}
+
+static void writeLight(int cluster, int light)
+{
+    if (filled[cluster] < counts[cluster]) {
+        clusters.data[offsets[cluster] + filled[cluster]++] = light;
+    }
+}
+
+/******************************************************************
+ * AssignClusterLights
+ * Moves all point lights to view space and writes the lights of every
+ * cluster into the frame data: a first pass counts the lights per
+ * cluster, the prefix sum gives the offsets into the index list, and a
+ * second pass fills it. Expects a symmetric perspective projection
+ *******************************************************************/
+void AssignClusterLights(float* viewMatrix, float* projectionMatrix, float nearPlane, float farPlane)
+{
+    double start = milliseconds();
+
+    // exponential slices: the depth of slice z is near * (far/near)^(z/slices)
+    float sliceDepth[clusterSlices + 1];
+    for (int z = 0; z <= clusterSlices; z++) {
+        sliceDepth[z] = nearPlane * powf(farPlane / nearPlane, (float)z / clusterSlices);
+    }
+    clusters.sliceScale = clusterSlices / logf(farPlane / nearPlane);
+    clusters.sliceBias = -logf(nearPlane) * clusters.sliceScale;
+
+    memset(counts, 0, sizeof(counts));
+    memset(filled, 0, sizeof(filled));
+
+    float* v = viewMatrix;
+
+    // count, and keep the lights which touch a cluster
+    clusterStats.visible = 0;
+    for (int i = 0; i < clusters.count; i++) {
+        float* p = clusters.lights[i].position;
+        view[i][0] = v[0]*p[0] + v[1]*p[1] + v[2]*p[2] + v[3];
+        view[i][1] = v[4]*p[0] + v[5]*p[1] + v[6]*p[2] + v[7];
+        view[i][2] = v[8]*p[0] + v[9]*p[1] + v[10]*p[2] + v[11];
+
+        visible[i] = -1;
+        if (forEachCluster(view[i], clusters.lights[i].radius, sliceDepth, projectionMatrix, countLight, 0) == 0) {
+            continue;
+        }
+        visible[i] = clusterStats.visible++;
+
+        float* light = clusters.lightData + 8*visible[i];
+        memcpy(light, view[i], 3*sizeof(float));
+        light[3] = clusters.lights[i].radius;
+        memcpy(light + 4, clusters.lights[i].color, 3*sizeof(float));
+        light[7] = 0.;
+    }
+
+    // offsets, clusters past the end of the list lose their lights
+    GLuint offset = 2*clusterCount;
+    GLuint end = 2*clusterCount + maxClusterIndices;
+    clusterStats.maxPerCluster = 0;
+    clusterStats.dropped = 0;
+    for (int c = 0; c < clusterCount; c++) {
+        if (counts[c] > clusterStats.maxPerCluster) {
+            clusterStats.maxPerCluster = counts[c];
+        }
+        if (counts[c] > end - offset) {
+            clusterStats.dropped += counts[c] - (end - offset);
+            counts[c] = end - offset;
+        }
+        offsets[c] = offset;
+        clusters.data[2*c] = offset;
+        clusters.data[2*c + 1] = counts[c];
+        offset += counts[c];
+    }
+
+    for (int i = 0; i < clusters.count; i++) {
+        if (visible[i] >= 0) {
+            forEachCluster(view[i], clusters.lights[i].radius, sliceDepth, projectionMatrix, writeLight, visible[i]);
+        }
+    }
+
+    clusterStats.lights = clusters.count;
+    clusterStats.indices = offset - 2*clusterCount;
+    clusterStats.time = milliseconds() - start;
+}
+
+/******************************************************************
+ * BindClusterLights
+ * Binds the clusters of the current frame for the program, which
+ * draws into a viewport of the given size
+ *******************************************************************/
+void BindClusterLights(GLuint program, float width, float height)
+{
+    StateActiveTexture(clusterDataUnit);
+    StateBindTexture(GL_TEXTURE_BUFFER, clusters.dataTexture);
+    StateActiveTexture(clusterLightUnit);
+    StateBindTexture(GL_TEXTURE_BUFFER, clusters.lightTexture);
+    StateActiveTexture(0);
+
+    EnableTexture("ClusterData", program, clusterDataUnit);
+    EnableTexture("PointLights", program, clusterLightUnit);
+    BindUniform1i("ClusterDataOffset", program, clusters.dataOffset / sizeof(GLuint));
+    BindUniform1i("PointLightsOffset", program, clusters.lightDataOffset / (4*sizeof(float)));
+    glUniform2f(glGetUniformLocation(program, "ClusterTileSize"), width / clusterTilesX, height / clusterTilesY);
+    glUniform2f(glGetUniformLocation(program, "ClusterSlices"), clusters.sliceScale, clusters.sliceBias);
+}
+
+void PrintClusterStats()
+{
+    printf("clustered lights: %d of %d point lights visible, %d indices (max %d per cluster, %d dropped), %.3f ms\n",
+            clusterStats.visible, clusterStats.lights, clusterStats.indices, clusterStats.maxPerCluster,
+            clusterStats.dropped, clusterStats.time);
+}
@@ -0,0 +1,65 @@
+#ifndef SOLAR_SYSTEM_CLUSTERS
+#define SOLAR_SYSTEM_CLUSTERS
+
+/* Clustered forward lighting: the view frustum is split into tiles on
+ * the screen and exponential slices in depth. Every frame, each point
+ * light is assigned to the clusters it touches, and the lit shaders only
+ * loop over the lights of the cluster of the fragment. Passed to the
+ * shaders as the CLUSTER_* defines */
+#define clusterTilesX 16
+#define clusterTilesY 9
+#define clusterSlices 24
+#define clusterCount (clusterTilesX*clusterTilesY*clusterSlices)
+
+#define maxPointLights 1024
+#define maxClusterIndices 65536
+
+typedef struct pointLight {
+    float position[3]; // world space
+    float color[3];
+    float radius; // the light does not reach further
+} PointLight;
+
+typedef struct clusters {
+    PointLight lights[maxPointLights];
+    int count;
+
+    // written every frame, into the buffer ranges set by SetClusterBuffers
+    GLuint* data; // offset and count of every cluster, followed by the light indices
+    GLintptr dataOffset;
+    float* lightData; // view space position and radius, and color of the visible lights
+    GLintptr lightDataOffset;
+
+    // views of the whole buffer, the offsets select the ranges of the frame
+    GLuint dataTexture;
+    GLuint lightTexture;
+
+    // slice of a view space depth z: log(z) * sliceScale + sliceBias
+    float sliceScale;
+    float sliceBias;
+} Clusters;
+
+/* Counters of the last assignment */
+typedef struct clusterStats {
+    int lights;
+    int visible; // lights touching at least one cluster
+    int indices; // light indices of all clusters
+    int maxPerCluster;
+    int dropped; // indices which did not fit into the list
+    double time; // milliseconds spent assigning
+} ClusterStats;
+
+extern Clusters clusters;
+extern ClusterStats clusterStats;
+
+GLsizeiptr ClusterDataSize();
+GLsizeiptr ClusterLightDataSize();
+void InitClusters(GLuint buffer);
+int AddPointLight(float* position, float* color, float radius);
+void SetPointLightPosition(int index, float* position);
+void SetClusterBuffers(void* data, GLintptr dataOffset, void* lightData, GLintptr lightDataOffset);
+void AssignClusterLights(float* viewMatrix, float* projectionMatrix, float nearPlane, float farPlane);
+void BindClusterLights(GLuint program, float width, float height);
+void PrintClusterStats();
+
+#endif
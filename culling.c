@@ -0,0 +1,276 @@
+#include "stdio.h"
+#include "stdlib.h"
+#include "math.h"
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE__)
+#include <xmmintrin.h>
+#endif
+
+#include "source/Matrix.h"
+#include "culling.h"
+
+CullStats cullStats;
+
+/* the arrays are padded, so the vectorized loop can always read full lanes */
+#define cullLaneWidth 8
+
+static float clampf(float val, float min, float max)
+{
+    return val < min ? min : (val > max ? max : val);
+}
+
+void InitSphereSet(SphereSet* set, int capacity)
+{
+    int padded = (capacity + cullLaneWidth - 1) / cullLaneWidth * cullLaneWidth;
+
+    set->x = calloc(padded, sizeof(float));
+    set->y = calloc(padded, sizeof(float));
+    set->z = calloc(padded, sizeof(float));
+    set->radius = calloc(padded, sizeof(float));
+    set->visible = calloc(padded, sizeof(unsigned char));
+    set->count = capacity;
+    set->capacity = padded;
+}
+
+/******************************************************************
+ * SetSphere
+ * Transforms the object space sphere of a mesh into world space.
+ * The radius is scaled by the largest axis scale of the (row major)
+ * transformation, so non uniform scaling stays conservative
+ *******************************************************************/
+void SetSphere(SphereSet* set, int index, float* transformation, float* localSphere)
+{
+    float* m = transformation;
+    float* c = localSphere;
+
+    set->x[index] = m[0]*c[0] + m[1]*c[1] + m[2]*c[2] + m[3];
+    set->y[index] = m[4]*c[0] + m[5]*c[1] + m[6]*c[2] + m[7];
+    set->z[index] = m[8]*c[0] + m[9]*c[1] + m[10]*c[2] + m[11];
+
+    float scaleX = m[0]*m[0] + m[4]*m[4] + m[8]*m[8];
+    float scaleY = m[1]*m[1] + m[5]*m[5] + m[9]*m[9];
+    float scaleZ = m[2]*m[2] + m[6]*m[6] + m[10]*m[10];
+    float scale = fmaxf(scaleX, fmaxf(scaleY, scaleZ));
+
+    set->radius[index] = c[3] * sqrtf(scale);
+}
+
+/******************************************************************
+ * ExtractFrustumPlanes
+ * Gribb/Hartmann plane extraction: with the row major clip matrix
+ * M = Projection * View, the planes are sums and differences of the
+ * fourth row with the other rows
+ *******************************************************************/
+void ExtractFrustumPlanes(float* viewMatrix, float* projectionMatrix, Frustum* frustum)
+{
+    float m[16];
+    MultiplyMatrix(projectionMatrix, viewMatrix, m);
+
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 4; j++) {
+            frustum->planes[i*2][j] = m[12 + j] + m[i*4 + j];
+            frustum->planes[i*2 + 1][j] = m[12 + j] - m[i*4 + j];
+        }
+    }
+
+    // normalize, so the plane equation returns the distance
+    for (int i = 0; i < 6; i++) {
+        float* p = frustum->planes[i];
+        float length = sqrtf(p[0]*p[0] + p[1]*p[1] + p[2]*p[2]);
+        p[0] /= length;
+        p[1] /= length;
+        p[2] /= length;
+        p[3] /= length;
+    }
+}
+
+/******************************************************************
+ * CullSpheres
+ * Tests all spheres of the set against the frustum. A sphere is
+ * visible unless it lies completely behind one of the planes.
+ * Uses 8 (AVX) or 4 (SSE) spheres per iteration when available
+ *******************************************************************/
+void CullSpheres(Frustum* frustum, SphereSet* set)
+{
+    int i = 0;
+
+#if defined(__AVX__)
+    for (; i < set->count; i += 8) {
+        __m256 x = _mm256_loadu_ps(set->x + i);
+        __m256 y = _mm256_loadu_ps(set->y + i);
+        __m256 z = _mm256_loadu_ps(set->z + i);
+        __m256 negRadius = _mm256_sub_ps(_mm256_setzero_ps(), _mm256_loadu_ps(set->radius + i));
+        __m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+
+        for (int p = 0; p < 6; p++) {
+            float* plane = frustum->planes[p];
+            __m256 distance = _mm256_add_ps(
+                    _mm256_add_ps(_mm256_mul_ps(x, _mm256_set1_ps(plane[0])), _mm256_mul_ps(y, _mm256_set1_ps(plane[1]))),
+                    _mm256_add_ps(_mm256_mul_ps(z, _mm256_set1_ps(plane[2])), _mm256_set1_ps(plane[3])));
+            inside = _mm256_and_ps(inside, _mm256_cmp_ps(distance, negRadius, _CMP_GT_OQ));
+        }
+
+        int mask = _mm256_movemask_ps(inside);
+        for (int k = 0; k < 8; k++) {
+            set->visible[i + k] = (mask >> k) & 1;
+        }
+    }
+#elif defined(__SSE__)
+    for (; i < set->count; i += 4) {
+        __m128 x = _mm_loadu_ps(set->x + i);
+        __m128 y = _mm_loadu_ps(set->y + i);
+        __m128 z = _mm_loadu_ps(set->z + i);
+        __m128 negRadius = _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(set->radius + i));
+        __m128 inside = _mm_cmpeq_ps(x, x); // all bits set
+
+        for (int p = 0; p < 6; p++) {
+            float* plane = frustum->planes[p];
+            __m128 distance = _mm_add_ps(
+                    _mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(plane[0])), _mm_mul_ps(y, _mm_set1_ps(plane[1]))),
+                    _mm_add_ps(_mm_mul_ps(z, _mm_set1_ps(plane[2])), _mm_set1_ps(plane[3])));
+            inside = _mm_and_ps(inside, _mm_cmpgt_ps(distance, negRadius));
+        }
+
+        int mask = _mm_movemask_ps(inside);
+        for (int k = 0; k < 4; k++) {
+            set->visible[i + k] = (mask >> k) & 1;
+        }
+    }
+#else
+    for (; i < set->count; i++) {
+        set->visible[i] = 1;
+        for (int p = 0; p < 6; p++) {
+            float* plane = frustum->planes[p];
+            float distance = plane[0]*set->x[i] + plane[1]*set->y[i] + plane[2]*set->z[i] + plane[3];
+            if (distance <= -set->radius[i]) {
+                set->visible[i] = 0;
+                break;
+            }
+        }
+    }
+#endif
+
+    cullStats.visible = 0;
+    for (i = 0; i < set->count; i++) {
+        cullStats.visible += set->visible[i];
+    }
+    cullStats.culled = set->count - cullStats.visible;
+}
+
+/******************************************************************
+ * SelectOccluders
+ * Picks the candidates with the largest angular radius as seen from
+ * the eye. Candidates with radius 0, outside of the screen, or
+ * containing the eye are skipped
+ *******************************************************************/
+void SelectOccluders(SphereSet* candidates, unsigned char* onScreen, float* eye, Occluders* occluders)
+{
+    // skip tiny occluders, they hardly hide anything (about 1 degree)
+    float minAngularRadius = .02;
+    float size[maxOccluders];
+
+    occluders->count = 0;
+    for (int i = 0; i < candidates->count; i++) {
+        float radius = candidates->radius[i];
+        if (radius <= 0. || !onScreen[i]) {
+            continue;
+        }
+
+        float dx = candidates->x[i] - eye[0];
+        float dy = candidates->y[i] - eye[1];
+        float dz = candidates->z[i] - eye[2];
+        float distance = sqrtf(dx*dx + dy*dy + dz*dz);
+        if (distance <= radius || radius / distance < minAngularRadius) {
+            continue;
+        }
+
+        // insertion into the list, sorted by size
+        float angularRadius = radius / distance;
+        int k = occluders->count < maxOccluders ? occluders->count++ : maxOccluders;
+        while (k > 0 && size[k - 1] < angularRadius) {
+            if (k < maxOccluders) {
+                size[k] = size[k - 1];
+                occluders->x[k] = occluders->x[k - 1];
+                occluders->y[k] = occluders->y[k - 1];
+                occluders->z[k] = occluders->z[k - 1];
+                occluders->radius[k] = occluders->radius[k - 1];
+            }
+            k--;
+        }
+        if (k < maxOccluders) {
+            size[k] = angularRadius;
+            occluders->x[k] = candidates->x[i];
+            occluders->y[k] = candidates->y[i];
+            occluders->z[k] = candidates->z[i];
+            occluders->radius[k] = radius;
+        }
+    }
+}
+
+/******************************************************************
+ * CullOccluded
+ * Seen from the eye, every occluder hides a cone with half angle
+ * asin(R/d). A visible sphere is rejected if it lies completely inside
+ * of that cone, and completely behind the distance of the points where
+ * the cone touches the occluder: every ray to it hits the occluder first
+ *******************************************************************/
+void CullOccluded(Occluders* occluders, float* eye, SphereSet* set)
+{
+    float direction[maxOccluders][3];
+    float coneAngle[maxOccluders];
+    float tangentDistance[maxOccluders];
+
+    for (int k = 0; k < occluders->count; k++) {
+        float o[3] = {occluders->x[k] - eye[0], occluders->y[k] - eye[1], occluders->z[k] - eye[2]};
+        float distance = sqrtf(o[0]*o[0] + o[1]*o[1] + o[2]*o[2]);
+        float radius = occluders->radius[k];
+
+        NormalizeVector(o, direction[k]);
+        coneAngle[k] = asinf(radius / distance);
+        tangentDistance[k] = sqrtf(distance*distance - radius*radius);
+    }
+
+    cullStats.occluders = occluders->count;
+    cullStats.occluded = 0;
+    if (occluders->count == 0) {
+        return;
+    }
+
+    for (int i = 0; i < set->count; i++) {
+        if (!set->visible[i]) {
+            continue;
+        }
+
+        float v[3] = {set->x[i] - eye[0], set->y[i] - eye[1], set->z[i] - eye[2]};
+        float distance = sqrtf(v[0]*v[0] + v[1]*v[1] + v[2]*v[2]);
+        float radius = set->radius[i];
+        if (distance <= radius) {
+            continue;
+        }
+
+        float sphereAngle = asinf(radius / distance);
+        for (int k = 0; k < occluders->count; k++) {
+            if (distance - radius < tangentDistance[k]) {
+                continue;
+            }
+
+            float cosAngle = (v[0]*direction[k][0] + v[1]*direction[k][1] + v[2]*direction[k][2]) / distance;
+            float angle = acosf(clampf(cosAngle, -1., 1.));
+            if (angle + sphereAngle <= coneAngle[k]) {
+                set->visible[i] = 0;
+                cullStats.occluded++;
+                break;
+            }
+        }
+    }
+
+    cullStats.visible -= cullStats.occluded;
+}
+
+void PrintCullStats()
+{
+    printf("frustum culling: %d visible, %d culled\n", cullStats.visible, cullStats.culled);
+    printf("occlusion culling: %d occluders, %d occluded\n", cullStats.occluders, cullStats.occluded);
+}
@@ -0,0 +1,50 @@
+#ifndef SOLAR_SYSTEM_CULLING
+#define SOLAR_SYSTEM_CULLING
+
+/* Normalized planes (a, b, c, d) of the view frustum, pointing inwards:
+ * left, right, bottom, top, near, far */
+typedef struct frustum {
+    float planes[6][4];
+} Frustum;
+
+/* World space bounding spheres of all cullable objects, stored as
+ * structure of arrays so several spheres can be tested at once */
+typedef struct sphereSet {
+    float* x;
+    float* y;
+    float* z;
+    float* radius;
+    unsigned char* visible; // result of the last CullSpheres call
+    int count;
+    int capacity;
+} SphereSet;
+
+/* The largest spheres on screen, used to reject everything hidden
+ * behind them; see SelectOccluders */
+#define maxOccluders 4
+typedef struct occluders {
+    float x[maxOccluders];
+    float y[maxOccluders];
+    float z[maxOccluders];
+    float radius[maxOccluders];
+    int count;
+} Occluders;
+
+typedef struct cullStats {
+    int visible;
+    int culled; // outside of the frustum
+    int occluders;
+    int occluded; // inside of the frustum, but hidden behind an occluder
+} CullStats;
+
+extern CullStats cullStats;
+
+void InitSphereSet(SphereSet* set, int capacity);
+void SetSphere(SphereSet* set, int index, float* transformation, float* localSphere);
+void ExtractFrustumPlanes(float* viewMatrix, float* projectionMatrix, Frustum* frustum);
+void CullSpheres(Frustum* frustum, SphereSet* set);
+void SelectOccluders(SphereSet* candidates, unsigned char* onScreen, float* eye, Occluders* occluders);
+void CullOccluded(Occluders* occluders, float* eye, SphereSet* set);
+void PrintCullStats();
+
+#endif
@@ -0,0 +1,160 @@
+#include "stdio.h"
+#include "stdlib.h"
+#include "math.h"
+#include "GL/glew.h"
+
+#include "utils.h"
+#include "exposure.h"
+#include "glstate.h"
+
+ExposureStats exposureStats;
+
+void InitExposure(Exposure* exposure, float value)
+{
+    exposure->levels = 1;
+    for (int size = exposureSize; size > 1; size /= 2) {
+        exposure->levels++;
+    }
+
+    // red: sum of the log luminance of lit pixels, green: their number;
+    // both are averaged by the mipmaps
+    glGenTextures(1, &exposure->texture);
+    glBindTexture(GL_TEXTURE_2D, exposure->texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RG32F, exposureSize, exposureSize, 0, GL_RG, GL_FLOAT, NULL);
+    glGenerateMipmap(GL_TEXTURE_2D);
+
+    glGenFramebuffers(1, &exposure->framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, exposure->framebuffer);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, exposure->texture, 0);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        fprintf(stderr, "Exposure Framebuffer not complete!\n");
+        exit(-1);
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    glGenBuffers(exposureReadbacks, exposure->buffers);
+    for (int i = 0; i < exposureReadbacks; i++) {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, exposure->buffers[i]);
+        glBufferData(GL_PIXEL_PACK_BUFFER, 2 * sizeof(float), NULL, GL_STREAM_READ);
+        exposure->fences[i] = NULL;
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    exposure->next = 0;
+    exposure->frame = 0;
+    ResetExposure(exposure, value);
+}
+
+/* Starts adapting anew from the value; measurements still on their way
+ * are dropped */
+void ResetExposure(Exposure* exposure, float value)
+{
+    for (int i = 0; i < exposureReadbacks; i++) {
+        if (exposure->fences[i] != NULL) {
+            glDeleteSync(exposure->fences[i]);
+            exposure->fences[i] = NULL;
+        }
+    }
+    exposure->value = value;
+    exposure->target = value;
+    exposure->time = milliseconds();
+}
+
+/******************************************************************
+ * MeasureExposure
+ * Draws the log luminance of the scene texture, averages it by
+ * generating the mipmaps and copies the last level into a free pixel
+ * buffer. Skipped if the GPU did not yet finish all earlier copies.
+ * Changes the viewport, the caller has to restore it
+ *******************************************************************/
+void MeasureExposure(Exposure* exposure, GLuint program, GLuint scene)
+{
+    exposure->frame++;
+    int buffer = exposure->next;
+    if (exposure->fences[buffer] != NULL) {
+        exposureStats.skipped++;
+        return;
+    }
+
+    StateBindFramebuffer(GL_FRAMEBUFFER, exposure->framebuffer);
+    glViewport(0, 0, exposureSize, exposureSize);
+    StateUseProgram(program);
+    ActivateTexture(0, scene);
+    EnableTexture("scene", program, 0);
+    DrawFrontScreen();
+
+    StateBindTexture(GL_TEXTURE_2D, exposure->texture);
+    glGenerateMipmap(GL_TEXTURE_2D);
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, exposure->buffers[buffer]);
+    glGetTexImage(GL_TEXTURE_2D, exposure->levels - 1, GL_RG, GL_FLOAT, 0);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    exposure->fences[buffer] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    exposure->frames[buffer] = exposure->frame;
+    exposure->next = (buffer + 1) % exposureReadbacks;
+}
+
+/* Reads the measurements the GPU finished, oldest first; returns if one
+ * was read */
+static int readMeasurements(Exposure* exposure)
+{
+    int read = 0;
+    for (int i = 0; i < exposureReadbacks; i++) {
+        int buffer = (exposure->next + i) % exposureReadbacks;
+        GLsync fence = exposure->fences[buffer];
+        if (fence == NULL) {
+            continue;
+        }
+
+        GLenum result = glClientWaitSync(fence, 0, 0);
+        if (result == GL_TIMEOUT_EXPIRED) {
+            break;
+        }
+        if (result == GL_WAIT_FAILED) {
+            fprintf(stderr, "Error waiting for the exposure fence\n");
+            exit(-1);
+        }
+        glDeleteSync(fence);
+        exposure->fences[buffer] = NULL;
+
+        float average[2];
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, exposure->buffers[buffer]);
+        glGetBufferSubData(GL_PIXEL_PACK_BUFFER, 0, sizeof(average), average);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+        exposureStats.latency = exposure->frame - exposure->frames[buffer];
+        exposureStats.coverage = average[1];
+        if (average[1] > 0) {
+            exposureStats.luminance = exp(average[0] / average[1]);
+            exposure->target = clamp(exposureKey / exposureStats.luminance, maxExposure, minExposure);
+        }
+        read = 1;
+    }
+    return read;
+}
+
+/******************************************************************
+ * AdaptExposure
+ * Moves the exposure towards the one of the latest measurement, the
+ * further away the faster
+ *******************************************************************/
+void AdaptExposure(Exposure* exposure)
+{
+    readMeasurements(exposure);
+
+    double now = milliseconds();
+    double seconds = (now - exposure->time) / 1000.;
+    exposure->time = now;
+
+    // adapt in log space, so brightening and darkening take as long
+    float step = 1. - exp(-seconds * exposureRate);
+    exposure->value = exp(log(exposure->value) + (log(exposure->target) - log(exposure->value)) * step);
+}
+
+void PrintExposureStats(Exposure* exposure)
+{
+    printf("exposure: %.3f, adapting to %.3f\n", exposure->value, exposure->target);
+    printf("exposure: average luminance %.3f over %.0f%% of the screen, read %d frames later, %d skipped\n",
+            exposureStats.luminance, exposureStats.coverage * 100., exposureStats.latency, exposureStats.skipped);
+}
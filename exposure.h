@@ -0,0 +1,50 @@
+#ifndef SOLAR_SYSTEM_EXPOSURE
+#define SOLAR_SYSTEM_EXPOSURE
+
+/* Automatic exposure: the log luminance of the scene is drawn into a
+ * small target and averaged by its mipmaps. The single value of the
+ * last level is copied into a pixel buffer and read a few frames later,
+ * once its fence is signaled, so the CPU never waits for the GPU. The
+ * exposure then adapts to it over time, like an eye */
+#define exposureSize 128
+#define exposureReadbacks 3
+
+/* the exposure maps the average luminance to exposureKey before tone
+ * mapping, within the limits; it adapts by exposureRate per second */
+#define exposureKey .5
+#define minExposure .02
+#define maxExposure 2.
+#define exposureRate 1.5
+
+typedef struct exposure {
+    GLuint texture; // log luminance and coverage, with mipmaps
+    GLuint framebuffer;
+    int levels;
+
+    GLuint buffers[exposureReadbacks]; // pixel buffers of the readbacks
+    GLsync fences[exposureReadbacks]; // NULL if the buffer is free
+    int frames[exposureReadbacks]; // frame of the measurement
+    int next; // buffer of the next measurement
+    int frame;
+
+    float value; // current exposure
+    float target;
+    double time; // of the last adaption, milliseconds
+} Exposure;
+
+typedef struct exposureStats {
+    float luminance; // average luminance of the lit pixels, last read
+    float coverage; // part of the screen which is lit
+    int latency; // frames between measuring and reading it
+    int skipped; // measurements skipped, all buffers were busy
+} ExposureStats;
+
+extern ExposureStats exposureStats;
+
+void InitExposure(Exposure* exposure, float value);
+void ResetExposure(Exposure* exposure, float value);
+void MeasureExposure(Exposure* exposure, GLuint program, GLuint scene);
+void AdaptExposure(Exposure* exposure);
+void PrintExposureStats(Exposure* exposure);
+
+#endif
@@ -0,0 +1,432 @@
+#include "stdio.h"
+#include "stdlib.h"
+#include "string.h"
+#include "GL/glew.h"
+
+#include "framegraph.h"
+#include "glstate.h"
+
+FrameGraphStats frameGraphStats;
+
+static int isDepthFormat(GLenum format)
+{
+    return format == GL_DEPTH_COMPONENT16 || format == GL_DEPTH_COMPONENT24 || format == GL_DEPTH_COMPONENT32F;
+}
+
+static int bytesPerTexel(GLenum format)
+{
+    switch (format) {
+        case GL_RGBA16F: return 8;
+        case GL_RGBA32F: return 16;
+        case GL_R16F: case GL_DEPTH_COMPONENT16: return 2;
+        case GL_DEPTH_COMPONENT32F: case GL_R32F: return 4;
+        default: return 4;
+    }
+}
+
+/* Starts declaring the passes of a new frame */
+void ResetFrameGraph(FrameGraph* graph)
+{
+    graph->passCount = 0;
+    graph->resourceCount = 0;
+}
+
+static int addResource(FrameGraph* graph, const char* name)
+{
+    if (graph->resourceCount == maxGraphResources) {
+        fprintf(stderr, "Too many resources in the frame graph, adding %s\n", name);
+        exit(-1);
+    }
+
+    GraphResource* resource = &graph->resources[graph->resourceCount];
+    memset(resource, 0, sizeof(GraphResource));
+    resource->name = name;
+    return graph->resourceCount++;
+}
+
+/* Declares a transient texture, backed by the pool while it is needed */
+int CreateGraphTexture(FrameGraph* graph, const char* name, GLenum format, int width, int height)
+{
+    int index = addResource(graph, name);
+    graph->resources[index].format = format;
+    graph->resources[index].width = width;
+    graph->resources[index].height = height;
+    return index;
+}
+
+/* Declares a texture allocated outside of the graph */
+int ImportGraphTexture(FrameGraph* graph, const char* name, GLuint id)
+{
+    int index = addResource(graph, name);
+    graph->resources[index].imported = 1;
+    graph->resources[index].id = id;
+    return index;
+}
+
+/* Adds a pass, executed in the order of adding */
+int AddGraphPass(FrameGraph* graph, const char* name, void (*execute)(FrameGraph* graph))
+{
+    if (graph->passCount == maxGraphPasses) {
+        fprintf(stderr, "Too many passes in the frame graph, adding %s\n", name);
+        exit(-1);
+    }
+
+    GraphPass* pass = &graph->passes[graph->passCount];
+    memset(pass, 0, sizeof(GraphPass));
+    pass->name = name;
+    pass->execute = execute;
+    return graph->passCount++;
+}
+
+void GraphPassReads(FrameGraph* graph, int pass, int resource)
+{
+    GraphPass* p = &graph->passes[pass];
+    if (p->readCount == maxPassResources) {
+        fprintf(stderr, "Pass %s reads too many resources\n", p->name);
+        exit(-1);
+    }
+    p->reads[p->readCount++] = resource;
+}
+
+/* Color attachments are numbered in the order of the writes, like the
+ * outputs of the shaders; a depth format is the depth attachment */
+void GraphPassWrites(FrameGraph* graph, int pass, int resource)
+{
+    GraphPass* p = &graph->passes[pass];
+    if (p->writeCount == maxPassResources) {
+        fprintf(stderr, "Pass %s writes too many resources\n", p->name);
+        exit(-1);
+    }
+    p->writes[p->writeCount++] = resource;
+}
+
+void GraphPassOutput(FrameGraph* graph, int pass, int width, int height)
+{
+    graph->passes[pass].output = 1;
+    graph->passes[pass].outputWidth = width;
+    graph->passes[pass].outputHeight = height;
+}
+
+/* For passes whose results are read back by the CPU */
+void GraphPassKeep(FrameGraph* graph, int pass)
+{
+    graph->passes[pass].kept = 1;
+}
+
+/******************************************************************
+ * cullPasses
+ * Walks back from the passes drawing to the window and the kept ones:
+ * a pass is only executed if a later executed pass reads something it
+ * writes
+ *******************************************************************/
+static void cullPasses(FrameGraph* graph)
+{
+    for (int i = graph->passCount - 1; i >= 0; i--) {
+        GraphPass* pass = &graph->passes[i];
+        pass->culled = !pass->output && !pass->kept;
+        for (int j = 0; j < pass->writeCount && pass->culled; j++) {
+            pass->culled = !graph->resources[pass->writes[j]].needed;
+        }
+        if (pass->culled) {
+            continue;
+        }
+        for (int j = 0; j < pass->readCount; j++) {
+            graph->resources[pass->reads[j]].needed = 1;
+        }
+    }
+}
+
+static void extendLifetime(GraphResource* resource, int pass)
+{
+    if (resource->first < 0) {
+        resource->first = pass;
+    }
+    resource->last = pass;
+}
+
+/* If the framebuffer has a texture of the pool attached which is
+ * released this frame */
+static int attachesReleased(FrameGraph* graph, PooledFramebuffer* framebuffer)
+{
+    for (int i = 0; i < framebuffer->count; i++) {
+        for (int j = 0; j < graph->textureCount; j++) {
+            if (graph->textures[j].id == framebuffer->attachments[i]
+                    && graph->textures[j].idleFrames > graphIdleFrames) {
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+/* Releases the textures and framebuffers no frame used for a while */
+static void releaseUnused(FrameGraph* graph)
+{
+    int released = 0;
+
+    for (int i = 0; i < graph->textureCount; i++) {
+        PooledTexture* texture = &graph->textures[i];
+        texture->idleFrames = texture->used ? 0 : texture->idleFrames + 1;
+        frameGraphStats.idleTextures += !texture->used;
+    }
+
+    // framebuffers go with their textures, a new texture may get the name
+    int count = 0;
+    for (int i = 0; i < graph->framebufferCount; i++) {
+        PooledFramebuffer* framebuffer = &graph->framebuffers[i];
+        framebuffer->idleFrames = framebuffer->used ? 0 : framebuffer->idleFrames + 1;
+        if (framebuffer->idleFrames <= graphIdleFrames && !attachesReleased(graph, framebuffer)) {
+            graph->framebuffers[count++] = *framebuffer;
+        } else {
+            glDeleteFramebuffers(1, &framebuffer->id);
+            released = 1;
+        }
+    }
+    graph->framebufferCount = count;
+
+    count = 0;
+    for (int i = 0; i < graph->textureCount; i++) {
+        if (graph->textures[i].idleFrames <= graphIdleFrames) {
+            graph->textures[count++] = graph->textures[i];
+        } else {
+            glDeleteTextures(1, &graph->textures[i].id);
+            released = 1;
+        }
+    }
+    graph->textureCount = count;
+
+    // the names may be reused by the next textures and framebuffers
+    if (released) {
+        InvalidateGLState();
+    }
+}
+
+/******************************************************************
+ * assignTexture
+ * Backs the transient resource with a texture of the pool. Resources
+ * are assigned in the order they are first used, so a texture whose
+ * resources were all used up before can take the next one
+ *******************************************************************/
+static void assignTexture(FrameGraph* graph, GraphResource* resource)
+{
+    for (int i = 0; i < graph->textureCount; i++) {
+        PooledTexture* texture = &graph->textures[i];
+        if (texture->format == resource->format && texture->width == resource->width
+                && texture->height == resource->height
+                && (!texture->used || texture->freeAfter < resource->first)) {
+            if (!texture->used) {
+                frameGraphStats.textures++;
+                frameGraphStats.bytes += (long)texture->width * texture->height * bytesPerTexel(texture->format);
+            }
+            texture->used = 1;
+            texture->freeAfter = resource->last;
+            resource->id = texture->id;
+            return;
+        }
+    }
+
+    if (graph->textureCount == maxGraphTextures) {
+        fprintf(stderr, "Frame graph texture pool exhausted by %s\n", resource->name);
+        exit(-1);
+    }
+
+    PooledTexture* texture = &graph->textures[graph->textureCount];
+    texture->format = resource->format;
+    texture->width = resource->width;
+    texture->height = resource->height;
+    texture->used = 1;
+    texture->freeAfter = resource->last;
+    texture->idleFrames = 0;
+
+    int depth = isDepthFormat(resource->format);
+    glGenTextures(1, &texture->id);
+    StateBindTexture(GL_TEXTURE_2D, texture->id);
+    glTexImage2D(GL_TEXTURE_2D, 0, resource->format, resource->width, resource->height, 0,
+            depth ? GL_DEPTH_COMPONENT : GL_RGBA, GL_FLOAT, NULL);
+    // color targets are scaled and filtered when sampled, and must
+    // not repeat at the edges
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, depth ? GL_NEAREST : GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, depth ? GL_NEAREST : GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    frameGraphStats.textures++;
+    frameGraphStats.bytes += (long)texture->width * texture->height * bytesPerTexel(texture->format);
+    resource->id = texture->id;
+    graph->textureCount++;
+}
+
+/******************************************************************
+ * assignFramebuffer
+ * Finds or creates the framebuffer with the transient writes of the
+ * pass attached. Writes nobody reads are left out, their color
+ * attachment is not drawn to
+ *******************************************************************/
+static void assignFramebuffer(FrameGraph* graph, GraphPass* pass)
+{
+    GLuint attachments[maxPassResources];
+    int attached = 0;
+    for (int i = 0; i < pass->writeCount; i++) {
+        GraphResource* resource = &graph->resources[pass->writes[i]];
+        attachments[i] = !resource->imported && resource->needed ? resource->id : 0;
+        attached |= attachments[i] != 0;
+    }
+    if (!attached) {
+        return;
+    }
+
+    for (int i = 0; i < graph->framebufferCount; i++) {
+        PooledFramebuffer* framebuffer = &graph->framebuffers[i];
+        if (framebuffer->count == pass->writeCount
+                && memcmp(framebuffer->attachments, attachments, pass->writeCount * sizeof(GLuint)) == 0) {
+            framebuffer->used = 1;
+            pass->framebuffer = framebuffer->id;
+            return;
+        }
+    }
+
+    if (graph->framebufferCount == maxGraphFramebuffers) {
+        fprintf(stderr, "Too many framebuffers in the frame graph, for pass %s\n", pass->name);
+        exit(-1);
+    }
+
+    PooledFramebuffer* framebuffer = &graph->framebuffers[graph->framebufferCount];
+    memcpy(framebuffer->attachments, attachments, sizeof(attachments));
+    framebuffer->count = pass->writeCount;
+    framebuffer->used = 1;
+    framebuffer->idleFrames = 0;
+
+    glGenFramebuffers(1, &framebuffer->id);
+    StateBindFramebuffer(GL_FRAMEBUFFER, framebuffer->id);
+
+    GLenum drawBuffers[maxPassResources];
+    int colors = 0;
+    for (int i = 0; i < pass->writeCount; i++) {
+        GraphResource* resource = &graph->resources[pass->writes[i]];
+        if (isDepthFormat(resource->format)) {
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, attachments[i], 0);
+            continue;
+        }
+        drawBuffers[colors] = attachments[i] ? GL_COLOR_ATTACHMENT0 + colors : GL_NONE;
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + colors, GL_TEXTURE_2D, attachments[i], 0);
+        colors++;
+    }
+    glDrawBuffers(colors, drawBuffers);
+
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        fprintf(stderr, "Frame graph framebuffer of pass %s not complete!\n", pass->name);
+        exit(-1);
+    }
+    pass->framebuffer = framebuffer->id;
+    graph->framebufferCount++;
+}
+
+/******************************************************************
+ * CompileFrameGraph
+ * Culls the passes, computes when every resource is needed, and backs
+ * the transient ones with textures and framebuffers of the pool
+ *******************************************************************/
+void CompileFrameGraph(FrameGraph* graph)
+{
+    memset(&frameGraphStats, 0, sizeof(frameGraphStats));
+    frameGraphStats.passes = graph->passCount;
+
+    for (int i = 0; i < graph->resourceCount; i++) {
+        graph->resources[i].needed = 0;
+        graph->resources[i].first = -1;
+        graph->resources[i].last = -1;
+    }
+    cullPasses(graph);
+
+    for (int i = 0; i < graph->passCount; i++) {
+        GraphPass* pass = &graph->passes[i];
+        pass->framebuffer = 0;
+        if (pass->culled) {
+            frameGraphStats.culled++;
+            continue;
+        }
+        for (int j = 0; j < pass->readCount; j++) {
+            extendLifetime(&graph->resources[pass->reads[j]], i);
+        }
+        for (int j = 0; j < pass->writeCount; j++) {
+            extendLifetime(&graph->resources[pass->writes[j]], i);
+        }
+    }
+
+    for (int i = 0; i < graph->textureCount; i++) {
+        graph->textures[i].used = 0;
+    }
+    for (int i = 0; i < graph->framebufferCount; i++) {
+        graph->framebuffers[i].used = 0;
+    }
+
+    // the resources in the order they are first used
+    for (int i = 0; i < graph->passCount; i++) {
+        for (int j = 0; j < graph->resourceCount; j++) {
+            GraphResource* resource = &graph->resources[j];
+            if (resource->first == i && resource->needed && !resource->imported) {
+                assignTexture(graph, resource);
+                frameGraphStats.resources++;
+                frameGraphStats.unaliasedBytes += (long)resource->width * resource->height * bytesPerTexel(resource->format);
+            }
+        }
+    }
+
+    for (int i = 0; i < graph->passCount; i++) {
+        if (!graph->passes[i].culled) {
+            assignFramebuffer(graph, &graph->passes[i]);
+        }
+    }
+    releaseUnused(graph);
+}
+
+/******************************************************************
+ * ExecuteFrameGraph
+ * Executes the passes which were not culled. Passes with attachments
+ * get their framebuffer bound and the viewport set to its size, the
+ * passes drawing to the window the window
+ *******************************************************************/
+void ExecuteFrameGraph(FrameGraph* graph)
+{
+    for (int i = 0; i < graph->passCount; i++) {
+        GraphPass* pass = &graph->passes[i];
+        if (pass->culled) {
+            continue;
+        }
+
+        if (pass->framebuffer) {
+            StateBindFramebuffer(GL_FRAMEBUFFER, pass->framebuffer);
+            for (int j = 0; j < pass->writeCount; j++) {
+                GraphResource* resource = &graph->resources[pass->writes[j]];
+                if (resource->needed && !resource->imported) {
+                    glViewport(0, 0, resource->width, resource->height);
+                    break;
+                }
+            }
+        } else if (pass->output) {
+            StateBindFramebuffer(GL_FRAMEBUFFER, 0);
+            glViewport(0, 0, pass->outputWidth, pass->outputHeight);
+        }
+        pass->execute(graph);
+    }
+}
+
+/* The texture holding the resource, valid after compiling */
+GLuint GraphTexture(FrameGraph* graph, int resource)
+{
+    return graph->resources[resource].id;
+}
+
+/* If a pass which is executed reads the resource */
+int GraphResourceNeeded(FrameGraph* graph, int resource)
+{
+    return graph->resources[resource].needed;
+}
+
+void PrintFrameGraphStats()
+{
+    printf("frame graph: %d passes, %d culled\n", frameGraphStats.passes, frameGraphStats.culled);
+    printf("frame graph: %d transient targets in %d textures, %.1f MB (%.1f MB without aliasing), %d idle textures kept\n",
+            frameGraphStats.resources, frameGraphStats.textures, frameGraphStats.bytes / 1048576.,
+            frameGraphStats.unaliasedBytes / 1048576., frameGraphStats.idleTextures);
+}
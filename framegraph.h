@@ -0,0 +1,114 @@
+#ifndef SOLAR_SYSTEM_FRAME_GRAPH
+#define SOLAR_SYSTEM_FRAME_GRAPH
+
+/* Frame graph: the passes of a frame and the render targets they read
+ * and write are declared anew every frame, then compiled and executed.
+ * Compiling culls the passes whose results nobody reads, and backs the
+ * targets which are only needed during the frame (transient ones) with
+ * textures of a pool: targets of the same format and size share one
+ * texture if they are not needed at the same time. Textures and
+ * framebuffers no frame used for graphIdleFrames are released, so a
+ * target which comes and goes, like the bright one with the sun, is not
+ * reallocated every time */
+
+#define maxGraphPasses 16
+#define maxGraphResources 16
+#define maxPassResources 4
+#define maxGraphTextures 16
+#define maxGraphFramebuffers 16
+#define graphIdleFrames 60
+
+struct frameGraph;
+
+typedef struct graphResource {
+    const char* name;
+    int imported; // owned by someone else, e.g. the bloom levels
+    GLenum format; // internal format of a transient resource
+    int width;
+    int height;
+
+    int needed; // read by a pass which is executed
+    int first; // first and last executed pass using it
+    int last;
+    GLuint id; // the texture holding the resource
+} GraphResource;
+
+typedef struct graphPass {
+    const char* name;
+    void (*execute)(struct frameGraph* graph);
+
+    // sampled, or tested against like a depth buffer
+    int reads[maxPassResources];
+    int readCount;
+    // attached as render targets; a pass only writing imported
+    // resources binds its own framebuffers
+    int writes[maxPassResources];
+    int writeCount;
+
+    int output; // draws to the window, never culled
+    int outputWidth;
+    int outputHeight;
+    int kept; // has effects outside of the graph, never culled
+
+    int culled;
+    GLuint framebuffer; // bound while executing, 0 if none
+} GraphPass;
+
+typedef struct pooledTexture {
+    GLuint id;
+    GLenum format;
+    int width;
+    int height;
+    int used; // backs a resource of the current frame
+    int freeAfter; // last pass of the resources it backed so far
+    int idleFrames; // since it last backed a resource
+} PooledTexture;
+
+typedef struct pooledFramebuffer {
+    GLuint id;
+    GLuint attachments[maxPassResources];
+    int count;
+    int used;
+    int idleFrames;
+} PooledFramebuffer;
+
+typedef struct frameGraph {
+    GraphPass passes[maxGraphPasses];
+    int passCount;
+    GraphResource resources[maxGraphResources];
+    int resourceCount;
+
+    // kept from frame to frame
+    PooledTexture textures[maxGraphTextures];
+    int textureCount;
+    PooledFramebuffer framebuffers[maxGraphFramebuffers];
+    int framebufferCount;
+} FrameGraph;
+
+typedef struct frameGraphStats {
+    int passes;
+    int culled;
+    int resources; // transient resources backed by textures
+    int textures;
+    int idleTextures; // kept in the pool, unused by the frame
+    long bytes; // memory of the textures
+    long unaliasedBytes; // memory with one texture per resource
+} FrameGraphStats;
+
+extern FrameGraphStats frameGraphStats;
+
+void ResetFrameGraph(FrameGraph* graph);
+int CreateGraphTexture(FrameGraph* graph, const char* name, GLenum format, int width, int height);
+int ImportGraphTexture(FrameGraph* graph, const char* name, GLuint id);
+int AddGraphPass(FrameGraph* graph, const char* name, void (*execute)(FrameGraph* graph));
+void GraphPassReads(FrameGraph* graph, int pass, int resource);
+void GraphPassWrites(FrameGraph* graph, int pass, int resource);
+void GraphPassOutput(FrameGraph* graph, int pass, int width, int height);
+void GraphPassKeep(FrameGraph* graph, int pass);
+void CompileFrameGraph(FrameGraph* graph);
+void ExecuteFrameGraph(FrameGraph* graph);
+GLuint GraphTexture(FrameGraph* graph, int resource);
+int GraphResourceNeeded(FrameGraph* graph, int resource);
+void PrintFrameGraphStats();
+
+#endif
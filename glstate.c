@@ -0,0 +1,289 @@
+#include "stdio.h"
+#include "GL/glew.h"
+
+#include "glstate.h"
+
+GLStateStats glStateStats;
+
+/* value of every cached state which is not known */
+#define stateUnknown 0xffffffff
+
+enum StateBufferTargets {
+    stateArrayBuffer, stateElementArrayBuffer, stateDrawIndirectBuffer,
+    stateUniformBuffer, stateShaderStorageBuffer, stateCopyWriteBuffer, stateBufferTargets
+};
+enum StateTextureTargets {stateTexture2D, stateTexture2DArray, stateTextureCubeMap, stateTextureBuffer, stateTextureTargets};
+enum StateCaps {stateBlend, stateDepthTest, stateCullFace, stateScissorTest, stateCaps};
+
+typedef struct indexedBinding {
+    GLuint buffer;
+    GLintptr offset;
+    GLsizeiptr size; // 0 for the whole buffer
+} IndexedBinding;
+
+static struct {
+    GLuint program;
+    GLuint vertexArray;
+    GLuint buffers[stateBufferTargets];
+    IndexedBinding uniformBindings[stateIndexedBindings];
+    IndexedBinding storageBindings[stateIndexedBindings];
+
+    GLuint activeTexture;
+    GLuint textures[stateTextureUnits][stateTextureTargets];
+
+    GLuint caps[stateCaps];
+    GLenum blendSource;
+    GLenum blendDestination;
+    GLenum depthFunc;
+    GLuint depthMask;
+
+    GLuint drawFramebuffer;
+    GLuint readFramebuffer;
+} cache;
+
+/* Counts the call and tells if it has to be issued */
+static int changes(GLuint* cached, GLuint value)
+{
+    if (*cached == value) {
+        glStateStats.skipped++;
+        return 0;
+    }
+    *cached = value;
+    glStateStats.issued++;
+    return 1;
+}
+
+static int bufferTarget(GLenum target)
+{
+    switch (target) {
+        case GL_ARRAY_BUFFER: return stateArrayBuffer;
+        case GL_ELEMENT_ARRAY_BUFFER: return stateElementArrayBuffer;
+        case GL_DRAW_INDIRECT_BUFFER: return stateDrawIndirectBuffer;
+        case GL_UNIFORM_BUFFER: return stateUniformBuffer;
+        case GL_SHADER_STORAGE_BUFFER: return stateShaderStorageBuffer;
+        case GL_COPY_WRITE_BUFFER: return stateCopyWriteBuffer;
+    }
+    return -1;
+}
+
+static int textureTarget(GLenum target)
+{
+    switch (target) {
+        case GL_TEXTURE_2D: return stateTexture2D;
+        case GL_TEXTURE_2D_ARRAY: return stateTexture2DArray;
+        case GL_TEXTURE_CUBE_MAP: return stateTextureCubeMap;
+        case GL_TEXTURE_BUFFER: return stateTextureBuffer;
+    }
+    return -1;
+}
+
+static int capIndex(GLenum cap)
+{
+    switch (cap) {
+        case GL_BLEND: return stateBlend;
+        case GL_DEPTH_TEST: return stateDepthTest;
+        case GL_CULL_FACE: return stateCullFace;
+        case GL_SCISSOR_TEST: return stateScissorTest;
+    }
+    return -1;
+}
+
+void InvalidateGLState()
+{
+    cache.program = stateUnknown;
+    cache.vertexArray = stateUnknown;
+    for (int i = 0; i < stateBufferTargets; i++) {
+        cache.buffers[i] = stateUnknown;
+    }
+    for (int i = 0; i < stateIndexedBindings; i++) {
+        cache.uniformBindings[i].buffer = stateUnknown;
+        cache.storageBindings[i].buffer = stateUnknown;
+    }
+
+    cache.activeTexture = stateUnknown;
+    for (int i = 0; i < stateTextureUnits; i++) {
+        for (int j = 0; j < stateTextureTargets; j++) {
+            cache.textures[i][j] = stateUnknown;
+        }
+    }
+
+    for (int i = 0; i < stateCaps; i++) {
+        cache.caps[i] = stateUnknown;
+    }
+    cache.blendSource = stateUnknown;
+    cache.blendDestination = stateUnknown;
+    cache.depthFunc = stateUnknown;
+    cache.depthMask = stateUnknown;
+
+    cache.drawFramebuffer = stateUnknown;
+    cache.readFramebuffer = stateUnknown;
+}
+
+void ResetGLStateStats()
+{
+    glStateStats.issued = 0;
+    glStateStats.skipped = 0;
+}
+
+void StateUseProgram(GLuint program)
+{
+    if (changes(&cache.program, program)) {
+        glUseProgram(program);
+    }
+}
+
+void StateBindVertexArray(GLuint vertexArray)
+{
+    if (changes(&cache.vertexArray, vertexArray)) {
+        glBindVertexArray(vertexArray);
+        // the element array buffer is part of the vertex array
+        cache.buffers[stateElementArrayBuffer] = stateUnknown;
+    }
+}
+
+/* Currently bound vertex array, without asking OpenGL */
+GLuint StateVertexArray()
+{
+    return cache.vertexArray == stateUnknown ? 0 : cache.vertexArray;
+}
+
+void StateBindBuffer(GLenum target, GLuint buffer)
+{
+    int index = bufferTarget(target);
+    if (index < 0) {
+        glStateStats.issued++;
+        glBindBuffer(target, buffer);
+    } else if (changes(&cache.buffers[index], buffer)) {
+        glBindBuffer(target, buffer);
+    }
+}
+
+/******************************************************************
+ * StateBindBufferRange
+ * Binds a range of a buffer to an indexed uniform or storage buffer
+ * binding; a size of 0 binds the whole buffer. Like OpenGL, this also
+ * changes the generic binding of the target
+ *******************************************************************/
+void StateBindBufferRange(GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size)
+{
+    IndexedBinding* binding = NULL;
+    if (index < stateIndexedBindings && target == GL_UNIFORM_BUFFER) {
+        binding = &cache.uniformBindings[index];
+    } else if (index < stateIndexedBindings && target == GL_SHADER_STORAGE_BUFFER) {
+        binding = &cache.storageBindings[index];
+    }
+
+    if (binding != NULL && binding->buffer == buffer && binding->offset == offset && binding->size == size) {
+        glStateStats.skipped++;
+        return;
+    }
+    glStateStats.issued++;
+
+    if (size == 0) {
+        glBindBufferBase(target, index, buffer);
+    } else {
+        glBindBufferRange(target, index, buffer, offset, size);
+    }
+
+    if (binding != NULL) {
+        binding->buffer = buffer;
+        binding->offset = offset;
+        binding->size = size;
+    }
+    int generic = bufferTarget(target);
+    if (generic >= 0) {
+        cache.buffers[generic] = buffer;
+    }
+}
+
+void StateActiveTexture(int unit)
+{
+    if (changes(&cache.activeTexture, unit)) {
+        glActiveTexture(GL_TEXTURE0 + unit);
+    }
+}
+
+/* Binds to the active texture unit */
+void StateBindTexture(GLenum target, GLuint texture)
+{
+    int index = textureTarget(target);
+    if (index < 0 || cache.activeTexture >= stateTextureUnits) {
+        glStateStats.issued++;
+        glBindTexture(target, texture);
+    } else if (changes(&cache.textures[cache.activeTexture][index], texture)) {
+        glBindTexture(target, texture);
+    }
+}
+
+void StateEnable(GLenum cap)
+{
+    int index = capIndex(cap);
+    if (index < 0) {
+        glStateStats.issued++;
+        glEnable(cap);
+    } else if (changes(&cache.caps[index], GL_TRUE)) {
+        glEnable(cap);
+    }
+}
+
+void StateDisable(GLenum cap)
+{
+    int index = capIndex(cap);
+    if (index < 0) {
+        glStateStats.issued++;
+        glDisable(cap);
+    } else if (changes(&cache.caps[index], GL_FALSE)) {
+        glDisable(cap);
+    }
+}
+
+void StateBlendFunc(GLenum source, GLenum destination)
+{
+    if (cache.blendSource == source && cache.blendDestination == destination) {
+        glStateStats.skipped++;
+        return;
+    }
+    cache.blendSource = source;
+    cache.blendDestination = destination;
+    glStateStats.issued++;
+    glBlendFunc(source, destination);
+}
+
+void StateDepthFunc(GLenum func)
+{
+    if (changes(&cache.depthFunc, func)) {
+        glDepthFunc(func);
+    }
+}
+
+void StateDepthMask(GLboolean mask)
+{
+    if (changes(&cache.depthMask, mask)) {
+        glDepthMask(mask);
+    }
+}
+
+/* GL_FRAMEBUFFER binds both the draw and the read framebuffer */
+void StateBindFramebuffer(GLenum target, GLuint framebuffer)
+{
+    int draw = target != GL_READ_FRAMEBUFFER && cache.drawFramebuffer != framebuffer;
+    int read = target != GL_DRAW_FRAMEBUFFER && cache.readFramebuffer != framebuffer;
+    if (!draw && !read) {
+        glStateStats.skipped++;
+        return;
+    }
+
+    if (target != GL_READ_FRAMEBUFFER) {
+        cache.drawFramebuffer = framebuffer;
+    }
+    if (target != GL_DRAW_FRAMEBUFFER) {
+        cache.readFramebuffer = framebuffer;
+    }
+    glStateStats.issued++;
+    glBindFramebuffer(target, framebuffer);
+}
+
+void PrintGLStateStats()
+{
+    printf("gl state: %d calls issued, %d skipped\n", glStateStats.issued, glStateStats.skipped);
+}
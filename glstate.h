@@ -0,0 +1,38 @@
+#ifndef SOLAR_SYSTEM_GL_STATE
+#define SOLAR_SYSTEM_GL_STATE
+
+/* Thin cache over the OpenGL state changed while drawing a frame: a
+ * call is only passed on to OpenGL if it changes the current state.
+ * All binds of the frame have to go through it; after changing state
+ * directly (e.g. while loading), call InvalidateGLState */
+
+#define stateTextureUnits 8
+#define stateIndexedBindings 8
+
+typedef struct glStateStats {
+    int issued;
+    int skipped;
+} GLStateStats;
+
+extern GLStateStats glStateStats;
+
+void InvalidateGLState();
+void ResetGLStateStats();
+
+void StateUseProgram(GLuint program);
+void StateBindVertexArray(GLuint vertexArray);
+GLuint StateVertexArray();
+void StateBindBuffer(GLenum target, GLuint buffer);
+void StateBindBufferRange(GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size);
+void StateActiveTexture(int unit);
+void StateBindTexture(GLenum target, GLuint texture);
+void StateEnable(GLenum cap);
+void StateDisable(GLenum cap);
+void StateBlendFunc(GLenum source, GLenum destination);
+void StateDepthFunc(GLenum func);
+void StateDepthMask(GLboolean mask);
+void StateBindFramebuffer(GLenum target, GLuint framebuffer);
+
+void PrintGLStateStats();
+
+#endif
@@ -0,0 +1,145 @@
+#include "stdio.h"
+#include "GL/glew.h"
+
+#include "utils.h"
+#include "governor.h"
+
+void InitGovernor(Governor* governor, double budget, int levels)
+{
+    governor->enabled = 0;
+    governor->budget = budget;
+    governor->level = 0;
+    governor->levels = levels;
+
+    governor->cpuTime = 0;
+    governor->gpuTime = 0;
+    governor->overFrames = 0;
+    governor->underFrames = 0;
+    governor->settleFrames = governorSettleFrames;
+    governor->raiseFrames = governorRaiseFrames;
+    governor->raisedAt = -1;
+    governor->frames = 0;
+
+    governor->cpuStart = -1;
+    for (int i = 0; i < governorQueryFrames; i++) {
+        glGenQueries(2, governor->queries[i]);
+        governor->issued[i] = 0;
+    }
+    governor->frame = 0;
+}
+
+/* Exponential moving average, so single slow frames do not count much */
+static double average(double current, double sample)
+{
+    return current == 0 ? sample : current * .9 + sample * .1;
+}
+
+/* Reads the GPU time of the frame which used the query pair before,
+ * if the GPU is done with it */
+static void readQueries(Governor* governor, int set)
+{
+    if (!governor->issued[set]) {
+        return;
+    }
+
+    GLuint available = GL_FALSE;
+    glGetQueryObjectuiv(governor->queries[set][1], GL_QUERY_RESULT_AVAILABLE, &available);
+    if (!available) {
+        return;
+    }
+
+    GLuint64 start = 0, end = 0;
+    glGetQueryObjectui64v(governor->queries[set][0], GL_QUERY_RESULT, &start);
+    glGetQueryObjectui64v(governor->queries[set][1], GL_QUERY_RESULT, &end);
+    governor->gpuTime = average(governor->gpuTime, (end - start) / 1000000.);
+    governor->issued[set] = 0;
+}
+
+/******************************************************************
+ * BeginGovernorUpdate
+ * Starts the CPU time of a frame with the updates of the simulation
+ * before it is drawn, unless it already runs
+ *******************************************************************/
+void BeginGovernorUpdate(Governor* governor)
+{
+    if (governor->cpuStart < 0) {
+        governor->cpuStart = milliseconds();
+    }
+}
+
+/******************************************************************
+ * BeginGovernorFrame
+ * Starts measuring the drawing of a frame; a frame drawn without
+ * updates before it starts its CPU time here. The GPU time is taken
+ * from timestamps, which unlike GL_TIME_ELAPSED may enclose other
+ * timer queries
+ *******************************************************************/
+void BeginGovernorFrame(Governor* governor)
+{
+    readQueries(governor, governor->frame);
+
+    BeginGovernorUpdate(governor);
+    glQueryCounter(governor->queries[governor->frame][0], GL_TIMESTAMP);
+}
+
+/* Moves to the level, and waits for the times to settle */
+static void changeLevel(Governor* governor, int level)
+{
+    governor->level = level;
+    governor->overFrames = 0;
+    governor->underFrames = 0;
+    governor->settleFrames = governorSettleFrames;
+}
+
+/******************************************************************
+ * EndGovernorFrame
+ * Ends measuring the frame, before the buffers are swapped so the
+ * CPU time, from the updates on, does not include waiting for the
+ * display. If the governor
+ * is enabled, returns the level the next frame should use: the frame
+ * time is the slower one of CPU and GPU.
+ * A level raised again after too short a time means the better one
+ * does not fit the budget, the governor then waits twice as long
+ * before trying to raise it again
+ *******************************************************************/
+int EndGovernorFrame(Governor* governor)
+{
+    glQueryCounter(governor->queries[governor->frame][1], GL_TIMESTAMP);
+    governor->issued[governor->frame] = 1;
+    governor->frame = (governor->frame + 1) % governorQueryFrames;
+
+    governor->cpuTime = average(governor->cpuTime, milliseconds() - governor->cpuStart);
+    governor->cpuStart = -1;
+    governor->frames++;
+
+    if (!governor->enabled) {
+        return governor->level;
+    }
+    if (governor->settleFrames > 0) {
+        governor->settleFrames--;
+        return governor->level;
+    }
+
+    double frameTime = governor->cpuTime > governor->gpuTime ? governor->cpuTime : governor->gpuTime;
+    governor->overFrames = frameTime > governor->budget ? governor->overFrames + 1 : 0;
+    governor->underFrames = frameTime < governor->budget * governorRaiseFactor ? governor->underFrames + 1 : 0;
+
+    if (governor->overFrames >= governorLowerFrames && governor->level < governor->levels - 1) {
+        if (governor->raisedAt >= 0 && governor->frames - governor->raisedAt < governorRaiseFrames
+                && governor->raiseFrames < 16 * governorRaiseFrames) {
+            governor->raiseFrames *= 2;
+        }
+        changeLevel(governor, governor->level + 1);
+    } else if (governor->underFrames >= governor->raiseFrames && governor->level > 0) {
+        governor->raisedAt = governor->frames;
+        changeLevel(governor, governor->level - 1);
+    }
+    return governor->level;
+}
+
+void PrintGovernorStats(Governor* governor)
+{
+    printf("governor: %s, level %d of %d, budget %.2f ms\n", governor->enabled ? "on" : "off",
+            governor->level, governor->levels - 1, governor->budget);
+    printf("governor: cpu %.3f ms, gpu %.3f ms per frame\n", governor->cpuTime, governor->gpuTime);
+}
@@ -0,0 +1,51 @@
+#ifndef SOLAR_SYSTEM_GOVERNOR
+#define SOLAR_SYSTEM_GOVERNOR
+
+/* Performance governor: measures how long the CPU and the GPU take for
+ * a frame and selects a quality level to stay within a budget. Level 0
+ * is the best quality, every further level is cheaper. What a level
+ * changes is up to the caller */
+
+/* Timestamp queries of the GPU, one pair per frame in flight */
+#define governorQueryFrames 3
+
+/* A level is lowered when the frame time stays above the budget for
+ * governorLowerFrames frames, and raised again when it stays below
+ * governorRaiseFactor of the budget for governorRaiseFrames frames.
+ * Between the two thresholds nothing changes */
+#define governorLowerFrames 30
+#define governorRaiseFrames 120
+#define governorRaiseFactor .7
+
+/* Frames to wait after a change, until the measured times reflect it */
+#define governorSettleFrames 30
+
+typedef struct governor {
+    int enabled;
+    double budget; // milliseconds per frame
+    int level;
+    int levels;
+
+    double cpuTime; // milliseconds, averaged over the last frames
+    double gpuTime;
+
+    int overFrames; // consecutive frames above the budget
+    int underFrames; // consecutive frames below the raise threshold
+    int settleFrames; // frames left until the times are measured again
+    int raiseFrames; // required frames below the threshold for raising
+    int raisedAt; // frame of the last raise, -1 if none
+    int frames;
+
+    double cpuStart; // -1 until the frame begins
+    GLuint queries[governorQueryFrames][2];
+    int issued[governorQueryFrames];
+    int frame; // query pair used by the current frame
+} Governor;
+
+void InitGovernor(Governor* governor, double budget, int levels);
+void BeginGovernorUpdate(Governor* governor);
+void BeginGovernorFrame(Governor* governor);
+int EndGovernorFrame(Governor* governor);
+void PrintGovernorStats(Governor* governor);
+
+#endif
@@ -0,0 +1,180 @@
+#include "stdio.h"
+#include "stdlib.h"
+#include "string.h"
+#include "GL/glew.h"
+
+#include "utils.h"
+#include "gpuculling.h"
+#include "glstate.h"
+
+GPUCulling gpuCulling = {
+    // no meshes with fewer triangles exist, so these are not geometric
+    // levels of detail: the entry after the last level of an instance is
+    // a cutoff, skipping it below half a pixel. solarsystem.c uses the
+    // levels for the shading tiers and sets their radius every frame
+    .lodPixelRadius = {.5, .5, .5, .5},
+};
+
+/******************************************************************
+ * InitGPUCulling
+ * Compute shaders and indirect draws with a base instance need
+ * OpenGL 4.3. Returns 0 if they are not available, the caller then
+ * keeps culling on the CPU
+ *******************************************************************/
+int InitGPUCulling(int instanceCapacity, int commandCapacity)
+{
+    gpuCulling.supported = GLEW_VERSION_4_3;
+    if (!gpuCulling.supported) {
+        printf("OpenGL 4.3 not available, culling on the CPU\n");
+        return 0;
+    }
+
+    gpuCulling.instances = NULL;
+    gpuCulling.materials = calloc(instanceCapacity, sizeof(GPUMaterial));
+    gpuCulling.instanceCapacity = instanceCapacity;
+    gpuCulling.instanceCount = 0;
+
+    gpuCulling.commands = calloc(commandCapacity, sizeof(DrawElementsIndirectCommand));
+    gpuCulling.commandCapacity = commandCapacity;
+    gpuCulling.commandCount = 0;
+    gpuCulling.visibleCapacity = 0;
+
+    glGenBuffers(1, &gpuCulling.commandBuffer);
+    glGenBuffers(1, &gpuCulling.visibleBuffer);
+
+    return 1;
+}
+
+/******************************************************************
+ * AddGPUCullCommand
+ * Adds an indirect draw of indexCount indices from firstIndex on, a
+ * whole mesh or a part of it, which can draw up to maxInstances
+ * instances. Returns the index of the command
+ *******************************************************************/
+int AddGPUCullCommand(GLsizei firstIndex, GLsizei indexCount, int maxInstances)
+{
+    if (gpuCulling.commandCount == gpuCulling.commandCapacity) {
+        fprintf(stderr, "Too many GPU culling commands\n");
+        exit(-1);
+    }
+
+    DrawElementsIndirectCommand* command = &gpuCulling.commands[gpuCulling.commandCount];
+    command->count = indexCount;
+    command->instanceCount = 0; // written by the cull shader
+    command->firstIndex = firstIndex;
+    command->baseVertex = 0;
+    command->baseInstance = gpuCulling.visibleCapacity; // start of its slots in the visible list
+
+    gpuCulling.visibleCapacity += maxInstances;
+
+    return gpuCulling.commandCount++;
+}
+
+/******************************************************************
+ * SetGPUCullInstanceBuffer
+ * The instances of this frame are written to mapped memory, starting
+ * at offset of buffer. Has to be set before any instance of the frame
+ *******************************************************************/
+void SetGPUCullInstanceBuffer(GPUInstance* instances, GLuint buffer, GLintptr offset)
+{
+    gpuCulling.instances = instances;
+    gpuCulling.instanceBuffer = buffer;
+    gpuCulling.instanceOffset = offset;
+}
+
+/* Only writes, the instances may be in write combined memory */
+void SetGPUCullTransform(int index, float* transformation)
+{
+    if (!gpuCulling.supported) {
+        return;
+    }
+
+    memcpy(gpuCulling.instances[index].transformation, transformation, 16*sizeof(float));
+}
+
+void SetGPUCullInstance(int index, float* sphere, int command, int lodCount, int partCount)
+{
+    GPUInstance* instance = &gpuCulling.instances[index];
+    GPUMaterial* material = &gpuCulling.materials[index];
+
+    memcpy(instance->sphere, sphere, 4*sizeof(float));
+    memcpy(instance->color, material->color, 4*sizeof(float));
+    instance->command = command;
+    instance->lodCount = lodCount;
+    instance->partCount = partCount;
+    instance->textureLayer = material->textureLayer;
+
+    if (index >= gpuCulling.instanceCount) {
+        gpuCulling.instanceCount = index + 1;
+    }
+}
+
+/* The material of an instance stays the same, it only has to be set once */
+void SetGPUCullMaterial(int index, float* color, int textureLayer)
+{
+    GPUMaterial* material = &gpuCulling.materials[index];
+
+    memcpy(material->color, color, 3*sizeof(float));
+    material->color[3] = 1.;
+    material->textureLayer = textureLayer;
+}
+
+/******************************************************************
+ * DispatchGPUCulling
+ * Resets the instance counts of all commands and runs the cull shader
+ * over this frame's instances. Afterwards the commands can be drawn
+ * with glDrawElementsIndirect, without reading anything back
+ *******************************************************************/
+void DispatchGPUCulling(GLuint program, Frustum* frustum, float* viewMatrix, float projectedScale)
+{
+    // orphan the buffers, so the upload does not wait for the last frame
+    StateBindBuffer(GL_DRAW_INDIRECT_BUFFER, gpuCulling.commandBuffer);
+    glBufferData(GL_DRAW_INDIRECT_BUFFER, gpuCulling.commandCount*sizeof(DrawElementsIndirectCommand),
+            gpuCulling.commands, GL_STREAM_DRAW);
+
+    StateBindBuffer(GL_ARRAY_BUFFER, gpuCulling.visibleBuffer);
+    glBufferData(GL_ARRAY_BUFFER, gpuCulling.visibleCapacity*sizeof(GLuint), NULL, GL_STREAM_DRAW);
+
+    StateBindBufferRange(GL_SHADER_STORAGE_BUFFER, 0, gpuCulling.instanceBuffer, gpuCulling.instanceOffset,
+            gpuCulling.instanceCount*sizeof(GPUInstance));
+    StateBindBufferRange(GL_SHADER_STORAGE_BUFFER, 1, gpuCulling.commandBuffer, 0, 0);
+    StateBindBufferRange(GL_SHADER_STORAGE_BUFFER, 2, gpuCulling.visibleBuffer, 0, 0);
+
+    StateUseProgram(program);
+    glUniform4fv(glGetUniformLocation(program, "planes"), 6, &frustum->planes[0][0]);
+    glUniform1fv(glGetUniformLocation(program, "lodPixelRadius"), maxLods, gpuCulling.lodPixelRadius);
+    glUniform1ui(glGetUniformLocation(program, "instanceCount"), gpuCulling.instanceCount);
+    BindUniform4f("ViewMatrix", program, viewMatrix);
+    BindUniform1f("projectedScale", program, projectedScale);
+
+    glDispatchCompute((gpuCulling.instanceCount + 63) / 64, 1, 1);
+
+    // commands and visible list are read by the draws
+    glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT);
+}
+
+/* Binds the buffers read by the indirect draws; the visible list
+ * feeds the per instance attribute vInstanceIndex */
+void BindGPUCullingBuffers()
+{
+    StateBindBufferRange(GL_SHADER_STORAGE_BUFFER, 0, gpuCulling.instanceBuffer, gpuCulling.instanceOffset,
+            gpuCulling.instanceCount*sizeof(GPUInstance));
+    StateBindBuffer(GL_DRAW_INDIRECT_BUFFER, gpuCulling.commandBuffer);
+
+    glEnableVertexAttribArray(vInstanceIndex);
+    StateBindBuffer(GL_ARRAY_BUFFER, gpuCulling.visibleBuffer);
+    glVertexAttribIPointer(vInstanceIndex, 1, GL_UNSIGNED_INT, 0, 0);
+    glVertexAttribDivisor(vInstanceIndex, 1);
+}
+
+void UnbindGPUCullingBuffers()
+{
+    glVertexAttribDivisor(vInstanceIndex, 0);
+    glDisableVertexAttribArray(vInstanceIndex);
+    StateBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+}
+
+GLintptr GPUCullCommandOffset(int command)
+{
+    return command * sizeof(DrawElementsIndirectCommand);
+}
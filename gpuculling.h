@@ -0,0 +1,75 @@
+#ifndef SOLAR_SYSTEM_GPU_CULLING
+#define SOLAR_SYSTEM_GPU_CULLING
+
+#include "culling.h"
+
+/* Vertex attribute holding the index of the drawn instance, in sync
+ * with the INDIRECT variant of phong.vs. The part of the instance is
+ * stored above gpuCullPartShift, see cull.cs */
+enum GPUCullingIndices {vInstanceIndex = 4};
+#define gpuCullPartShift 24
+
+#define maxLods 4
+
+/* Layout matches the Instance struct (std430) of cull.cs */
+typedef struct gpuInstance {
+    float transformation[16];
+    float sphere[4]; // object space center and radius
+    float color[4];
+    GLuint command; // first indirect command of the instance
+    GLuint lodCount; // number of levels of detail, each with partCount consecutive commands
+    GLint textureLayer; // layer of the body texture array, for the first part
+    GLuint partCount; // parts of the mesh, drawn by one multi-draw per level
+} GPUInstance;
+
+/* Per instance data which stays the same over all frames */
+typedef struct gpuMaterial {
+    float color[4];
+    GLint textureLayer;
+} GPUMaterial;
+
+/* Layout given by glDrawElementsIndirect */
+typedef struct drawElementsIndirectCommand {
+    GLuint count;
+    GLuint instanceCount;
+    GLuint firstIndex;
+    GLint baseVertex;
+    GLuint baseInstance;
+} DrawElementsIndirectCommand;
+
+typedef struct gpuCulling {
+    int supported; // 0 if the context has no compute shaders/indirect draws
+
+    // written every frame, into the buffer range set by SetGPUCullInstanceBuffer
+    GPUInstance* instances;
+    GLuint instanceBuffer;
+    GLintptr instanceOffset;
+    int instanceCount;
+    int instanceCapacity;
+    GPUMaterial* materials;
+
+    DrawElementsIndirectCommand* commands; // instance counts are reset to 0 every frame
+    int commandCount;
+    int commandCapacity;
+    int visibleCapacity; // sum of the instance slots reserved by all commands
+
+    float lodPixelRadius[maxLods]; // radius in pixels below which the next command is used, see cull.cs
+
+    GLuint commandBuffer;
+    GLuint visibleBuffer;
+} GPUCulling;
+
+extern GPUCulling gpuCulling;
+
+int InitGPUCulling(int instanceCapacity, int commandCapacity);
+int AddGPUCullCommand(GLsizei firstIndex, GLsizei indexCount, int maxInstances);
+void SetGPUCullInstanceBuffer(GPUInstance* instances, GLuint buffer, GLintptr offset);
+void SetGPUCullTransform(int index, float* transformation);
+void SetGPUCullInstance(int index, float* sphere, int command, int lodCount, int partCount);
+void SetGPUCullMaterial(int index, float* color, int textureLayer);
+void DispatchGPUCulling(GLuint program, Frustum* frustum, float* viewMatrix, float projectedScale);
+void BindGPUCullingBuffers();
+void UnbindGPUCullingBuffers();
+GLintptr GPUCullCommandOffset(int command);
+
+#endif
@@ -6,6 +6,17 @@
 #include "utils.h"
 #include "input.h"
 #include "solarsystem.h"
+#include "transforms.h"
+#include "renderqueue.h"
+#include "culling.h"
+#include "orbits.h"
+#include "ringbuffer.h"
+#include "glstate.h"
+#include "shadervariants.h"
+#include "clusters.h"
+#include "bloom.h"
+#include "framegraph.h"
+#include "beltlod.h"
 
 /******************************************************************
 *
@@ -181,5 +192,54 @@ void Keyboard(unsigned char key, int x, int y)
             lightSettings.bloomFactor = (int)clamp(lightSettings.bloomFactor-1, 10, 0);
             printf("bloom factor: %d\n", lightSettings.bloomFactor);
             break;
+        case 'u': // BLOOM
+            lightSettings.bloomQuality = (lightSettings.bloomQuality + 1) % bloomQualities;
+            printf("bloom quality: %s\n", (char*[]){"low", "medium", "high"}[lightSettings.bloomQuality]);
+            break;
+        case 'c': // smooth edges
+            lightSettings.antialiasing = (lightSettings.antialiasing + 1) % antialiasingModes;
+            printf("anti-aliasing: %s\n", (char*[]){"off", "low", "high"}[lightSettings.antialiasing]);
+            break;
+        case 'z': // shade fewer bodies with the reduced shading
+            lightSettings.reducedShadingRadius = clamp(lightSettings.reducedShadingRadius-1, 64., 0);
+            printf("reduced shading below %g pixels\n", lightSettings.reducedShadingRadius);
+            break;
+        case 'x': // shade more bodies with the reduced shading
+            lightSettings.reducedShadingRadius = clamp(lightSettings.reducedShadingRadius+1, 64., 0);
+            printf("reduced shading below %g pixels\n", lightSettings.reducedShadingRadius);
+            break;
+        case '+': case '=': // sharper, slower
+            setRenderScale(renderScale + .25);
+            break;
+        case '-': // blurrier, faster
+            setRenderScale(renderScale - .25);
+            break;
+        case 'f': // quality adjusted to the frame time
+            toggleGovernor();
+            break;
+        case 'e': // exposure adapted to the scene
+            toggleAutoExposure();
+            break;
+        case 'l': // exact spheres instead of their mesh
+            lightSettings.rayCastSpheres = !lightSettings.rayCastSpheres;
+            printf("ray cast spheres %s\n", lightSettings.rayCastSpheres ? "on" : "off");
+            break;
+        case 'i': // statistics of the last frame
+            PrintCullStats();
+            PrintRenderStats();
+            PrintOrbitStats();
+            PrintRingStats();
+            PrintGLStateStats();
+            PrintShaderVariantStats();
+            PrintClusterStats();
+            PrintTransformStats();
+            printSkyStats();
+            PrintBloomStats();
+            printGovernorStats();
+            PrintFrameGraphStats();
+            printExposureStats();
+            PrintBeltLodStats();
+            printTerrainStats();
+            break;
     }
 }
@@ -0,0 +1,119 @@
+#include "stdio.h"
+#include "stdlib.h"
+#include "string.h"
+#include "math.h"
+#include "GL/glew.h"
+
+#include "utils.h"
+#include "orbits.h"
+#include "glstate.h"
+
+OrbitStats orbitStats;
+
+/* largest distance in pixels between an orbit and its line segments */
+#define orbitPixelError .25
+
+void InitOrbitBatch(OrbitBatch* batch)
+{
+    batch->count = 0;
+    glGenVertexArrays(1, &batch->VAO);
+}
+
+/******************************************************************
+ * AppendOrbit
+ * Adds the ellipse of an orbit to the batch, with the same shape as
+ * planetPosition. The transformation is kept as pointer, so it can
+ * still change after the orbit was added. Returns the index of the orbit
+ *******************************************************************/
+int AppendOrbit(OrbitBatch* batch, float semimajor, float semiminor, float inclination,
+        float* transformation, float* color)
+{
+    if (batch->count == maxOrbits) {
+        fprintf(stderr, "Too many orbits\n");
+        exit(-1);
+    }
+
+    int orbit = batch->count++;
+    batch->ellipse[orbit][0] = semimajor;
+    batch->ellipse[orbit][1] = semiminor;
+    batch->ellipse[orbit][2] = inclination;
+    batch->transformation[orbit] = transformation;
+    memcpy(batch->color[orbit], color, 3*sizeof(float));
+
+    batch->first[orbit] = orbit * maxOrbitSegments;
+    batch->segments[orbit] = minOrbitSegments;
+
+    return orbit;
+}
+
+/******************************************************************
+ * orbitSegments
+ * A circle with radius R (in pixels) approximated by n segments is
+ * off by at most R*(1 - cos(pi/n)). The radius is projected with the
+ * distance to the closest possible point of the orbit, so orbits close
+ * to the camera get the most segments
+ *******************************************************************/
+static int orbitSegments(OrbitBatch* batch, int orbit, float* eye, float projectedScale)
+{
+    float* m = batch->transformation[orbit];
+    float radius = fmaxf(batch->ellipse[orbit][0], batch->ellipse[orbit][1]);
+
+    float dx = m[3] - eye[0];
+    float dy = m[7] - eye[1];
+    float dz = m[11] - eye[2];
+    float distance = sqrtf(dx*dx + dy*dy + dz*dz) - radius;
+
+    // the camera is within the orbit, or too close to tell
+    if (distance < radius / maxOrbitSegments) {
+        return maxOrbitSegments;
+    }
+
+    float pixelRadius = radius * projectedScale / distance;
+    if (pixelRadius <= orbitPixelError) {
+        return minOrbitSegments;
+    }
+
+    int segments = ceilf(M_PI / acosf(1. - orbitPixelError / pixelRadius));
+    return segments < minOrbitSegments ? minOrbitSegments :
+           (segments > maxOrbitSegments ? maxOrbitSegments : segments);
+}
+
+/******************************************************************
+ * DrawOrbitBatch
+ * Picks the number of segments of every orbit, uploads the ellipses,
+ * transformations and colors as uniform arrays and draws every orbit
+ * as line loop, in one call
+ *******************************************************************/
+void DrawOrbitBatch(OrbitBatch* batch, GLuint program, float* eye, float projectedScale)
+{
+    if (batch->count == 0) {
+        return;
+    }
+
+    float transformations[maxOrbits*16];
+    orbitStats.orbits = batch->count;
+    orbitStats.segments = 0;
+    for (int i = 0; i < batch->count; i++) {
+        memcpy(transformations + i*16, batch->transformation[i], 16*sizeof(float));
+        batch->segments[i] = orbitSegments(batch, i, eye, projectedScale);
+        orbitStats.segments += batch->segments[i];
+    }
+
+    glUniformMatrix4fv(glGetUniformLocation(program, "OrbitTransforms"), batch->count, GL_TRUE, transformations);
+    glUniform3fv(glGetUniformLocation(program, "OrbitEllipses"), batch->count, &batch->ellipse[0][0]);
+    glUniform3fv(glGetUniformLocation(program, "OrbitColors"), batch->count, &batch->color[0][0]);
+    glUniform1iv(glGetUniformLocation(program, "OrbitSegments"), batch->count, batch->segments);
+
+    // the positions only depend on gl_VertexID, no attribute is read
+    GLuint previousVAO = StateVertexArray();
+    StateBindVertexArray(batch->VAO);
+
+    glMultiDrawArrays(GL_LINE_LOOP, batch->first, batch->segments, batch->count);
+
+    StateBindVertexArray(previousVAO);
+}
+
+void PrintOrbitStats()
+{
+    printf("orbit lines: %d orbits, %d segments\n", orbitStats.orbits, orbitStats.segments);
+}
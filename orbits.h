@@ -0,0 +1,39 @@
+#ifndef SOLAR_SYSTEM_ORBITS
+#define SOLAR_SYSTEM_ORBITS
+
+// should be in sync with orbit.vs
+#define maxOrbits 16
+#define maxOrbitSegments 1024
+#define minOrbitSegments 16
+
+/* Orbit lines are generated in the vertex shader from the ellipse of
+ * every orbit, without any vertex buffer. Orbit i uses the vertex ids
+ * starting at i*maxOrbitSegments, so one glMultiDrawArrays call draws
+ * all of them with a different number of segments each */
+typedef struct orbitBatch {
+    int count;
+    float ellipse[maxOrbits][3]; // semimajor, semiminor and inclination
+    float* transformation[maxOrbits]; // read every time the batch is drawn
+    float color[maxOrbits][3];
+
+    // chosen every frame from the size on screen
+    GLint first[maxOrbits];
+    GLsizei segments[maxOrbits];
+
+    GLuint VAO; // without attributes
+} OrbitBatch;
+
+typedef struct orbitStats {
+    int orbits;
+    int segments; // sum over all orbits of the last frame
+} OrbitStats;
+
+extern OrbitStats orbitStats;
+
+void InitOrbitBatch(OrbitBatch* batch);
+int AppendOrbit(OrbitBatch* batch, float semimajor, float semiminor, float inclination,
+        float* transformation, float* color);
+void DrawOrbitBatch(OrbitBatch* batch, GLuint program, float* eye, float projectedScale);
+void PrintOrbitStats();
+
+#endif
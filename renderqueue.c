@@ -0,0 +1,251 @@
+#include "stdio.h"
+#include "stdlib.h"
+#include "string.h"
+#include "GL/glew.h"
+
+#include "source/Matrix.h"
+
+#include "utils.h"
+#include "solarsystem.h"
+#include "transforms.h"
+#include "renderqueue.h"
+#include "glstate.h"
+#include "shadervariants.h"
+
+RenderStats renderStats;
+
+/*
+ * Layout of the 64 bit sort key, from the highest to the lowest bit:
+ *
+ *  opaque/debug: | pass 2 | program 4 | variant 4 | texture 12 | mesh 12 | depth 16 | unused 14 |
+ *  transparent:  | pass 2 | inverted depth 16 | program 4 | variant 4 | texture 12 | mesh 12 | unused 14 |
+ *
+ * Opaque draws are grouped by state first, and drawn front to back inside of
+ * every group so the early depth test can reject hidden fragments.
+ * Transparent draws have to be blended back to front, so depth wins over state
+ */
+#define keyPassShift 62
+#define keyProgramShift 58
+#define keyVariantShift 54
+#define keyTextureShift 42
+#define keyMeshShift 30
+#define keyDepthShift 14
+#define keyTransparentDepthShift 46
+#define keyTransparentProgramShift 42
+#define keyTransparentVariantShift 38
+#define keyTransparentTextureShift 26
+#define keyTransparentMeshShift 14
+
+static unsigned long long buildKey(RenderCommand* command)
+{
+    unsigned long long pass = command->pass & 0x3;
+    unsigned long long program = command->program & 0xf;
+    unsigned long long variant = command->variant & 0xf;
+    unsigned long long texture = command->texture & 0xfff;
+    unsigned long long mesh = command->VBO & 0xfff;
+    unsigned long long depth = (unsigned long long)(clamp(command->depth, 1., 0.) * 0xffff);
+
+    if (command->pass == passTransparent) {
+        return (pass << keyPassShift)
+            | ((0xffff - depth) << keyTransparentDepthShift)
+            | (program << keyTransparentProgramShift)
+            | (variant << keyTransparentVariantShift)
+            | (texture << keyTransparentTextureShift)
+            | (mesh << keyTransparentMeshShift);
+    }
+
+    return (pass << keyPassShift)
+        | (program << keyProgramShift)
+        | (variant << keyVariantShift)
+        | (texture << keyTextureShift)
+        | (mesh << keyMeshShift)
+        | (depth << keyDepthShift);
+}
+
+void InitRenderQueue(RenderQueue* queue, int capacity, void (*setupProgram)(int program, GLuint id))
+{
+    queue->commands = malloc(capacity * sizeof(RenderCommand));
+    queue->matrices = malloc(capacity * sizeof(ObjectMatrices));
+    queue->transformations = malloc(capacity * sizeof(float*));
+    queue->order = malloc(capacity * sizeof(unsigned int));
+    queue->scratch = malloc(capacity * sizeof(unsigned int));
+    queue->capacity = capacity;
+    queue->count = 0;
+    queue->setupProgram = setupProgram;
+}
+
+void ResetRenderQueue(RenderQueue* queue)
+{
+    queue->count = 0;
+    memset(&renderStats, 0, sizeof(RenderStats));
+}
+
+void SubmitRenderCommand(RenderQueue* queue, RenderCommand* command)
+{
+    if (queue->count == queue->capacity) {
+        queue->capacity *= 2;
+        queue->commands = realloc(queue->commands, queue->capacity * sizeof(RenderCommand));
+        queue->order = realloc(queue->order, queue->capacity * sizeof(unsigned int));
+        queue->scratch = realloc(queue->scratch, queue->capacity * sizeof(unsigned int));
+    }
+
+    command->key = buildKey(command);
+    renderStats.commands++;
+    queue->order[queue->count] = queue->count;
+    queue->commands[queue->count++] = *command;
+}
+
+/******************************************************************
+ * SortRenderQueue
+ * LSD radix sort of the command indices by their key, one byte per
+ * pass. Bytes which are the same for every command (e.g. the unused
+ * low bits, or the program while only asteroids are queued) are skipped
+ *******************************************************************/
+void SortRenderQueue(RenderQueue* queue)
+{
+    unsigned int* src = queue->order;
+    unsigned int* dst = queue->scratch;
+
+    for (int shift = 0; shift < 64; shift += 8) {
+        int histogram[256] = {0};
+        for (int i = 0; i < queue->count; i++) {
+            histogram[(queue->commands[src[i]].key >> shift) & 0xff]++;
+        }
+
+        // all keys share this byte, order would not change
+        if (queue->count == 0 || histogram[(queue->commands[src[0]].key >> shift) & 0xff] == queue->count) {
+            continue;
+        }
+
+        int offset = 0;
+        for (int i = 0; i < 256; i++) {
+            int n = histogram[i];
+            histogram[i] = offset;
+            offset += n;
+        }
+
+        for (int i = 0; i < queue->count; i++) {
+            dst[histogram[(queue->commands[src[i]].key >> shift) & 0xff]++] = src[i];
+        }
+
+        unsigned int* temp = src;
+        src = dst;
+        dst = temp;
+    }
+
+    // keep the sorted indices in order and the spare buffer in scratch
+    queue->order = src;
+    queue->scratch = dst;
+}
+
+/******************************************************************
+ * ComputeRenderMatrices
+ * Computes the matrices of all queued objects in one batch, once the
+ * frame is queued. Indirect commands get their transformations from
+ * the GPU, their matrices are computed from the identity and unused
+ *******************************************************************/
+void ComputeRenderMatrices(RenderQueue* queue, float* viewMatrix, float* projectionMatrix)
+{
+    static float identity[16];
+    SetIdentityMatrix(identity);
+
+    for (int i = 0; i < queue->count; i++) {
+        RenderCommand* command = &queue->commands[i];
+        queue->transformations[i] = command->indirect ? identity : command->transformation;
+    }
+    ComputeObjectMatrices(viewMatrix, projectionMatrix, queue->transformations, queue->matrices, queue->count);
+}
+
+/******************************************************************
+ * ExecuteRenderQueue
+ * Draws all sorted commands of the passes firstPass to lastPass.
+ * Program, texture and mesh are only bound if they differ from the
+ * previous command. The program is the variant of the command's flags
+ *******************************************************************/
+void ExecuteRenderQueue(RenderQueue* queue, int firstPass, int lastPass)
+{
+    int currentPass = -1;
+    int currentProgram = -1;
+    int currentVariant = -1;
+    GLuint program = 0;
+    GLuint currentTexture = 0;
+    GLuint currentVBO = 0;
+
+    for (int i = 0; i < queue->count; i++) {
+        RenderCommand* command = &queue->commands[queue->order[i]];
+        if (command->pass < firstPass || command->pass > lastPass) {
+            continue;
+        }
+
+        if (command->pass != currentPass) {
+            if (command->pass == passTransparent) {
+                //settings for alpha blending
+                StateEnable(GL_BLEND);
+                StateBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+            }
+            currentPass = command->pass;
+        }
+
+        if (command->program != currentProgram || command->variant != currentVariant) {
+            program = ShaderVariant(command->program, command->variant);
+            StateUseProgram(program);
+            queue->setupProgram(command->program, program);
+            currentProgram = command->program;
+            currentVariant = command->variant;
+            renderStats.programSwitches++;
+        }
+
+        if (command->texture != currentTexture) {
+            ActivateTexture(0, command->texture);
+            currentTexture = command->texture;
+            renderStats.textureSwitches++;
+        }
+
+        if (command->VBO != currentVBO) {
+            BindBuffers(command->VBO, command->CBO, command->IBO, command->NBO, command->UVBO);
+            currentVBO = command->VBO;
+            renderStats.bufferSwitches++;
+        }
+
+        if (command->color != NULL) {
+            BindUniform3f("Color", program, command->color);
+        }
+
+        if (command->indirect) {
+            /* Instance count and transformations are provided by the GPU */
+            glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (void*)command->indirectOffset,
+                    command->indirectCount, 0);
+            renderStats.draws++;
+            continue;
+        }
+
+        /* Associate program with the matrices of the object; ray cast
+         * spheres project their quad themselves, from view space */
+        ObjectMatrices* matrices = &queue->matrices[queue->order[i]];
+        if (!(command->variant & variantRayCast)) {
+            BindUniform4f("ModelViewProjectionMatrix", program, matrices->modelViewProjection);
+        }
+        GLint modelView = glGetUniformLocation(program, "ModelViewMatrix");
+        if (modelView != -1) {
+            glUniformMatrix4fv(modelView, 1, GL_TRUE, matrices->modelView);
+        }
+        BindUniformMatrix3f("NormalMatrix", program, matrices->normal);
+
+        /* Issue draw command, using indexed triangle list */
+        glDrawElements(GL_TRIANGLES, command->indexCount, GL_UNSIGNED_INT,
+                (void*)(command->firstIndex * sizeof(GLuint)));
+        renderStats.draws++;
+    }
+
+    if (currentPass == passTransparent) {
+        //disabling alpha blending
+        StateDisable(GL_BLEND);
+    }
+}
+
+void PrintRenderStats()
+{
+    printf("render queue: %d commands, %d draws, %d program / %d texture / %d buffer switches\n",
+            renderStats.commands, renderStats.draws, renderStats.programSwitches,
+            renderStats.textureSwitches, renderStats.bufferSwitches);
+}
@@ -0,0 +1,70 @@
+#ifndef SOLAR_SYSTEM_RENDER_QUEUE
+#define SOLAR_SYSTEM_RENDER_QUEUE
+
+/* Passes are executed in this order; the pass is stored in the highest
+ * bits of the sort key, so all commands of a pass end up next to each other */
+enum RenderPass {passOpaque = 0, passDebug = 1, passTransparent = 2};
+
+typedef struct renderCommand {
+    unsigned long long key; // filled by SubmitRenderCommand
+
+    int pass;
+    int program; // index on the programs array
+    GLuint texture;
+
+    // mesh
+    GLuint VBO;
+    GLuint CBO;
+    GLuint NBO;
+    GLuint UVBO;
+    GLuint IBO;
+    GLsizei firstIndex; // of the drawn sub-range of the IBO, 0 for the whole mesh
+    GLsizei indexCount;
+
+    float* transformation;
+    float* color; // optional, only read by the simple program
+    int variant; // ShaderVariantFlags of the program
+
+    // draw with the indirect commands starting at this offset of the
+    // bound GL_DRAW_INDIRECT_BUFFER; the transformation is not used then
+    int indirect;
+    GLintptr indirectOffset;
+    GLsizei indirectCount; // number of consecutive commands, drawn by one call
+
+    float depth; // view space distance, normalized between 0 (near) and 1 (far)
+} RenderCommand;
+
+/* Counters for the last executed frame */
+typedef struct renderStats {
+    int commands;
+    int draws;
+    int programSwitches;
+    int textureSwitches;
+    int bufferSwitches;
+} RenderStats;
+
+typedef struct renderQueue {
+    RenderCommand* commands;
+    ObjectMatrices* matrices; // of every command, see ComputeRenderMatrices
+    float** transformations; // gathered for ComputeObjectMatrices
+    unsigned int* order; // indices on commands, sorted by key
+    unsigned int* scratch; // temporary buffer for the radix sort
+    int count;
+    int capacity;
+
+    // called whenever the queue switches to another program or variant
+    // (id), to upload the uniforms which are shared by all its draws
+    void (*setupProgram)(int program, GLuint id);
+} RenderQueue;
+
+extern RenderStats renderStats;
+
+void InitRenderQueue(RenderQueue* queue, int capacity, void (*setupProgram)(int program, GLuint id));
+void ResetRenderQueue(RenderQueue* queue);
+void SubmitRenderCommand(RenderQueue* queue, RenderCommand* command);
+void SortRenderQueue(RenderQueue* queue);
+void ComputeRenderMatrices(RenderQueue* queue, float* viewMatrix, float* projectionMatrix);
+void ExecuteRenderQueue(RenderQueue* queue, int firstPass, int lastPass);
+void PrintRenderStats();
+
+#endif
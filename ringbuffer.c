@@ -0,0 +1,159 @@
+#include "stdio.h"
+#include "stdlib.h"
+#include "string.h"
+#include "GL/glew.h"
+
+#include "utils.h"
+#include "ringbuffer.h"
+#include "glstate.h"
+
+RingStats ringStats;
+
+/******************************************************************
+ * RingAlignment
+ * Offsets of uniform and storage buffer ranges have to be multiples
+ * of an implementation defined alignment; sections of a region are
+ * aligned to the larger one
+ *******************************************************************/
+GLsizeiptr RingAlignment()
+{
+    GLint uniformAlignment = 256;
+    GLint storageAlignment = 0;
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &uniformAlignment);
+    if (GLEW_VERSION_4_3) {
+        glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &storageAlignment);
+    }
+
+    return uniformAlignment > storageAlignment ? uniformAlignment : storageAlignment;
+}
+
+void InitRingBuffer(RingBuffer* ring, GLsizeiptr frameSize)
+{
+    GLsizeiptr alignment = RingAlignment();
+    ring->frameSize = (frameSize + alignment - 1) / alignment * alignment;
+    ring->persistent = GLEW_VERSION_4_4 || GLEW_ARB_buffer_storage;
+    ring->frame = 0;
+    ring->open = 0;
+    memset(ring->fences, 0, sizeof(ring->fences));
+
+    glGenBuffers(1, &ring->id);
+    StateBindBuffer(GL_COPY_WRITE_BUFFER, ring->id);
+
+    if (!ring->persistent) {
+        printf("glBufferStorage not available, uploading frame data every frame\n");
+        ring->memory = calloc(1, ring->frameSize);
+        glBufferData(GL_COPY_WRITE_BUFFER, ring->frameSize, NULL, GL_STREAM_DRAW);
+        return;
+    }
+
+    GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    glBufferStorage(GL_COPY_WRITE_BUFFER, ringFrames * ring->frameSize, NULL, flags);
+    ring->memory = glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, ringFrames * ring->frameSize, flags);
+    if (ring->memory == NULL) {
+        fprintf(stderr, "Error mapping the frame data buffer\n");
+        exit(-1);
+    }
+}
+
+/******************************************************************
+ * BeginRingFrame
+ * Moves on to the next region and waits until the GPU is done with
+ * the frame which used it last. Does nothing if the frame was already
+ * begun. With keepContents, the data of the previous frame is copied,
+ * for frames drawn again without any update
+ *******************************************************************/
+void BeginRingFrame(RingBuffer* ring, int keepContents)
+{
+    if (ring->open) {
+        return;
+    }
+    ring->open = 1;
+
+    ringStats.waits = 0;
+    ringStats.waitTime = 0;
+    if (!ring->persistent) {
+        return;
+    }
+
+    int previous = ring->frame;
+    ring->frame = (ring->frame + 1) % ringFrames;
+
+    GLsync fence = ring->fences[ring->frame];
+    if (fence != NULL) {
+        GLenum result = glClientWaitSync(fence, 0, 0);
+        if (result == GL_TIMEOUT_EXPIRED) {
+            double start = milliseconds();
+            ringStats.waits++;
+
+            // flush once, so the fence can be reached at all
+            GLbitfield flags = GL_SYNC_FLUSH_COMMANDS_BIT;
+            do {
+                result = glClientWaitSync(fence, flags, 1000000);
+                flags = 0;
+            } while (result == GL_TIMEOUT_EXPIRED);
+
+            ringStats.waitTime = milliseconds() - start;
+            if (ringStats.waitTime > ringStats.maxWaitTime) {
+                ringStats.maxWaitTime = ringStats.waitTime;
+            }
+        }
+        if (result == GL_WAIT_FAILED) {
+            fprintf(stderr, "Error waiting for the frame data fence\n");
+            exit(-1);
+        }
+
+        glDeleteSync(fence);
+        ring->fences[ring->frame] = NULL;
+    }
+
+    if (keepContents) {
+        memcpy(ring->memory + ring->frame * ring->frameSize,
+               ring->memory + previous * ring->frameSize, ring->frameSize);
+    }
+}
+
+/* Pointer to write the section at offset of the current region */
+void* RingFrameData(RingBuffer* ring, GLintptr offset)
+{
+    if (!ring->persistent) {
+        return ring->memory + offset;
+    }
+    return ring->memory + ring->frame * ring->frameSize + offset;
+}
+
+/* Offset in the buffer of the section at offset of the current region,
+ * for glBindBufferRange */
+GLintptr RingFrameOffset(RingBuffer* ring, GLintptr offset)
+{
+    if (!ring->persistent) {
+        return offset;
+    }
+    return ring->frame * ring->frameSize + offset;
+}
+
+/* Makes the writes of this frame visible to the GPU. Coherent mappings
+ * need nothing, otherwise the region is uploaded into an orphaned buffer */
+void FlushRingFrame(RingBuffer* ring)
+{
+    if (ring->persistent) {
+        return;
+    }
+
+    StateBindBuffer(GL_COPY_WRITE_BUFFER, ring->id);
+    glBufferData(GL_COPY_WRITE_BUFFER, ring->frameSize, ring->memory, GL_STREAM_DRAW);
+}
+
+/* Called after the last command reading the region of this frame */
+void EndRingFrame(RingBuffer* ring)
+{
+    if (ring->persistent) {
+        ring->fences[ring->frame] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
+    ring->open = 0;
+}
+
+void PrintRingStats()
+{
+    printf("frame data: waited for the GPU %d times, %.3f ms (max %.3f ms)\n",
+            ringStats.waits, ringStats.waitTime, ringStats.maxWaitTime);
+}
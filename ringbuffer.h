@@ -0,0 +1,41 @@
+#ifndef SOLAR_SYSTEM_RING_BUFFER
+#define SOLAR_SYSTEM_RING_BUFFER
+
+/* Frames the CPU may write ahead of the GPU */
+#define ringFrames 3
+
+/* Buffer for data which changes every frame. With glBufferStorage it
+ * is mapped once, persistent and coherent, and split in ringFrames
+ * regions: the CPU writes the region of the next frame while the GPU
+ * still reads the previous ones, a fence per region tells when it can
+ * be reused. Without it, a single region in CPU memory is uploaded
+ * every frame */
+typedef struct ringBuffer {
+    int persistent; // 0 if glBufferStorage is not available
+    GLuint id;
+    GLsizeiptr frameSize; // size of one region, aligned for buffer ranges
+    char* memory; // mapped buffer, or the CPU copy without persistent mapping
+
+    int frame; // region written and drawn in the current frame
+    int open; // between BeginRingFrame and EndRingFrame
+    GLsync fences[ringFrames];
+} RingBuffer;
+
+typedef struct ringStats {
+    int waits; // fences not signaled yet, in the last frame
+    double waitTime; // milliseconds spent waiting in the last frame
+    double maxWaitTime;
+} RingStats;
+
+extern RingStats ringStats;
+
+GLsizeiptr RingAlignment();
+void InitRingBuffer(RingBuffer* ring, GLsizeiptr frameSize);
+void BeginRingFrame(RingBuffer* ring, int keepContents);
+void* RingFrameData(RingBuffer* ring, GLintptr offset);
+GLintptr RingFrameOffset(RingBuffer* ring, GLintptr offset);
+void FlushRingFrame(RingBuffer* ring);
+void EndRingFrame(RingBuffer* ring);
+void PrintRingStats();
+
+#endif
@@ -0,0 +1,16 @@
+#version 330
+
+flat in vec3 color;
+
+layout (location = 0) out vec4 FragColor;
+#ifdef BLOOM_OUTPUT
+layout (location = 1) out vec4 BrightColor;
+#endif
+
+void main()
+{
+    FragColor = vec4(color, 1.0);
+#ifdef BLOOM_OUTPUT
+    BrightColor = vec4(0.0, 0.0, 0.0, 1.0);
+#endif
+}
@@ -0,0 +1,59 @@
+#version 330
+
+// The smallest asteroids, see beltlod.h: a point sprite each, as large
+// as the asteroid on screen but at least a pixel. Lit as a whole, by
+// how much of the lit side faces the camera
+
+uniform mat4 ViewMatrix;
+uniform mat4 ProjectionMatrix;
+uniform vec4 Sphere; // bounding sphere of the mesh, object space
+uniform float projectedScale; // projected size of a unit sphere at distance 1, in pixels
+uniform vec3 Albedo; // average color of the mesh
+uniform float DiffuseFactor;
+uniform float AmbientFactor;
+
+// set by the program, see CreateVariantProgram
+#ifndef LIGHT_COUNT
+#define LIGHT_COUNT 3
+#endif
+struct Light {
+    vec3 position;
+    vec3 color;
+};
+// in view space, written by the CPU into the frame data buffer, see GPULight
+layout (std140) uniform Lights {
+    Light lights[LIGHT_COUNT];
+};
+
+const float PI = 3.14159265;
+
+// the first three rows of the row major transformation, per instance
+layout (location = 0) in vec4 TransformRow0;
+layout (location = 1) in vec4 TransformRow1;
+layout (location = 2) in vec4 TransformRow2;
+
+flat out vec3 color;
+
+void main()
+{
+    mat4 transformation = transpose(mat4(TransformRow0, TransformRow1, TransformRow2, vec4(0.0, 0.0, 0.0, 1.0)));
+    vec4 position = ViewMatrix * transformation * vec4(Sphere.xyz, 1.0);
+    float radius = Sphere.w * length(TransformRow0.xyz);
+
+    // asteroids smaller than the point are darkened by their coverage,
+    // so they do not flicker between a whole pixel and nothing
+    float pixelRadius = radius * projectedScale / max(-position.z, 1e-4);
+    gl_PointSize = max(2.0 * pixelRadius, 1.0);
+    float coverage = min(PI * pixelRadius * pixelRadius / (gl_PointSize * gl_PointSize), 1.0);
+
+    // diffuse light of a sphere, averaged over its disk, by the angle
+    // between the light and the camera; 2/3 seen from the light
+    vec3 toLight = normalize(lights[0].position - position.xyz);
+    vec3 toEye = normalize(-position.xyz);
+    float phase = acos(clamp(dot(toLight, toEye), -1.0, 1.0));
+    float lit = 2.0 / 3.0 * (sin(phase) + (PI - phase) * cos(phase)) / PI;
+
+    vec3 lightFactor = lit * lights[0].color * DiffuseFactor;
+    color = Albedo * (lightFactor + Albedo * AmbientFactor) * coverage;
+    gl_Position = ProjectionMatrix * position;
+}
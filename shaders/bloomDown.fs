@@ -0,0 +1,22 @@
+#version 330 core
+out vec4 FragColor;
+
+in vec2 TexCoords;
+
+uniform sampler2D image; // the level twice as large as the target
+
+void main()
+{
+    // the center of a target texel is the corner of 2x2 source texels;
+    // every tap averages such a block through linear filtering: the one
+    // below the center, and the four diagonal neighbours one texel away
+    vec2 texel = 1.0 / textureSize(image, 0);
+
+    vec3 sum = texture(image, TexCoords).rgb * 4.0;
+    sum += texture(image, TexCoords + vec2(-texel.x, -texel.y)).rgb;
+    sum += texture(image, TexCoords + vec2( texel.x, -texel.y)).rgb;
+    sum += texture(image, TexCoords + vec2(-texel.x,  texel.y)).rgb;
+    sum += texture(image, TexCoords + vec2( texel.x,  texel.y)).rgb;
+
+    FragColor = vec4(sum / 8.0, 1.0);
+}
@@ -6,21 +6,36 @@ in vec2 TexCoords;
 uniform sampler2D scene;
 uniform sampler2D bloomBlur;
 uniform int bloom;
+uniform vec4 bloomRect; // blurred region, min and max texture coordinates
 uniform float exposure;
 
-void main()
+const float gamma = 2.2;
+
+// final color at uv: scene and bloom, tone mapped and gamma corrected
+vec3 toneMapped(vec2 uv)
 {
-    const float gamma = 2.2;
-    vec3 hdrColor = texture(scene, TexCoords).rgb;
-    vec3 bloomColor = texture(bloomBlur, TexCoords).rgb;
+    vec3 hdrColor = texture(scene, uv).rgb;
 
-    if (bloom == 1) {
-        hdrColor += bloomColor; // blend colors
+    // the blurred image is only valid inside of its region
+    if (bloom == 1 && all(greaterThanEqual(uv, bloomRect.xy)) && all(lessThan(uv, bloomRect.zw))) {
+        hdrColor += texture(bloomBlur, uv).rgb; // blend colors
     }
 
     // reinhard algorithm for tone mapping
     vec3 result = vec3(1.0) - exp(-hdrColor * exposure);
     // gamma correction
-    result = pow(result, vec3(1.0 / gamma));
-    FragColor = vec4(result, 1.0);
+    return pow(result, vec3(1.0 / gamma));
+}
+
+float luma(vec3 color)
+{
+    return dot(color, vec3(0.299, 0.587, 0.114));
+}
+
+void main()
+{
+    vec3 result = toneMapped(TexCoords);
+
+    // the luma is read by the anti-aliasing, if it follows
+    FragColor = vec4(result, luma(result));
 }
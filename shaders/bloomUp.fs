@@ -0,0 +1,24 @@
+#version 330 core
+out vec4 FragColor;
+
+in vec2 TexCoords;
+
+uniform sampler2D image; // the level half as large as the target
+
+void main()
+{
+    // tent of 8 taps around the center: four on the axes one source
+    // texel away, and four diagonal ones half a texel away, weighted twice
+    vec2 halfTexel = 0.5 / textureSize(image, 0);
+
+    vec3 sum = texture(image, TexCoords + vec2(-halfTexel.x * 2.0, 0.0)).rgb;
+    sum += texture(image, TexCoords + vec2(halfTexel.x * 2.0, 0.0)).rgb;
+    sum += texture(image, TexCoords + vec2(0.0, -halfTexel.y * 2.0)).rgb;
+    sum += texture(image, TexCoords + vec2(0.0, halfTexel.y * 2.0)).rgb;
+    sum += texture(image, TexCoords + vec2(-halfTexel.x, -halfTexel.y)).rgb * 2.0;
+    sum += texture(image, TexCoords + vec2( halfTexel.x, -halfTexel.y)).rgb * 2.0;
+    sum += texture(image, TexCoords + vec2(-halfTexel.x,  halfTexel.y)).rgb * 2.0;
+    sum += texture(image, TexCoords + vec2( halfTexel.x,  halfTexel.y)).rgb * 2.0;
+
+    FragColor = vec4(sum / 12.0, 1.0);
+}
@@ -0,0 +1,90 @@
+#version 430
+
+// GPU culling: one invocation per instance. Visible instances are
+// appended to the visible list of their draw command, the instance
+// count of the command is the number of survivors. An instance of
+// several parts is appended to the command of every part, with the
+// part above PART_SHIFT of the index, in sync with gpuculling.h
+
+layout (local_size_x = 64) in;
+
+struct Instance {
+    mat4 transformation;
+    vec4 sphere; // object space center and radius
+    vec4 color;
+    uint command; // first indirect command of the instance
+    uint lodCount; // number of levels of detail following it
+    int textureLayer;
+    uint partCount; // commands per level of detail
+};
+
+struct DrawCommand {
+    uint count;
+    uint instanceCount;
+    uint firstIndex;
+    int baseVertex;
+    uint baseInstance;
+};
+
+layout (std430, row_major, binding = 0) readonly buffer Instances {
+    Instance instances[];
+};
+
+layout (std430, binding = 1) buffer Commands {
+    DrawCommand commands[];
+};
+
+layout (std430, binding = 2) writeonly buffer Visible {
+    uint visibleInstances[];
+};
+
+#define MAX_LODS 4
+#define PART_SHIFT 24
+uniform vec4 planes[6];
+uniform mat4 ViewMatrix;
+uniform float projectedScale; // projected size of a unit sphere at distance 1, in pixels
+uniform float lodPixelRadius[MAX_LODS]; // below this radius, the next level is used
+uniform uint instanceCount;
+
+void main()
+{
+    uint i = gl_GlobalInvocationID.x;
+    if (i >= instanceCount) {
+        return;
+    }
+
+    Instance instance = instances[i];
+    vec3 center = (instance.transformation * vec4(instance.sphere.xyz, 1.)).xyz;
+
+    // largest axis scale keeps the sphere conservative
+    mat3 m = mat3(instance.transformation);
+    float scale = max(dot(m[0], m[0]), max(dot(m[1], m[1]), dot(m[2], m[2])));
+    float radius = instance.sphere.w * sqrt(scale);
+
+    for (int p = 0; p < 6; p++) {
+        if (dot(planes[p].xyz, center) + planes[p].w <= -radius) {
+            return;
+        }
+    }
+
+    // select the level of detail by the projected radius; below the
+    // radius of the last level the object is culled, so with a single
+    // level this is only a size cutoff
+    float distance = -(ViewMatrix * vec4(center, 1.)).z;
+    uint lod = 0u;
+    if (distance > radius) {
+        float pixelRadius = radius * projectedScale / distance;
+        while (lod < instance.lodCount && pixelRadius < lodPixelRadius[lod]) {
+            lod++;
+        }
+    }
+    if (lod >= instance.lodCount) {
+        return;
+    }
+
+    for (uint part = 0u; part < instance.partCount; part++) {
+        uint command = instance.command + lod * instance.partCount + part;
+        uint slot = atomicAdd(commands[command].instanceCount, 1u);
+        visibleInstances[commands[command].baseInstance + slot] = i | part << PART_SHIFT;
+    }
+}
@@ -5,9 +5,7 @@ layout (location = 1) in vec3 Color;
 layout (location = 2) in vec3 Normal;
 layout (location = 3) in vec2 UV;
 
-uniform mat4 ProjectionMatrix;
-uniform mat4 ViewMatrix;
-uniform mat4 TransformMatrix;
+uniform mat4 ModelViewProjectionMatrix; // computed once per object on the CPU
 
 out Data
 {
@@ -19,8 +17,7 @@ out Data
 
 void main()
 {
-    mat4 mv = ViewMatrix*TransformMatrix;
-    vdata.mvp = ProjectionMatrix * mv;
+    vdata.mvp = ModelViewProjectionMatrix;
     vdata.position = vec4(Position, 1.);
     vdata.normal = vec4(Normal, 1.);
 }
@@ -0,0 +1,131 @@
+#version 330 core
+out vec4 FragColor;
+
+in vec2 TexCoords;
+
+// tone mapped by the merge, with the luma in alpha
+uniform sampler2D image;
+uniform int quality; // 1: low, 2: high
+
+float lumaAt(vec2 uv)
+{
+    return texture(image, uv).a;
+}
+
+// steps of the search along an edge, in texels: low quality takes few
+// but long ones, high quality walks the first texels one by one
+const float lowSteps[3] = float[3](1.5, 3.0, 12.0);
+const float highSteps[12] = float[12](1.0, 1.0, 1.0, 1.0, 1.0, 1.5, 2.0, 2.0, 2.0, 2.0, 4.0, 8.0);
+
+float searchStep(int quality, int i)
+{
+    return quality == 1 ? lowSteps[i] : highSteps[i];
+}
+
+/* FXAA: finds the ends of the edge through the pixel by searching
+ * along it, and blends the pixel with the one across the edge by how
+ * close it is to the nearer end. Thin features are blended by their
+ * contrast to the neighborhood */
+vec3 fxaa(vec2 uv, vec2 texel, vec4 center, int quality)
+{
+    vec3 color = center.rgb;
+    float lumaM = center.a;
+    float lumaN = lumaAt(uv + vec2(0.0, -1.0) * texel);
+    float lumaS = lumaAt(uv + vec2(0.0, 1.0) * texel);
+    float lumaW = lumaAt(uv + vec2(-1.0, 0.0) * texel);
+    float lumaE = lumaAt(uv + vec2(1.0, 0.0) * texel);
+
+    float lumaMin = min(lumaM, min(min(lumaN, lumaS), min(lumaW, lumaE)));
+    float lumaMax = max(lumaM, max(max(lumaN, lumaS), max(lumaW, lumaE)));
+    // edges with too little contrast are left alone
+    if (lumaMax - lumaMin < max(quality == 1 ? 0.0625 : 0.0312, lumaMax * 0.125)) {
+        return color;
+    }
+    float range = lumaMax - lumaMin;
+
+    float lumaNW = lumaAt(uv + vec2(-1.0, -1.0) * texel);
+    float lumaNE = lumaAt(uv + vec2(1.0, -1.0) * texel);
+    float lumaSW = lumaAt(uv + vec2(-1.0, 1.0) * texel);
+    float lumaSE = lumaAt(uv + vec2(1.0, 1.0) * texel);
+
+    // horizontal or vertical edge
+    float edgeHorizontal = abs(lumaNW - 2.0 * lumaW + lumaSW) + 2.0 * abs(lumaN - 2.0 * lumaM + lumaS)
+        + abs(lumaNE - 2.0 * lumaE + lumaSE);
+    float edgeVertical = abs(lumaNW - 2.0 * lumaN + lumaNE) + 2.0 * abs(lumaW - 2.0 * lumaM + lumaE)
+        + abs(lumaSW - 2.0 * lumaS + lumaSE);
+    bool horizontal = edgeHorizontal >= edgeVertical;
+
+    // blend of thin features, by the contrast to the average around
+    float average = (2.0 * (lumaN + lumaS + lumaW + lumaE) + lumaNW + lumaNE + lumaSW + lumaSE) / 12.0;
+    float contrast = clamp(abs(average - lumaM) / range, 0.0, 1.0);
+    float subpixel = (-2.0 * contrast + 3.0) * contrast * contrast;
+    subpixel = subpixel * subpixel * 0.75;
+
+    // the pixel across the edge
+    float lumaNegative = horizontal ? lumaN : lumaW;
+    float lumaPositive = horizontal ? lumaS : lumaE;
+    float gradientNegative = abs(lumaNegative - lumaM);
+    float gradientPositive = abs(lumaPositive - lumaM);
+    float stepLength = horizontal ? texel.y : texel.x;
+    float lumaPair = lumaPositive;
+    if (gradientNegative >= gradientPositive) {
+        stepLength = -stepLength;
+        lumaPair = lumaNegative;
+    }
+
+    // walk along the edge, between the two pixels, in both directions
+    // until the luma changes; the steps grow with the distance
+    vec2 edge = uv;
+    vec2 along = horizontal ? vec2(texel.x, 0.0) : vec2(0.0, texel.y);
+    if (horizontal) {
+        edge.y += stepLength * 0.5;
+    } else {
+        edge.x += stepLength * 0.5;
+    }
+    // luma on the edge, the average of the two pixels; an end is where
+    // the taps of the search get half way closer to either of them
+    float lumaLocal = lumaAt(edge);
+    float gradientScaled = 0.5 * min(abs(lumaM - lumaLocal), abs(lumaPair - lumaLocal));
+
+    int steps = quality == 1 ? 3 : 12;
+    vec2 endNegative = edge - along;
+    vec2 endPositive = edge + along;
+    float lumaEndNegative = lumaAt(endNegative) - lumaLocal;
+    float lumaEndPositive = lumaAt(endPositive) - lumaLocal;
+    bool doneNegative = abs(lumaEndNegative) >= gradientScaled;
+    bool donePositive = abs(lumaEndPositive) >= gradientScaled;
+    for (int i = 0; i < steps && !(doneNegative && donePositive); i++) {
+        if (!doneNegative) {
+            endNegative -= along * searchStep(quality, i);
+            lumaEndNegative = lumaAt(endNegative) - lumaLocal;
+            doneNegative = abs(lumaEndNegative) >= gradientScaled;
+        }
+        if (!donePositive) {
+            endPositive += along * searchStep(quality, i);
+            lumaEndPositive = lumaAt(endPositive) - lumaLocal;
+            donePositive = abs(lumaEndPositive) >= gradientScaled;
+        }
+    }
+
+    float distanceNegative = horizontal ? uv.x - endNegative.x : uv.y - endNegative.y;
+    float distancePositive = horizontal ? endPositive.x - uv.x : endPositive.y - uv.y;
+    bool nearerNegative = distanceNegative < distancePositive;
+    float distanceNearer = min(distanceNegative, distancePositive);
+
+    // only blend towards an end where the edge turns to the side of the pixel
+    bool centerBelow = lumaM - lumaLocal < 0.0;
+    bool goodSpan = ((nearerNegative ? lumaEndNegative : lumaEndPositive) < 0.0) != centerBelow;
+    float offset = goodSpan ? 0.5 - distanceNearer / (distanceNegative + distancePositive) : 0.0;
+    offset = max(offset, subpixel);
+
+    // a filtered tap towards the pixel across the edge blends the two
+    vec2 across = horizontal ? vec2(0.0, stepLength) : vec2(stepLength, 0.0);
+    return texture(image, uv + across * offset).rgb;
+}
+
+void main()
+{
+    // edges are found in the texels of the image, whatever the render scale
+    vec2 texel = 1.0 / vec2(textureSize(image, 0));
+    FragColor = vec4(fxaa(TexCoords, texel, texture(image, TexCoords), quality), 1.0);
+}
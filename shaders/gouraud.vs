@@ -1,14 +1,13 @@
 #version 330
 
-// Uniform input
-uniform mat4 ProjectionMatrix;
-uniform mat4 ViewMatrix;
-uniform mat4 TransformMatrix;
+// Uniform input, computed once per object on the CPU
+uniform mat4 ModelViewMatrix;
+uniform mat4 ModelViewProjectionMatrix;
+uniform mat3 NormalMatrix; // inverse transpose of the modelview matrix
 
 uniform float DiffuseFactor;
 uniform float SpecularFactor;
 uniform float AmbientFactor;
-uniform int isSun;
 
 uniform sampler2D tex;
 
@@ -18,19 +17,24 @@ layout (location = 1) in vec3 Color;
 layout (location = 2) in vec3 Normal;
 layout (location = 3) in vec2 UV;
 
+// set by the program, see CreateVariantProgram
+#ifndef LIGHT_COUNT
 #define LIGHT_COUNT 3
+#endif
 struct Light {
     vec3 position;
     vec3 color;
 };
-uniform Light lights[LIGHT_COUNT];
+// in view space, written by the CPU into the frame data buffer, see GPULight
+layout (std140) uniform Lights {
+    Light lights[LIGHT_COUNT];
+};
 
 // Output sent to the fragment Shader
 out vec4 vColor;
 
-vec3 calculatePhong(vec3 normal, vec3 vertPos, Light light) {
-    // vertex to lightsource vector (L)
-    vec3 lightPos = (ViewMatrix * vec4(light.position, 1.)).xyz;
+vec3 calculatePhong(vec3 normal, vec3 vertPos, vec3 lightPos, vec3 lightColor) {
+    // vertex to lightsource vector (L), both in view space
     vec3 lightDir = normalize(lightPos - vertPos);
 
     vec3 viewer = normalize(-vertPos.xyz);
@@ -44,7 +48,7 @@ vec3 calculatePhong(vec3 normal, vec3 vertPos, Light light) {
     // n: normal
     // l: lightVector1
     // clamp(Normal x LightVector): between 0 and 1
-    vec3 diffusePart = clamp(dot(normal, lightDir), 0.0, 1.0) * light.color;
+    vec3 diffusePart = clamp(dot(normal, lightDir), 0.0, 1.0) * lightColor;
     diffusePart *= vec3(DiffuseFactor);
 
     // Specular Reflection: I_s = k_S * I_L * (n x h)^m
@@ -53,7 +57,7 @@ vec3 calculatePhong(vec3 normal, vec3 vertPos, Light light) {
     // I_L: LightColor1 (Light at Surface Location)
     // n: normal
     // h: halfway vector
-    vec3 specularPart = pow(clamp(dot(normal, halfVector1),0.0,1.0),5.0) * light.color;
+    vec3 specularPart = pow(clamp(dot(normal, halfVector1),0.0,1.0),5.0) * lightColor;
     specularPart *= vec3(SpecularFactor);
 
     // final color is the sum of 3 terms
@@ -66,37 +70,30 @@ vec3 calculatePhong(vec3 normal, vec3 vertPos, Light light) {
 
 void main()
 {
-    // Compute modelview matrix
-    mat4 modelViewMatrix = ViewMatrix * TransformMatrix;
-    mat4 modelViewProjectionMatrix = ProjectionMatrix * modelViewMatrix;
-
     vec4 TexColor = texture2D(tex, UV);
 
-    if (isSun == 0) {
-        // Compute a 4*4 normal matrix
-        mat4 normalMatrix = transpose(inverse(modelViewMatrix));
-        vec3 normal = normalize((normalMatrix * vec4(normalize(Normal), 1.0)).xyz);
-
-        // Compute vertex position in Model space
-        vec4 position = modelViewMatrix * vec4(Position,1.0);
+#ifdef IS_EMISSIVE
+    // ignore lighting if its the sun
+    vColor = vec4(TexColor.xyz, 1.);
+#else
+    vec3 normal = normalize(NormalMatrix * normalize(Normal));
 
-        vec3 lightFactor = calculatePhong(normal, position.xyz, lights[0]);
-        for(int i = 1; i < LIGHT_COUNT; i++){
-            lightFactor += calculatePhong(normal, position.xyz, lights[i]);
-        }
+    // Compute vertex position in Model space
+    vec4 position = ModelViewMatrix * vec4(Position,1.0);
 
-        // Ambient Reflection: I_A = k_A * I_L
-        // k_A: AmbientFactor
-        // I_L: Light at Surface Location (LightColor1???)
-        vec3 ambientPart = vec3(TexColor.xyz * AmbientFactor);
-
-        vColor = vec4(TexColor.xyz * (lightFactor + ambientPart), 1.);
-    } else {
-        // ignore lighting if its the sun
-        vColor = vec4(TexColor.xyz, 1.);
+    vec3 lightFactor = calculatePhong(normal, position.xyz, lights[0].position, lights[0].color);
+    for(int i = 1; i < LIGHT_COUNT; i++){
+        lightFactor += calculatePhong(normal, position.xyz, lights[i].position, lights[i].color);
     }
 
+    // Ambient Reflection: I_A = k_A * I_L
+    // k_A: AmbientFactor
+    // I_L: Light at Surface Location (LightColor1???)
+    vec3 ambientPart = vec3(TexColor.xyz * AmbientFactor);
+
+    vColor = vec4(TexColor.xyz * (lightFactor + ambientPart), 1.);
+#endif
 
-    gl_Position = modelViewProjectionMatrix * vec4(Position, 1.0);
+    gl_Position = ModelViewProjectionMatrix * vec4(Position, 1.0);
 
 }
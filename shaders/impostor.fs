@@ -0,0 +1,48 @@
+#version 330
+
+uniform float DiffuseFactor;
+uniform float AmbientFactor;
+
+uniform sampler2D atlas; // color and coverage
+uniform sampler2D normalAtlas; // object space normals
+
+in vec2 atlasCoords;
+in vec3 vertPosInt;
+flat in mat3 normalMatrix;
+
+// set by the program, see CreateVariantProgram
+#ifndef LIGHT_COUNT
+#define LIGHT_COUNT 3
+#endif
+struct Light {
+    vec3 position;
+    vec3 color;
+};
+// in view space, written by the CPU into the frame data buffer, see GPULight
+layout (std140) uniform Lights {
+    Light lights[LIGHT_COUNT];
+};
+
+layout (location = 0) out vec4 FragColor;
+#ifdef BLOOM_OUTPUT
+layout (location = 1) out vec4 BrightColor;
+#endif
+
+void main()
+{
+    vec4 TexColor = texture(atlas, atlasCoords);
+    if (TexColor.a < 0.5) {
+        discard;
+    }
+    vec3 normal = normalize(normalMatrix * (texture(normalAtlas, atlasCoords).xyz * 2.0 - 1.0));
+
+    // impostors are small on screen: the reduced shading of phong.fs
+    vec3 lightDir = normalize(lights[0].position - vertPosInt);
+    vec3 lightFactor = clamp(dot(normal, lightDir), 0.0, 1.0) * lights[0].color * DiffuseFactor;
+    vec3 ambientPart = TexColor.rgb * AmbientFactor;
+
+    FragColor = vec4(TexColor.rgb * (lightFactor + ambientPart), 1.0);
+#ifdef BLOOM_OUTPUT
+    BrightColor = vec4(0.0, 0.0, 0.0, 1.0);
+#endif
+}
@@ -0,0 +1,63 @@
+#version 330
+
+// Impostor of an asteroid, see beltlod.h: a quad with the view of the
+// atlas closest to the direction of the camera. The quad lies in the
+// image plane of that view, through the center of the bounding sphere,
+// and turns with the asteroid like the mesh would
+
+uniform mat4 ViewMatrix;
+uniform mat4 ProjectionMatrix;
+uniform vec3 Eye; // camera position, world space
+uniform vec4 Sphere; // bounding sphere of the mesh, object space
+
+// views of the atlas, in sync with beltlod.h
+#define COLUMNS 8
+#define ROWS 4
+const float PI = 3.14159265;
+
+// the first three rows of the row major transformation, per instance
+layout (location = 0) in vec4 TransformRow0;
+layout (location = 1) in vec4 TransformRow1;
+layout (location = 2) in vec4 TransformRow2;
+
+out vec2 atlasCoords;
+out vec3 vertPosInt;
+flat out mat3 normalMatrix; // object to view space, scaled
+
+// right and top of the image of a view, the same as viewAxes in beltlod.c
+void viewAxes(ivec2 cell, out vec3 right, out vec3 up)
+{
+    float longitude = 2.0 * PI * (float(cell.x) + 0.5) / float(COLUMNS);
+    float latitude = PI * (float(cell.y) + 0.5) / float(ROWS) - PI / 2.0;
+    vec3 direction = vec3(cos(latitude) * cos(longitude), sin(latitude), cos(latitude) * sin(longitude));
+    right = normalize(vec3(direction.z, 0.0, -direction.x));
+    up = cross(direction, right);
+}
+
+void main()
+{
+    // the rows are the columns of the transposed matrix
+    mat4 transformation = transpose(mat4(TransformRow0, TransformRow1, TransformRow2, vec4(0.0, 0.0, 0.0, 1.0)));
+    vec3 center = (transformation * vec4(Sphere.xyz, 1.0)).xyz;
+
+    // direction to the camera in object space; asteroids are scaled
+    // uniformly, so the transpose turns back
+    vec3 toEye = normalize(transpose(mat3(transformation)) * (Eye - center));
+    float longitude = atan(toEye.z, toEye.x);
+    float latitude = asin(clamp(toEye.y, -1.0, 1.0));
+    ivec2 cell = ivec2(int(floor(longitude / (2.0 * PI) * float(COLUMNS) + float(COLUMNS))) % COLUMNS,
+            clamp(int(floor((latitude / PI + 0.5) * float(ROWS))), 0, ROWS - 1));
+
+    vec3 right, up;
+    viewAxes(cell, right, up);
+
+    // corners of a triangle strip
+    vec2 corner = vec2(gl_VertexID & 1, gl_VertexID >> 1) * 2.0 - 1.0;
+    vec3 objectPosition = Sphere.xyz + (corner.x * right + corner.y * up) * Sphere.w;
+    vec4 position = ViewMatrix * transformation * vec4(objectPosition, 1.0);
+
+    atlasCoords = (vec2(cell) + corner * 0.5 + 0.5) / vec2(COLUMNS, ROWS);
+    vertPosInt = position.xyz;
+    normalMatrix = mat3(ViewMatrix) * mat3(transformation);
+    gl_Position = ProjectionMatrix * position;
+}
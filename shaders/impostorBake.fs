@@ -0,0 +1,17 @@
+#version 330
+
+uniform sampler2D tex;
+
+in vec3 normalInt;
+in vec2 UVcoords;
+
+// unlit color with full coverage, and the normal mapped to colors;
+// the impostors are lit when drawn
+layout (location = 0) out vec4 FragColor;
+layout (location = 1) out vec4 NormalColor;
+
+void main()
+{
+    FragColor = vec4(texture(tex, UVcoords).rgb, 1.0);
+    NormalColor = vec4(normalize(normalInt) * 0.5 + 0.5, 1.0);
+}
@@ -0,0 +1,19 @@
+#version 330
+
+// Draws the asteroid mesh into a cell of the impostor atlas, see
+// BakeBeltImpostors: orthographic, the bounding sphere fills the cell
+uniform mat4 BakeMatrix;
+
+layout (location = 0) in vec3 Position;
+layout (location = 2) in vec3 Normal;
+layout (location = 3) in vec2 UV;
+
+out vec3 normalInt; // object space
+out vec2 UVcoords;
+
+void main()
+{
+    normalInt = Normal;
+    UVcoords = UV;
+    gl_Position = BakeMatrix * vec4(Position, 1.0);
+}
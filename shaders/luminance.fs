@@ -0,0 +1,30 @@
+#version 330 core
+out vec2 FragColor;
+
+in vec2 TexCoords;
+
+uniform sampler2D scene; // HDR scene, much larger than the target
+
+// darker pixels are empty space, which would drag the average down
+// until the planets are overexposed
+const float minLuminance = 0.05;
+
+void main()
+{
+    // four taps spread over the footprint of the target texel, each
+    // averaging 2x2 scene texels through linear filtering
+    vec2 quarter = 0.25 * fwidth(TexCoords);
+
+    // red: sum of the log luminance of the lit taps, green: their part;
+    // the mipmaps average both, and their ratio is the log average
+    vec2 result = vec2(0.0);
+    for (int i = 0; i < 4; i++) {
+        vec2 offset = vec2(i % 2 == 0 ? -quarter.x : quarter.x, i < 2 ? -quarter.y : quarter.y);
+        vec3 color = texture(scene, TexCoords + offset).rgb;
+        float luminance = dot(color, vec3(0.2126, 0.7152, 0.0722));
+        if (luminance > minLuminance) {
+            result += vec2(log(luminance), 1.0);
+        }
+    }
+    FragColor = result / 4.0;
+}
@@ -0,0 +1,33 @@
+#version 330
+
+// should be in sync with orbits.h
+#define maxOrbits 16
+#define maxOrbitSegments 1024
+
+uniform mat4 ProjectionMatrix;
+uniform mat4 ViewMatrix;
+uniform mat4 OrbitTransforms[maxOrbits];
+uniform vec3 OrbitEllipses[maxOrbits]; // semimajor, semiminor, inclination
+uniform vec3 OrbitColors[maxOrbits];
+uniform int OrbitSegments[maxOrbits];
+
+out vec4 vColor;
+
+void main()
+{
+   // orbit i is drawn with the vertex ids starting at i*maxOrbitSegments
+   int orbit = gl_VertexID / maxOrbitSegments;
+   int segment = gl_VertexID - orbit*maxOrbitSegments;
+   float angle = 6.28318531 * float(segment) / float(OrbitSegments[orbit]);
+
+   // same as planetPosition in solarsystem.c
+   vec3 ellipse = OrbitEllipses[orbit];
+   vec3 position = vec3(ellipse.y * sin(angle), 0., ellipse.x * cos(angle));
+   if (ellipse.z != 0.) {
+       position.x = position.x * cos(ellipse.z);
+       position.y = position.x * sin(ellipse.z);
+   }
+
+   gl_Position = ProjectionMatrix*ViewMatrix*OrbitTransforms[orbit]*vec4(position, 1.0);
+   vColor = vec4(OrbitColors[orbit], 1.);
+}
@@ -3,29 +3,63 @@
 uniform float DiffuseFactor;
 uniform float SpecularFactor;
 uniform float AmbientFactor;
-uniform mat4 ViewMatrix;
-uniform int isSun;
 uniform int bloomFactor;
 
+#ifdef INDIRECT
+// indirect draws: all bodies share one array texture, the layer comes
+// from the instance buffer
+uniform sampler2DArray tex;
+flat in int textureLayer;
+#define TEX_COORDS(uv) vec3(uv, textureLayer)
+#else
 uniform sampler2D tex;
+#define TEX_COORDS(uv) (uv)
+#endif
 
-in vec3 normalInt;
 in vec3 vertPosInt;
+#ifdef RAY_CAST
+uniform mat4 ProjectionMatrix;
+flat in vec3 sphereCenter;
+flat in float sphereRadius;
+flat in mat3 viewToObject;
+#else
+in vec3 normalInt;
 in vec2 UVcoords; // coordinates of fragment
+#endif
 
+// set by the program, see CreateVariantProgram
+#ifndef LIGHT_COUNT
 #define LIGHT_COUNT 3
+#endif
 struct Light {
     vec3 position;
     vec3 color;
 };
-uniform Light lights[LIGHT_COUNT];
+// in view space, written by the CPU into the frame data buffer, see GPULight
+layout (std140) uniform Lights {
+    Light lights[LIGHT_COUNT];
+};
+
+// point lights of the cluster of the fragment, see clusters.h
+#ifndef CLUSTER_TILES_X
+#define CLUSTER_TILES_X 16
+#define CLUSTER_TILES_Y 9
+#define CLUSTER_SLICES 24
+#endif
+uniform usamplerBuffer ClusterData; // offset and count per cluster, then the light indices
+uniform samplerBuffer PointLights; // view space position and radius, color
+uniform int ClusterDataOffset; // texels of the current frame
+uniform int PointLightsOffset;
+uniform vec2 ClusterTileSize; // in pixels
+uniform vec2 ClusterSlices; // slice of a depth z: log(z) * x + y
 
 layout (location = 0) out vec4 FragColor;
+#ifdef BLOOM_OUTPUT
 layout (location = 1) out vec4 BrightColor;
+#endif
 
-vec3 calculatePhong(vec3 normal, vec3 vertPos, Light light) {
-    // vertex to lightsource vector (L)
-    vec3 lightPos = (ViewMatrix * vec4(light.position, 1.)).xyz;
+vec3 calculatePhong(vec3 normal, vec3 vertPos, vec3 lightPos, vec3 lightColor) {
+    // vertex to lightsource vector (L), both in view space
     vec3 lightDir = normalize(lightPos - vertPos);
 
     vec3 viewer = normalize(-vertPos.xyz);
@@ -39,7 +73,7 @@ vec3 calculatePhong(vec3 normal, vec3 vertPos, Light light) {
     // n: normal
     // l: lightVector1
     // clamp(Normal x LightVector): between 0 and 1
-    vec3 diffusePart = clamp(dot(normal, lightDir), 0.0, 1.0) * light.color;
+    vec3 diffusePart = clamp(dot(normal, lightDir), 0.0, 1.0) * lightColor;
     diffusePart *= vec3(DiffuseFactor);
 
     // Specular Reflection: I_s = k_S * I_L * (n x h)^m
@@ -48,7 +82,7 @@ vec3 calculatePhong(vec3 normal, vec3 vertPos, Light light) {
     // I_L: LightColor1 (Light at Surface Location)
     // n: normal
     // h: halfway vector
-    vec3 specularPart = pow(clamp(dot(normal, halfVector1),0.0,1.0),5.0) * light.color;
+    vec3 specularPart = pow(clamp(dot(normal, halfVector1),0.0,1.0),5.0) * lightColor;
     specularPart *= vec3(SpecularFactor);
 
     // final color is the sum of 3 terms
@@ -59,32 +93,121 @@ vec3 calculatePhong(vec3 normal, vec3 vertPos, Light light) {
     return diffusePart + specularPart;
 }
 
+vec3 calculatePointLights(vec3 normal, vec3 vertPos) {
+    vec3 cell = vec3(gl_FragCoord.xy / ClusterTileSize, log(-vertPos.z) * ClusterSlices.x + ClusterSlices.y);
+    ivec3 tiles = ivec3(CLUSTER_TILES_X, CLUSTER_TILES_Y, CLUSTER_SLICES);
+    ivec3 index = clamp(ivec3(cell), ivec3(0), tiles - 1);
+    int cluster = ClusterDataOffset + 2 * (index.x + tiles.x * (index.y + tiles.y * index.z));
+
+    int first = ClusterDataOffset + int(texelFetch(ClusterData, cluster).r);
+    int count = int(texelFetch(ClusterData, cluster + 1).r);
+
+    vec3 result = vec3(0.);
+    for (int i = 0; i < count; i++) {
+        int light = PointLightsOffset + 2 * int(texelFetch(ClusterData, first + i).r);
+        vec4 positionRadius = texelFetch(PointLights, light);
+        vec3 color = texelFetch(PointLights, light + 1).rgb;
+
+        // smooth falloff, which reaches 0 at the radius of the light
+        float distance = length(positionRadius.xyz - vertPos);
+        float falloff = clamp(1. - pow(distance / positionRadius.w, 4.), 0., 1.);
+        float attenuation = falloff * falloff / (distance * distance + 1.);
+
+        result += calculatePhong(normal, vertPos, positionRadius.xyz, color * attenuation);
+    }
+    return result;
+}
+
+#ifdef RAY_CAST
+const float PI = 3.14159265358979;
+
+/* Hit of the ray through the fragment with the sphere, in view space;
+ * writes its depth. Returns false if the ray misses the sphere, or hits
+ * it in front of the near plane */
+bool intersectSphere(out vec3 position, out vec3 normal)
+{
+    vec3 ray = normalize(vertPosInt);
+    float b = dot(ray, sphereCenter);
+    float discriminant = b * b - dot(sphereCenter, sphereCenter) + sphereRadius * sphereRadius;
+    // a miss takes the closest point, its neighbours still need its derivatives
+    position = ray * (b - sqrt(max(discriminant, 0.0)));
+    normal = normalize(position - sphereCenter);
+
+    vec4 clip = ProjectionMatrix * vec4(position, 1.0);
+    gl_FragDepth = clip.z / clip.w * 0.5 + 0.5;
+
+    float near = ProjectionMatrix[3][2] / (ProjectionMatrix[2][2] - 1.0);
+    return discriminant >= 0.0 && -position.z >= near;
+}
+
+/* Texture at the object space normal, mapped like models/sphere.obj. The
+ * longitude jumps from 1 to 0 at the seam, where its derivatives would
+ * pick the smallest mipmap; the longitude turned by half a turn is
+ * continuous there, the smaller derivatives of both are used */
+vec4 sphereTexture(vec3 normal)
+{
+    vec2 uv = vec2(0.5 - atan(normal.z, normal.x) / (2.0 * PI), asin(clamp(normal.y, -1.0, 1.0)) / PI + 0.5);
+    float turned = fract(uv.x + 0.5);
+
+    vec2 dx = dFdx(uv);
+    vec2 dy = dFdy(uv);
+    if (abs(dFdx(turned)) + abs(dFdy(turned)) < abs(dx.x) + abs(dy.x)) {
+        dx.x = dFdx(turned);
+        dy.x = dFdy(turned);
+    }
+    return textureGrad(tex, TEX_COORDS(uv), dx, dy);
+}
+#endif
+
 void main()
 {
+#ifdef RAY_CAST
+    vec3 vertPos;
+    vec3 normal;
+    bool hit = intersectSphere(vertPos, normal);
+    vec4 TexColor = sphereTexture(normalize(viewToObject * normal));
+    // discarded after the texture read, which needs the derivatives
+    if (!hit) {
+        discard;
+    }
+#else
     // Read color at UVcoords position in the texture
-    vec4 TexColor = texture2D(tex, UVcoords);
-    vec3 result = TexColor.rgb; // default value to current texture color
-
-    if (isSun == 0) {
-        // normalize vector again, in case its not unit anymore
-        // because of interpolation
-        vec3 normal = normalize(normalInt);
-
-        vec3 lightFactor = calculatePhong(normal, vertPosInt, lights[0]);
-        for(int i = 1; i < LIGHT_COUNT; i++){
-            lightFactor += calculatePhong(normal, vertPosInt, lights[i]);
-        }
-
-        // Ambient Reflection: I_A = k_A * I_L
-        // k_A: AmbientFactor
-        // I_L: Light at Surface Location (LightColor1???)
-        vec3 ambientPart = vec3(TexColor * AmbientFactor);
-        vec3 result = (lightFactor + ambientPart);
-
-        FragColor = vec4(TexColor.xyz * result, 1.);
-        BrightColor = vec4(0.0, 0.0, 0.0, 1.0);
-    } else {
-        FragColor = vec4(result, 1.);
-        BrightColor = vec4(result*bloomFactor, 1.);
+    vec4 TexColor = texture(tex, TEX_COORDS(UVcoords));
+
+    // normalize vector again, in case its not unit anymore
+    // because of interpolation
+    vec3 normal = normalize(normalInt);
+    vec3 vertPos = vertPosInt;
+#endif
+
+#ifdef IS_EMISSIVE
+    // ignore lighting, the body is a light source itself
+    FragColor = vec4(TexColor.rgb, 1.);
+#ifdef BLOOM_OUTPUT
+    BrightColor = vec4(TexColor.rgb*bloomFactor, 1.);
+#endif
+#else
+#ifdef REDUCED_SHADING
+    // tiny on screen: only the diffuse part of the first light
+    vec3 lightDir = normalize(lights[0].position - vertPos);
+    vec3 lightFactor = clamp(dot(normal, lightDir), 0.0, 1.0) * lights[0].color * DiffuseFactor;
+#else
+    vec3 lightFactor = calculatePhong(normal, vertPos, lights[0].position, lights[0].color);
+    for(int i = 1; i < LIGHT_COUNT; i++){
+        lightFactor += calculatePhong(normal, vertPos, lights[i].position, lights[i].color);
     }
+    lightFactor += calculatePointLights(normal, vertPos);
+#endif
+
+    // Ambient Reflection: I_A = k_A * I_L
+    // k_A: AmbientFactor
+    // I_L: Light at Surface Location (LightColor1???)
+    vec3 ambientPart = vec3(TexColor * AmbientFactor);
+    vec3 result = (lightFactor + ambientPart);
+
+    FragColor = vec4(TexColor.xyz * result, 1.);
+#ifdef BLOOM_OUTPUT
+    BrightColor = vec4(0.0, 0.0, 0.0, 1.0);
+#endif
+#endif
 }
@@ -4,42 +4,131 @@
 // in gouraud light calculations are done per vertex
 // in phong they are done per fragment
 
-// Uniform input
-uniform mat4 ProjectionMatrix;
+#ifdef INDIRECT
+// GPU culled indirect draws, built with #version 430: transformation and
+// material are read from the instance buffer, indexed by the visible list of the draw
 uniform mat4 ViewMatrix;
-uniform mat4 TransformMatrix;
+
+struct Instance {
+    mat4 transformation;
+    vec4 sphere;
+    vec4 color;
+    uint command;
+    uint lodCount;
+    int textureLayer;
+    uint partCount;
+};
+
+layout (std430, row_major, binding = 0) readonly buffer Instances {
+    Instance instances[];
+};
+#else
+// Uniform input, computed once per object on the CPU
+uniform mat4 ModelViewMatrix;
+uniform mat4 ModelViewProjectionMatrix;
+// inverse transpose of the modelview matrix
+uniform mat3 NormalMatrix;
+#endif
+#if defined(RAY_CAST) || defined(INDIRECT)
+uniform mat4 ProjectionMatrix;
+#endif
 
 // Content of the vertex data (attributes)
 layout (location = 0) in vec3 Position;
 layout (location = 1) in vec3 Color;
 layout (location = 2) in vec3 Normal;
 layout (location = 3) in vec2 UV;
+#ifdef INDIRECT
+// one per instance, from the visible list; the part of the mesh is
+// stored above bit 24, see cull.cs
+layout (location = 4) in uint InstanceIndex;
+#endif
 
 // varying variables will be passed to the fragment shader. This values also get interpolated between vertices
-out vec3 normalInt;
 out vec3 vertPosInt;
+#ifdef INDIRECT
+flat out int textureLayer;
+#endif
+#ifdef RAY_CAST
+// the unit sphere of the modelview matrix, in view space
+flat out vec3 sphereCenter;
+flat out float sphereRadius;
+flat out mat3 viewToObject;
+#else
+out vec3 normalInt;
 out vec2 UVcoords;
+#endif
 
-void main()
+#ifdef RAY_CAST
+/* Places the corner Position (-1..1) of a quad covering the unit sphere
+ * of the modelview matrix, which is scaled uniformly. The quad stands on
+ * the sphere center, facing the camera, and covers the cone of rays
+ * touching the sphere; phong.fs intersects the rays with the sphere */
+void rayCastQuad(mat4 modelView)
 {
-    // Compute modelview matrix
-    mat4 modelViewMatrix = ViewMatrix * TransformMatrix;
-    mat4 modelViewProjectionMatrix = ProjectionMatrix * modelViewMatrix;
+    sphereCenter = modelView[3].xyz;
+    sphereRadius = length(modelView[0].xyz);
+    viewToObject = transpose(mat3(modelView));
 
-    // Compute a 4*4 normal matrix
-    // this fixes transformations made on the model, which would make
-    // the normal vector not perpendicular
-    mat4 normalMatrix = transpose(inverse(modelViewMatrix));
+    float distance = length(sphereCenter);
+    vec3 axis = sphereCenter / distance;
+    vec3 right = normalize(cross(axis, abs(axis.y) < 0.99 ? vec3(0.0, 1.0, 0.0) : vec3(1.0, 0.0, 0.0)));
+    vec3 up = cross(right, axis);
+    float halfSize = sphereRadius * distance / sqrt(max(distance * distance - sphereRadius * sphereRadius, 1e-6));
+
+    float near = ProjectionMatrix[3][2] / (ProjectionMatrix[2][2] - 1.0);
+    if (-sphereCenter.z - halfSize * sqrt(2.0) > near) {
+        vertPosInt = sphereCenter + (Position.x * right + Position.y * up) * halfSize;
+        gl_Position = ProjectionMatrix * vec4(vertPosInt, 1.0);
+    } else {
+        // the quad would be clipped by the near plane: cover the whole
+        // screen instead, with the rays starting on the near plane
+        vertPosInt = vec3(Position.x * near / ProjectionMatrix[0][0], Position.y * near / ProjectionMatrix[1][1], -near);
+        gl_Position = vec4(Position.xy, 0.0, 1.0);
+    }
+}
+#endif
+
+void main()
+{
+#ifdef INDIRECT
+    // the parts of an instance have consecutive layers
+    Instance instance = instances[InstanceIndex & 0xffffffu];
+    textureLayer = instance.textureLayer + int(InstanceIndex >> 24);
+    mat4 modelViewMatrix = ViewMatrix * instance.transformation;
+#else
+    mat4 modelViewMatrix = ModelViewMatrix;
+#endif
 
+#ifdef RAY_CAST
+    rayCastQuad(modelViewMatrix);
+#else
     // Compute vertex position in Model space
     vec4 position = modelViewMatrix * vec4(Position,1.0);
 
     // Normal (N)
+#if !defined(INDIRECT)
+    // the normal matrix fixes transformations made on the model, which
+    // would make the normal vector not perpendicular
+    normalInt = normalize(NormalMatrix * normalize(Normal));
+#elif defined(REDUCED_SHADING)
+    // all bodies are scaled uniformly, so the rotation part of the
+    // modelview matrix is enough to transform the normals
+    normalInt = normalize(mat3(modelViewMatrix) * normalize(Normal));
+#else
+    // Compute a 4*4 normal matrix
+    mat4 normalMatrix = transpose(inverse(modelViewMatrix));
     normalInt = normalize((normalMatrix * vec4(normalize(Normal), 1.0)).xyz);
+#endif
 
     vertPosInt = position.xyz;
 
     UVcoords = UV;
 
-    gl_Position = modelViewProjectionMatrix * vec4(Position, 1.0);
+#ifdef INDIRECT
+    gl_Position = ProjectionMatrix * position;
+#else
+    gl_Position = ModelViewProjectionMatrix * vec4(Position, 1.0);
+#endif
+#endif
 }
@@ -1,8 +1,6 @@
 #version 330
 
-uniform mat4 Projection;
-uniform mat4 View;
-uniform mat4 Transform;
+uniform mat4 ModelViewProjectionMatrix;
 uniform vec3 Color;
 
 layout (location = 0) in vec3 Position;
@@ -11,6 +9,6 @@ out vec4 vColor;
 
 void main()
 {
-   gl_Position = Projection*View*Transform*vec4(Position, 1.0);
+   gl_Position = ModelViewProjectionMatrix*vec4(Position, 1.0);
    vColor = vec4(Color, 1.);
 }
@@ -1,11 +1,11 @@
 #version 330 core
 out vec4 FragColor;
 
-in vec3 TexCoords;
+in vec4 Direction;
 
 uniform samplerCube sky;
 
 void main()
 {
-    FragColor = texture(sky, TexCoords);
+    FragColor = texture(sky, Direction.xyz / Direction.w);
 }
@@ -1,13 +1,17 @@
 #version 330 core
-layout (location = 0) in vec3 aPos;
 
-out vec3 TexCoords;
+// inverse of projection * view, without the translation of the camera
+uniform mat4 InverseViewProjection;
 
-uniform mat4 ProjectionMatrix;
-uniform mat4 ViewMatrix;
+// homogeneous view direction, divided per fragment
+out vec4 Direction;
 
 void main()
 {
-    TexCoords = aPos;
-    gl_Position = ProjectionMatrix * mat4(mat3(ViewMatrix)) * vec4(aPos, 1.0);
+    // a single triangle covering the screen, without any vertex buffer:
+    // (-1, -1), (3, -1), (-1, 3) at the far plane
+    vec2 position = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2) * 2. - 1.;
+    gl_Position = vec4(position, 1., 1.);
+
+    Direction = InverseViewProjection * vec4(position, 1., 1.);
 }
@@ -1,8 +1,6 @@
 #version 330
 
-uniform mat4 ProjectionMatrix;
-uniform mat4 ViewMatrix;
-uniform mat4 TransformMatrix;
+uniform mat4 ModelViewProjectionMatrix;
 
 layout (location = 0) in vec3 Position;
 layout (location = 2) in vec3 Normal;
@@ -12,8 +10,7 @@ out vec2 UVcoords;
 
 void main()
 {
-// summing up matrices
-   gl_Position = ProjectionMatrix*ViewMatrix*TransformMatrix*vec4(Position.x, Position.y, Position.z, 1.0);
+   gl_Position = ModelViewProjectionMatrix*vec4(Position.x, Position.y, Position.z, 1.0);
 
    UVcoords = UV;
 }
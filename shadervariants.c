@@ -0,0 +1,154 @@
+#include "stdio.h"
+#include "stdlib.h"
+#include "string.h"
+#include "GL/glew.h"
+
+#include "utils.h"
+#include "solarsystem.h"
+#include "shadervariants.h"
+
+ShaderVariantStats shaderVariantStats;
+
+static const char* flagDefines[variantFlagsCount] = {
+    "#define IS_EMISSIVE\n",
+    "#define BLOOM_OUTPUT\n",
+    "#define REDUCED_SHADING\n",
+    "#define RAY_CAST\n",
+};
+
+/* Sources of a program with variants */
+typedef struct variantSource {
+    int programIndex;
+    char* vsPath;
+    char* fsPath;
+    char* gsPath;
+    char* defines; // shared by all variants
+} VariantSource;
+
+/* Built variant, the key is the program index and the flags */
+typedef struct variant {
+    int programIndex;
+    int flags;
+    GLuint program;
+} Variant;
+
+static VariantSource sources[maxShaderVariants];
+static int sourceCount = 0;
+static Variant variants[maxShaderVariants];
+static int variantCount = 0;
+
+static char* copyString(const char* string)
+{
+    if (string == NULL) {
+        return NULL;
+    }
+    char* copy = malloc(strlen(string) + 1);
+    strcpy(copy, string);
+    return copy;
+}
+
+/* Uniform blocks of a new variant are bound like the ones of the base program */
+static void copyBlockBindings(GLuint base, GLuint program)
+{
+    GLint blocks = 0;
+    glGetProgramiv(base, GL_ACTIVE_UNIFORM_BLOCKS, &blocks);
+    for (int i = 0; i < blocks; i++) {
+        char name[64];
+        GLint binding = 0;
+        glGetActiveUniformBlockName(base, i, sizeof(name), NULL, name);
+        glGetActiveUniformBlockiv(base, i, GL_UNIFORM_BLOCK_BINDING, &binding);
+
+        GLuint index = glGetUniformBlockIndex(program, name);
+        if (index != GL_INVALID_INDEX) {
+            glUniformBlockBinding(program, index, binding);
+        }
+    }
+}
+
+/******************************************************************
+ * CreateVariantProgram
+ * Like CreateShaderProgram, with the defines (e.g. "#define
+ * LIGHT_COUNT 3\n", may be NULL) added to all shaders. The program
+ * without any flags is built right away into programs[programIndex],
+ * the others once ShaderVariant asks for them
+ *******************************************************************/
+void CreateVariantProgram(int programIndex, char* vsPath, char* fsPath, char* gsPath, char* defines)
+{
+    if (sourceCount == maxShaderVariants) {
+        fprintf(stderr, "Too many programs with shader variants\n");
+        exit(-1);
+    }
+
+    VariantSource* source = &sources[sourceCount++];
+    source->programIndex = programIndex;
+    source->vsPath = vsPath;
+    source->fsPath = fsPath;
+    source->gsPath = gsPath;
+    source->defines = copyString(defines == NULL ? "" : defines);
+
+    programs[programIndex] = CreateShaderVariant(vsPath, fsPath, gsPath, source->defines);
+}
+
+/******************************************************************
+ * ShaderVariant
+ * Program of programIndex specialized for the flags. Variants are
+ * built on first use and cached; programs created without variants
+ * ignore the flags
+ *******************************************************************/
+GLuint ShaderVariant(int programIndex, int flags)
+{
+    if (flags == 0) {
+        return programs[programIndex];
+    }
+
+    for (int i = 0; i < variantCount; i++) {
+        if (variants[i].programIndex == programIndex && variants[i].flags == flags) {
+            return variants[i].program;
+        }
+    }
+
+    VariantSource* source = NULL;
+    for (int i = 0; i < sourceCount; i++) {
+        if (sources[i].programIndex == programIndex) {
+            source = &sources[i];
+        }
+    }
+    if (source == NULL) {
+        return programs[programIndex];
+    }
+
+    if (variantCount == maxShaderVariants) {
+        fprintf(stderr, "Too many shader variants\n");
+        exit(-1);
+    }
+
+    char defines[512];
+    snprintf(defines, sizeof(defines), "%s", source->defines);
+    for (int i = 0; i < variantFlagsCount; i++) {
+        if (flags & (1 << i)) {
+            strncat(defines, flagDefines[i], sizeof(defines) - strlen(defines) - 1);
+        }
+    }
+
+    Variant* variant = &variants[variantCount++];
+    variant->programIndex = programIndex;
+    variant->flags = flags;
+    variant->program = CreateShaderVariant(source->vsPath, source->fsPath, source->gsPath, defines);
+    copyBlockBindings(programs[programIndex], variant->program);
+
+    shaderVariantStats.variants = variantCount;
+    return variant->program;
+}
+
+void ResetShadingTiers()
+{
+    memset(shaderVariantStats.objects, 0, sizeof(shaderVariantStats.objects));
+}
+
+void PrintShaderVariantStats()
+{
+    printf("shader variants: %d programs with variants, %d variants built\n",
+            sourceCount, shaderVariantStats.variants);
+    printf("shading tiers: %d objects full, %d reduced\n",
+            shaderVariantStats.objects[tierFull], shaderVariantStats.objects[tierReduced]);
+}
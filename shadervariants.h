@@ -0,0 +1,32 @@
+#ifndef SOLAR_SYSTEM_SHADER_VARIANTS
+#define SOLAR_SYSTEM_SHADER_VARIANTS
+
+/* Flags selecting a variant of a program; every flag is passed to the
+ * shaders as a #define, so the variants run without branching on them */
+enum ShaderVariantFlags {
+    variantEmissive = 1, // IS_EMISSIVE: not lit, the texture color is emitted
+    variantBloomOutput = 2, // BLOOM_OUTPUT: writes the bright color for the bloom
+    variantReducedShading = 4, // REDUCED_SHADING: one light, no specular, normal matrix given
+    variantRayCast = 8, // RAY_CAST: a sphere ray cast on a quad, instead of its mesh
+    variantFlagsCount = 4
+};
+
+/* Material level of detail: objects smaller on screen than a given
+ * radius are drawn with the reduced shading variant */
+enum ShadingTier {tierFull, tierReduced, shadingTiers};
+
+#define maxShaderVariants 32
+
+typedef struct shaderVariantStats {
+    int variants; // programs built so far, without the base programs
+    int objects[shadingTiers]; // drawn at every tier in the last frame
+} ShaderVariantStats;
+
+extern ShaderVariantStats shaderVariantStats;
+
+void CreateVariantProgram(int programIndex, char* vsPath, char* fsPath, char* gsPath, char* defines);
+GLuint ShaderVariant(int programIndex, int flags);
+void ResetShadingTiers();
+void PrintShaderVariantStats();
+
+#endif
@@ -29,6 +29,21 @@
 #include "input.h"              // functions for the processing of user inputs via mouse and keyboard
 #include "utils.h"              // functions for reading mesh files, setting up texutres, etc.
 #include "solarsystem.h"        // defining global variables and structs
+#include "transforms.h"         // matrices of all objects computed at once
+#include "renderqueue.h"        // sorted submission of draw calls
+#include "culling.h"            // view frustum culling
+#include "gpuculling.h"         // culling and indirect draws on the GPU
+#include "orbits.h"             // orbit lines generated on the GPU
+#include "ringbuffer.h"         // per frame data written to mapped memory
+#include "glstate.h"            // skips binds which change nothing
+#include "shadervariants.h"     // programs specialized by #defines
+#include "clusters.h"           // point lights assigned to clusters of the view
+#include "bloom.h"              // blur of the bright parts through downsampled levels
+#include "governor.h"           // quality adjusted to the frame time
+#include "framegraph.h"         // passes of the frame and their render targets
+#include "exposure.h"           // exposure adapted to the luminance of the scene
+#include "beltlod.h"            // impostors and points for the small asteroids
+#include "terrain.h"            // patches of the followed planet, generated by workers
 
 /*----------------------------------------------------------------*/
 
@@ -37,6 +52,7 @@ Planet planets[planetsCount] = {
         .name = "earth",
         .filename = "models/earth_up.obj",
         .textureFilename = "data/earth_tex.bmp",
+        .parts = {[1] = {.filename = "models/earth_down.obj", .textureFilename = "data/earth_down.bmp"}},
         .size = 0.25,
         .speed = 20.,
         .color = {.9486, .98, .0392},
@@ -67,6 +83,7 @@ Planet planets[planetsCount] = {
         .name = "sun",
         .filename = "models/sphere.obj",
         .textureFilename = "data/sun_tex.bmp",
+        .isEmissive = 1,
         .size = 1,
         .semimajor = 6.5,
         .semiminor = 7.,
@@ -176,14 +193,6 @@ Planet planets[planetsCount] = {
         .speed = 3.,
         .color = {.85, .85, .85}
     },
-    {
-        .name = "earth_down",
-        .filename = "models/earth_down.obj",
-        .textureFilename = "data/earth_down.bmp",
-        .size = 0.25,
-        .speed = 20.,
-        .color = {.9486, .98, .0392},
-    },
     {
         .name = "earthmoon",
         .filename = "models/sphere.obj",
@@ -208,9 +217,7 @@ Ring rings[ringsCount] = {
     }
 };
 
-SkyBox skybox = {
-    .size = 30,
-};
+SkyBox skybox;
 
 /* Asteroid settings */
 char* asteroidTextureFilename = "data/moon_tex.bmp";
@@ -224,14 +231,50 @@ int maxAsteroidDistance = 11;
 
 GLuint asteroidTextureID;
 GLuint asteroidVBO; // vertex buffer object
-GLuint asteroidCBO; // color buffe object
+GLuint asteroidCBO; // color buffer object
 GLuint asteroidNBO; // normal buffer object
 GLuint asteroidIBO; // index buffer object
-GLuint asteroidOVBO; // orbit vertex buffer object
 GLuint asteroidUVBO; // uv buffer object
+GLsizei asteroidIndexCount; // number of indices in the IBO
+float asteroidBoundingSphere[4]; // center and radius in object space
+
+/* Sphere mesh, shared by most bodies */
+char* sphereFilename = "models/sphere.obj";
+GLuint sphereVBO; // vertex buffer object
+GLuint sphereCBO; // color buffer object
+GLuint sphereNBO; // normal buffer object
+GLuint sphereIBO; // index buffer object
+GLuint sphereUVBO; // uv buffer object
+GLsizei sphereIndexCount; // number of indices in the IBO
+float sphereBoundingSphere[4]; // center and radius in object space
+
+/* Quad of the bodies with the sphere mesh while they are ray cast, see
+ * rayCastSphere */
+GLuint spriteVBO; // vertex buffer object
+GLuint spriteCBO; // color buffer object
+GLuint spriteIBO; // index buffer object
+GLsizei spriteIndexCount; // number of indices in the IBO
 
 #define asteroidsCount 1000
 Asteroid asteroid[asteroidsCount];
+int activeAsteroids = asteroidsCount; // the first ones are updated and drawn, the others hidden
+
+/* Small asteroids are drawn as impostors or points, see beltlod.h; the
+ * band of every asteroid is selected anew every frame */
+BeltLod beltLod;
+int asteroidBands[asteroidsCount];
+
+/* The planet the camera follows is drawn as terrain, once its patches
+ * are there; -1 while none is */
+Terrain terrain;
+int terrainBody = -1;
+
+/* Beacons carried by some of the asteroids, as clustered point lights */
+#define beaconCount 256
+#define beaconRadius 1.
+float beaconColors[4][3] = {{3., .9, .3}, {.6, 1.8, 3.}, {.9, 3., 1.2}, {3., 2.7, .9}};
+int beaconLights[beaconCount];
+#define beaconAsteroid(i) ((i) * asteroidsCount / beaconCount)
 
 /******************************************************************
 *
@@ -250,6 +293,8 @@ Camera cam = {
     .lookingAt = 0,
 
     .fov = 45.,
+    .nearPlane = 1.0,
+    .farPlane = 50.0,
 };
 
 MouseState mouse = {
@@ -271,6 +316,12 @@ LightSettings lightSettings = {
     .specularFactor = .4,
     .bloom = 1,
     .bloomFactor = 5,
+    .bloomQuality = bloomMedium,
+    .antialiasing = antialiasingLow,
+    .autoExposure = 1,
+    .exposure = .2,
+    .reducedShadingRadius = 4.,
+    .rayCastSpheres = 1,
     .mode = 0, // 0: phong, 1: gouraud
 };
 
@@ -299,244 +350,898 @@ AnimState state = {
     .DebugMode = 0,
 };
 
-CREATE_BUFFER(hdrBuffer, HDRShaderBuffer, 1, 2)
-CREATE_BUFFER(blurBuffer, BlurShaderBuffer, 2, 2)
+Bloom bloom;
+Exposure exposure;
+
+/* Passes of the frame, rebuilt every frame. The scene is drawn into the
+ * scene and bright targets at the render size; the bloom blurs the
+ * bright one, and the merge draws both to the window */
+FrameGraph frameGraph;
+int sceneTarget;
+int brightTarget;
+int depthTarget;
+int bloomTarget; // the bloom levels, imported
+int exposureTarget; // luminance of the scene, imported and read back
+int toneMappedTarget; // merged image with its luma, when anti-aliased
+int bloomRect[4]; // region blurred by the bloom pass
+int gpuDriven; // planets and asteroids of the frame are culled on the GPU
+
+/* Time for a frame the governor keeps to, for 60 Hz */
+#define frameBudget (1000. / 60.)
+Governor governor;
+
+/* Quality of every level of the governor, the first one is the
+ * defaults; each further level lowers the cheapest knob left */
+#define governorLevelCount 6
+GovernorLevel governorLevels[governorLevelCount] = {
+    {bloomMedium, 4., asteroidsCount, 1.},
+    {bloomLow, 4., asteroidsCount, 1.},
+    {bloomLow, 8., asteroidsCount, 1.},
+    {bloomLow, 8., asteroidsCount / 2, 1.},
+    {bloomLow, 16., asteroidsCount / 2, .75},
+    {bloomLow, 16., asteroidsCount / 4, .5},
+};
 ScreenQuad frontScreen;
-
-const float winWidth = 1500.0f;
-const float winHeight = 1000.0f;
+RenderQueue renderQueue;
+
+/* Bounding spheres of planets, rings and asteroids, in this order */
+#define cullRingsOffset planetsCount
+#define cullAsteroidsOffset (planetsCount + ringsCount)
+SphereSet cullSet;
+Frustum frustum;
+
+/* Spheres inside of the planets, the biggest ones on screen hide what is behind them */
+SphereSet occluderSet;
+Occluders occluders;
+
+/* Indirect commands of the GPU culling, one per mesh part: the bodies
+ * sharing the sphere mesh have the same command, the belt has another one */
+int planetCullCommands[planetsCount];
+int sphereCullCommand;
+int asteroidCullCommand;
+
+/* Parts of all planets, at least one each */
+int meshPartsCount;
+
+/* Textures of all planets and the asteroids, one layer per part, for
+ * the indirect draws. The asteroids use the layer after the planets */
+#define bodyTextureWidth 1024
+#define bodyTextureHeight 512
+GLuint bodyTextureArray;
+
+OrbitBatch orbitBatch;
+
+/* Data written every frame: the lights, the GPU culling instances and
+ * the clusters. Offsets are relative to the region of the frame */
+RingBuffer frameData;
+GLintptr frameLightsOffset;
+GLintptr frameInstancesOffset;
+GLintptr frameClustersOffset;
+GLintptr framePointLightsOffset;
+GLintptr frameBeltOffset;
+
+float winWidth = 1500.0f;
+float winHeight = 1000.0f;
+
+/* The scene is drawn at renderScale times the size of the window */
+float renderScale = 1.;
+int renderWidth;
+int renderHeight;
 
 /******************************************************************
- *
- * Display
- *
- * This function is called when the content of the window needs to be
- * drawn/redrawn. It has been specified through 'glutDisplayFunc()';
- * Enable vertex attributes, create binding between C program and
- * attribute name in shader, provide data for uniform variables
- *
+ * setupRenderProgram
+ * Called by the render queue whenever it switches to another program.
+ * Uploads the uniforms which are the same for all draws of a frame
  *******************************************************************/
-void Display()
+void setupRenderProgram(int program, GLuint currentProgram)
 {
-    // clean color and buffers on front buffer
-    glClearColor(0.0, 0.0, 0.0, 1.0);
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    if (program == phongIndirectProgram) {
+        // the only program still combining the matrices itself, the
+        // others get them per object from ComputeRenderMatrices
+        BindUniform4f("ProjectionMatrix", currentProgram, cam.projectionMatrix);
+        BindUniform4f("ViewMatrix", currentProgram, cam.viewMatrix);
+        BindGPUCullingBuffers();
+        StateActiveTexture(0);
+        StateBindTexture(GL_TEXTURE_2D_ARRAY, bodyTextureArray);
+    } else if (program == phongProgram) {
+        // only used by the ray cast spheres
+        GLint projection = glGetUniformLocation(currentProgram, "ProjectionMatrix");
+        if (projection != -1) {
+            glUniformMatrix4fv(projection, 1, GL_TRUE, cam.projectionMatrix);
+        }
+    } else if (program != gouraudProgram) {
+        EnableTexture("tex", currentProgram, 0);
+        return;
+    }
 
-    // 1. bind back buffer, and draw everything on it
-    glBindFramebuffer(GL_FRAMEBUFFER, hdrBuffer.id[0]);
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    /* Setting light parameters */
+    BindUniform1f("AmbientFactor", currentProgram, lightSettings.ambientFactor);
+    BindUniform1f("DiffuseFactor", currentProgram, lightSettings.diffuseFactor);
+    BindUniform1f("SpecularFactor", currentProgram, lightSettings.specularFactor);
+    BindUniform1i("bloomFactor", currentProgram, lightSettings.bloomFactor);
 
-    GLuint currentProgram;
+    EnableTexture("tex", currentProgram, 0);
 
-    // skybox
-    glActiveTexture(GL_TEXTURE0);
-    glDepthMask(GL_FALSE);
+    // lights are read from the frame data, bound in Display; the
+    // per vertex lighting of gouraud only has the global lights
+    if (program != gouraudProgram) {
+        BindClusterLights(currentProgram, renderWidth, renderHeight);
+    }
+}
 
-    currentProgram = programs[skyboxProgram];
+/******************************************************************
+ * beginFrameData
+ * Waits until the region of the frame data buffer for the next frame
+ * is free again; updates write into it directly. With keepContents,
+ * a frame drawn again without any update keeps the last frame's data
+ *******************************************************************/
+void beginFrameData(int keepContents)
+{
+    BeginRingFrame(&frameData, keepContents);
+    SetGPUCullInstanceBuffer(RingFrameData(&frameData, frameInstancesOffset), frameData.id,
+            RingFrameOffset(&frameData, frameInstancesOffset));
+    SetClusterBuffers(RingFrameData(&frameData, frameClustersOffset), RingFrameOffset(&frameData, frameClustersOffset),
+            RingFrameData(&frameData, framePointLightsOffset), RingFrameOffset(&frameData, framePointLightsOffset));
+    SetBeltInstanceBuffer(&beltLod, RingFrameData(&frameData, frameBeltOffset), frameData.id,
+            RingFrameOffset(&frameData, frameBeltOffset));
+}
 
-    glUseProgram(currentProgram);
-    glBindVertexArray(skybox.VAO);
-    glBindTexture(GL_TEXTURE_CUBE_MAP, skybox.textureID);
+/******************************************************************
+ * viewDepth
+ * Distance of the origin of the given transformation to the camera,
+ * normalized between the near (0) and the far plane (1).
+ * Used as sort key by the render queue
+ *******************************************************************/
+float viewDepth(float* transformation)
+{
+    // translation is stored in the last column of the row major matrix,
+    // only the third row of the view matrix contributes to z
+    float* v = cam.viewMatrix;
+    float z = v[8]*transformation[3] + v[9]*transformation[7] + v[10]*transformation[11] + v[11];
 
-    EnableTexture("sky", currentProgram, 0);
+    return (-z - cam.nearPlane) / (cam.farPlane - cam.nearPlane);
+}
 
-    glEnableVertexAttribArray(aPos);
-    glBindBuffer(GL_ARRAY_BUFFER, skybox.VBO);
-    glVertexAttribPointer(aPos, 3, GL_FLOAT, GL_FALSE, 0, 0);
-    BindUniform4f("ProjectionMatrix", currentProgram, cam.projectionMatrix);
-    BindUniform4f("ViewMatrix", currentProgram, cam.viewMatrix);
-    /* Issue draw command, using indexed triangle list */
-    glDrawArrays(GL_TRIANGLES, 0, 36);
-    glDisableVertexAttribArray(aPos);
+/******************************************************************
+ * brightScreenRect
+ * Pixels of the HDR buffer covered by the visible emissive bodies, the
+ * only ones which write a bright color, grown by margin pixels on every side and
+ * clipped to the screen, as x, y, width, height. Returns 0 if no
+ * emissive body is visible
+ *******************************************************************/
+int brightScreenRect(int margin, int* rect)
+{
+    float* v = cam.viewMatrix;
+    float* p = cam.projectionMatrix;
+    float x0 = renderWidth, y0 = renderHeight, x1 = 0, y1 = 0;
+    int found = 0;
 
-    glDepthMask(GL_TRUE);
+    for (int i = 0; i < planetsCount; i++) {
+        if (!planets[i].isEmissive || !cullSet.visible[i]) {
+            continue;
+        }
+        found = 1;
+
+        float x = cullSet.x[i], y = cullSet.y[i], z = cullSet.z[i], r = cullSet.radius[i];
+        float viewX = v[0]*x + v[1]*y + v[2]*z + v[3];
+        float viewY = v[4]*x + v[5]*y + v[6]*z + v[7];
+        float depth = -(v[8]*x + v[9]*y + v[10]*z + v[11]);
+        if (depth - r <= cam.nearPlane) {
+            // reaches in front of the near plane, may cover anything
+            x0 = 0;
+            y0 = 0;
+            x1 = renderWidth;
+            y1 = renderHeight;
+            continue;
+        }
 
+        // x/depth is extreme at the corners of the bounding box of the sphere
+        float left = fminf((viewX - r) / (depth - r), (viewX - r) / (depth + r)) * p[0];
+        float right = fmaxf((viewX + r) / (depth - r), (viewX + r) / (depth + r)) * p[0];
+        float bottom = fminf((viewY - r) / (depth - r), (viewY - r) / (depth + r)) * p[5];
+        float top = fmaxf((viewY + r) / (depth - r), (viewY + r) / (depth + r)) * p[5];
 
-    // select shader depending on lighting mode
-    if (state.DebugMode == 1) {
-        currentProgram = programs[debugProgram];
-    } else if (lightSettings.mode == 0) {
-        currentProgram = programs[phongProgram];
-    } else if (lightSettings.mode == 1) {
-        currentProgram = programs[gouraudProgram];
+        x0 = fminf(x0, (left * .5 + .5) * renderWidth);
+        x1 = fmaxf(x1, (right * .5 + .5) * renderWidth);
+        y0 = fminf(y0, (bottom * .5 + .5) * renderHeight);
+        y1 = fmaxf(y1, (top * .5 + .5) * renderHeight);
     }
-    glUseProgram(currentProgram);
 
-    BindUniform4f("ProjectionMatrix", currentProgram, cam.projectionMatrix);
-    BindUniform4f("ViewMatrix", currentProgram, cam.viewMatrix);
+    x0 = fmaxf(floorf(x0) - margin, 0);
+    y0 = fmaxf(floorf(y0) - margin, 0);
+    x1 = fminf(ceilf(x1) + margin, renderWidth);
+    y1 = fminf(ceilf(y1) + margin, renderHeight);
+    if (!found || x1 <= x0 || y1 <= y0) {
+        return 0;
+    }
 
-    /* Setting light parameters */
-    BindUniform1f("AmbientFactor", currentProgram, lightSettings.ambientFactor);
-    BindUniform1f("DiffuseFactor", currentProgram, lightSettings.diffuseFactor);
-    BindUniform1f("SpecularFactor", currentProgram, lightSettings.specularFactor);
-    BindUniform1i("bloomFactor", currentProgram, lightSettings.bloomFactor);
+    rect[0] = x0;
+    rect[1] = y0;
+    rect[2] = x1 - x0;
+    rect[3] = y1 - y0;
+    return 1;
+}
 
-    EnableTexture("tex", currentProgram, 0);
+/******************************************************************
+ * cullObjects
+ * Moves the bounding spheres of all planets, rings and asteroids to
+ * their current world position and tests them against the frustum,
+ * and against the shadows of the largest planets on screen
+ *******************************************************************/
+void cullObjects()
+{
+    for (int i = 0; i < planetsCount; i++) {
+        SetSphere(&cullSet, i, planets[i].transformation, planets[i].boundingSphere);
+    }
+    for (int i = 0; i < ringsCount; i++) {
+        SetSphere(&cullSet, cullRingsOffset + i, rings[i].transformation, rings[i].boundingSphere);
+    }
+    for (int i = 0; i < activeAsteroids; i++) {
+        SetSphere(&cullSet, cullAsteroidsOffset + i, asteroid[i].AsteroidMatrixCombinedTransformation,
+                asteroidBoundingSphere);
+    }
+
+    // the asteroids come last, the ones hidden by the governor are not tested
+    cullSet.count = cullAsteroidsOffset + activeAsteroids;
+    ExtractFrustumPlanes(cam.viewMatrix, cam.projectionMatrix, &frustum);
+    CullSpheres(&frustum, &cullSet);
 
-    // set lights
-    char varName[20];
-    for (int i = 0; i < lightCount; ++i) {
-        snprintf(varName, 20, "lights[%d].position", i);
-        BindUniform3f(varName, currentProgram, lights[i].position);
-        snprintf(varName, 20, "lights[%d].color", i);
-        BindUniform3f(varName, currentProgram, lights[i].color);
+    // reject what is hidden behind the sun or the planets
+    for (int i = 0; i < planetsCount; i++) {
+        float sphere[4] = {0., 0., 0., planets[i].occluderRadius};
+        SetSphere(&occluderSet, i, planets[i].transformation, sphere);
     }
+    SelectOccluders(&occluderSet, cullSet.visible, cam.position, &occluders);
+    CullOccluded(&occluders, cam.position, &cullSet);
 
-    // draw planets
-    for(int i = 0; i < planetsCount; i++)
-    {
-        if (strcmp(planets[i].name, "sun") == 0) {
-            BindUniform1i("isSun", currentProgram, 1);
-        } else {
-            BindUniform1i("isSun", currentProgram, 0);
-        }
+    // the hidden asteroids count as invisible for the draws
+    for (int i = activeAsteroids; i < asteroidsCount; i++) {
+        cullSet.visible[cullAsteroidsOffset + i] = 0;
+    }
+}
 
-        ActivateTexture(0, planets[i].TextureID);
+/******************************************************************
+ * projectedRadius
+ * Radius in pixels of a bounding sphere of the cull set. Like in
+ * cull.cs, a sphere containing the camera counts as huge
+ *******************************************************************/
+float projectedRadius(int index, float projectedScale)
+{
+    float* v = cam.viewMatrix;
+    float distance = -(v[8]*cullSet.x[index] + v[9]*cullSet.y[index] + v[10]*cullSet.z[index] + v[11]);
+    if (distance <= cullSet.radius[index]) {
+        return 1e30;
+    }
+    return cullSet.radius[index] * projectedScale / distance;
+}
 
-        int size = BindBasics(planets[i].VBO, planets[i].CBO, planets[i].IBO, planets[i].NBO, planets[i].UVBO);
+/******************************************************************
+ * selectShadingTier
+ * Material level of detail of a body drawn by the CPU: phong lit
+ * bodies smaller on screen than lightSettings.reducedShadingRadius use
+ * the reduced shading variant
+ *******************************************************************/
+void selectShadingTier(RenderCommand* command, int cullIndex, float projectedScale)
+{
+    int tier = tierFull;
+    if (command->program == phongProgram && !(command->variant & variantEmissive)
+            && projectedRadius(cullIndex, projectedScale) < lightSettings.reducedShadingRadius) {
+        tier = tierReduced;
+        command->variant |= variantReducedShading;
+    }
+    shaderVariantStats.objects[tier]++;
+}
 
-        /* Associate program with uniform shader matrices */
-        BindUniform4f("TransformMatrix", currentProgram, planets[i].transformation);
+/******************************************************************
+ * countGPUShadingTiers
+ * The GPU culling selects the tier of every instance as a level of
+ * detail; the same selection is repeated here for the statistics
+ *******************************************************************/
+void countGPUShadingTiers(float projectedScale)
+{
+    for (int i = 0; i < planetsCount + asteroidsCount; i++) {
+        int index = i < planetsCount ? i : cullAsteroidsOffset + i - planetsCount;
+        if (!cullSet.visible[index] || (i >= planetsCount && asteroidBands[i - planetsCount] != bandMesh)) {
+            continue;
+        }
 
-        /* Issue draw command, using indexed triangle list */
-        glDrawElements(GL_TRIANGLES, size, GL_UNSIGNED_INT, 0);
+        float radius = projectedRadius(index, projectedScale);
+        if (radius < gpuCulling.lodPixelRadius[tierReduced]) {
+            continue; // not drawn at all
+        }
+        int emissive = i < planetsCount && planets[i].isEmissive;
+        int reduced = radius < lightSettings.reducedShadingRadius && !emissive;
+        // the parts of a body share its tier
+        shaderVariantStats.objects[reduced ? tierReduced : tierFull] += i < planetsCount ? planets[i].partsCount : 1;
     }
+}
 
-    // draw asteroids
-    for(int i = 0; i < asteroidsCount; i++)
-    {
-        ActivateTexture(0, asteroidTextureID);
+/******************************************************************
+ * submitShadingTiers
+ * Queues the indirect commands of the GPU culling once per shading tier:
+ * the indirectCount commands of every tier, one per part, follow the
+ * ones of the previous tier
+ *******************************************************************/
+void submitShadingTiers(RenderCommand* command, int cullCommand)
+{
+    for (int tier = 0; tier < shadingTiers; tier++) {
+        RenderCommand level = *command;
+        level.indirectOffset = GPUCullCommandOffset(cullCommand + tier * command->indirectCount);
+        if (tier == tierReduced && !(level.variant & variantEmissive)) {
+            level.variant |= variantReducedShading;
+        }
+        SubmitRenderCommand(&renderQueue, &level);
+    }
+}
 
-        int size = BindBasics(asteroidVBO, asteroidCBO, asteroidIBO, asteroidNBO, asteroidUVBO);
+/******************************************************************
+ * rayCastSphere
+ * Draws a body with the sphere mesh as a quad instead, on which the
+ * phong programs intersect the view rays with the sphere: the
+ * silhouette, normals and depth are exact at any distance
+ *******************************************************************/
+void rayCastSphere(RenderCommand* command)
+{
+    command->VBO = spriteVBO;
+    command->CBO = spriteCBO;
+    command->NBO = 0;
+    command->UVBO = 0;
+    command->IBO = spriteIBO;
+    command->indexCount = spriteIndexCount;
+    command->variant |= variantRayCast;
+}
 
-        /* Associate program with uniform shader matrices */
-        BindUniform4f("TransformMatrix", currentProgram, asteroid[i].AsteroidMatrixCombinedTransformation);
+/* The indirect commands of the bodies with the sphere mesh draw either
+ * the mesh or the quad of the ray cast spheres, set before every culling */
+void setSphereCullCommands(GLsizei indexCount)
+{
+    for (int i = 0; i < planetsCount; i++) {
+        if (planets[i].VBO != sphereVBO) {
+            continue;
+        }
+        for (int tier = 0; tier < shadingTiers; tier++) {
+            gpuCulling.commands[planetCullCommands[i] + tier].count = indexCount;
+        }
+    }
+}
 
-        /* Issue draw command, using indexed triangle list */
-        glDrawElements(GL_TRIANGLES, size, GL_UNSIGNED_INT, 0);
+/******************************************************************
+ * selectTerrain
+ * The planet the camera follows is drawn as terrain instead of its
+ * sphere, refined around the camera; the sun stays a sphere
+ *******************************************************************/
+void selectTerrain(float projectedScale)
+{
+    terrainBody = -1;
+    int body = cam.lookingAt;
+    if (body <= 0 || planets[body].VBO != sphereVBO || planets[body].isEmissive || !cullSet.visible[body]) {
+        return;
+    }
+    if (UpdateTerrain(&terrain, body, planets[body].textureFilename, planets[body].transformation,
+                cam.position, &frustum, projectedScale)) {
+        terrainBody = body;
     }
+}
 
-    // draw orbit
-    currentProgram = programs[simpleProgram];
-    glUseProgram(currentProgram);
-    BindUniform4f("Projection", currentProgram, cam.projectionMatrix);
-    BindUniform4f("View", currentProgram, cam.viewMatrix);
+/* Queues the patches of the terrain, in place of the body */
+void submitTerrain(int program, int variant)
+{
+    Planet* planet = &planets[terrainBody];
+    for (int i = 0; i < terrain.visibleCount; i++) {
+        TerrainSlot* slot = &terrain.slots[terrain.visible[i]];
+        RenderCommand command = {
+            .pass = passOpaque,
+            .program = program,
+            .texture = planet->TextureID,
+            .VBO = slot->VBO,
+            .CBO = terrain.CBO,
+            .NBO = slot->NBO,
+            .UVBO = slot->UVBO,
+            .IBO = terrain.IBO,
+            .indexCount = terrainPatchIndices,
+            .transformation = planet->transformation,
+            .variant = variant,
+            .depth = viewDepth(planet->transformation),
+        };
+        SubmitRenderCommand(&renderQueue, &command);
+    }
+}
 
-    for(int i = 0; i < planetsCount; i++) {
-        if (planets[i].drawOrbit == 1) {
-            // orbit buffer
-            glEnableVertexAttribArray(oPos);
-            glBindBuffer(GL_ARRAY_BUFFER, planets[i].OVBO);
-            glVertexAttribPointer(oPos, 3, GL_FLOAT, GL_FALSE, 3*sizeof(GLfloat), 0);
+/* Adds the commands of all shading tiers, each with the consecutive
+ * commands of all parts of the mesh, so a tier is one multi-draw.
+ * Returns the first */
+int addTieredCullCommand(MeshPart* parts, int partsCount, int maxInstances)
+{
+    int first = gpuCulling.commandCount;
+    for (int tier = 0; tier < shadingTiers; tier++) {
+        for (int i = 0; i < partsCount; i++) {
+            AddGPUCullCommand(parts[i].firstIndex, parts[i].indexCount, maxInstances);
+        }
+    }
+    return first;
+}
 
-            BindUniform4f("Transform", currentProgram, planets[i].orbitTransform);
-            BindUniform3f("Color", currentProgram, (float[3]){1., 1., 1.});
+/******************************************************************
+ * writeGPUCullInstances
+ * Completes the instances of all planets and asteroids, whose
+ * transformations were already written by their updates, so the GPU
+ * can cull them. The planets and the whole belt are then drawn with
+ * one indirect draw per mesh, however many spheres or asteroids are visible
+ *******************************************************************/
+void writeGPUCullInstances()
+{
+    // the levels of detail are the shading tiers; instances rejected
+    // by the occlusion culling on the CPU get none, and are skipped
+    for (int i = 0; i < planetsCount; i++) {
+        SetGPUCullInstance(i, planets[i].boundingSphere, planetCullCommands[i],
+                cullSet.visible[i] && i != terrainBody ? shadingTiers : 0, planets[i].partsCount);
+    }
+    for (int i = 0; i < asteroidsCount; i++) {
+        int mesh = cullSet.visible[cullAsteroidsOffset + i] && asteroidBands[i] == bandMesh;
+        SetGPUCullInstance(planetsCount + i, asteroidBoundingSphere, asteroidCullCommand,
+                mesh ? shadingTiers : 0, 1);
+    }
+    gpuCulling.lodPixelRadius[tierFull] = lightSettings.reducedShadingRadius;
+}
 
-            glDrawArrays(GL_LINE_LOOP, 0, orbitDivisions);
+/******************************************************************
+ * selectBeltBands
+ * Sorts the visible asteroids into the bands of the belt by their
+ * radius on screen. Impostors and points are written to the frame
+ * data right away, only the meshes are queued like the other bodies
+ *******************************************************************/
+void selectBeltBands(float projectedScale)
+{
+    ResetBeltLod(&beltLod);
+    for (int i = 0; i < activeAsteroids; i++) {
+        int index = cullAsteroidsOffset + i;
+        if (!cullSet.visible[index]) {
+            continue;
         }
+        asteroidBands[i] = SelectBeltBand(&beltLod, projectedRadius(index, projectedScale));
+        AddBeltInstance(&beltLod, asteroidBands[i], asteroid[i].AsteroidMatrixCombinedTransformation);
     }
+}
 
-    // draw lights
-    if (state.DebugMode == 1) {
-       currentProgram = programs[simpleProgram];
-        glUseProgram(currentProgram);
-        // sun light source is ignored
-        for (int i = 1; i < lightCount; ++i) {
-            int size = BindBasics(lights[i].VBO, lights[i].CBO, lights[i].IBO, 0, 0);
-
-            // create light position matrix and resize
-            float pos[16];
-            SetTranslation(lights[i].position[0], lights[i].position[1], lights[i].position[2], pos);
+/* draws the impostors and the points of the belt, one call each */
+void drawBeltBands(int variant)
+{
+    GLuint currentProgram = ShaderVariant(impostorProgram, variant);
+    StateUseProgram(currentProgram);
+    BindUniform4f("ViewMatrix", currentProgram, cam.viewMatrix);
+    BindUniform4f("ProjectionMatrix", currentProgram, cam.projectionMatrix);
+    BindUniform3f("Eye", currentProgram, cam.position);
+    BindUniform1f("AmbientFactor", currentProgram, lightSettings.ambientFactor);
+    BindUniform1f("DiffuseFactor", currentProgram, lightSettings.diffuseFactor);
+    DrawBeltImpostors(&beltLod, currentProgram);
 
-            float scale[16];
-            SetScaleMatrix(.1, .1, .1, scale);
-            MultiplyMatrix(pos, scale, pos);
-            BindUniform4f("Transform", currentProgram, pos);
+    currentProgram = ShaderVariant(beltPointProgram, variant);
+    StateUseProgram(currentProgram);
+    BindUniform4f("ViewMatrix", currentProgram, cam.viewMatrix);
+    BindUniform4f("ProjectionMatrix", currentProgram, cam.projectionMatrix);
+    BindUniform1f("projectedScale", currentProgram, cam.projectionMatrix[5] * renderHeight / 2.);
+    BindUniform1f("AmbientFactor", currentProgram, lightSettings.ambientFactor);
+    BindUniform1f("DiffuseFactor", currentProgram, lightSettings.diffuseFactor);
+    DrawBeltPoints(&beltLod, currentProgram);
+}
 
-            BindUniform3f("Color", currentProgram, lights[i].color);
+/* draws planets and asteroids */
+void opaquePass(FrameGraph* graph)
+{
+    glClearColor(0.0, 0.0, 0.0, 1.0);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-            glDrawElements(GL_TRIANGLES, size, GL_UNSIGNED_INT, 0);
-        }
+    ExecuteRenderQueue(&renderQueue, passOpaque, passOpaque);
+    if (gpuDriven) {
+        UnbindGPUCullingBuffers();
     }
+    drawBeltBands(GraphResourceNeeded(graph, brightTarget) ? variantBloomOutput : 0);
+}
+
+/* the sky only fills what the bodies left uncovered, everything
+ * blended is drawn over it */
+void skyPass(FrameGraph* graph)
+{
+    drawSky();
+}
 
-    // draw rings
-    currentProgram = programs[ringProgram];
-    glUseProgram(currentProgram);
+void orbitPass(FrameGraph* graph)
+{
+    GLuint currentProgram = programs[orbitProgram];
+    StateUseProgram(currentProgram);
     BindUniform4f("ProjectionMatrix", currentProgram, cam.projectionMatrix);
     BindUniform4f("ViewMatrix", currentProgram, cam.viewMatrix);
-    EnableTexture("tex", currentProgram, 0);
+    DrawOrbitBatch(&orbitBatch, currentProgram, cam.position, cam.projectionMatrix[5] * renderHeight / 2.);
+}
 
-    for (int i = 0; i < ringsCount; ++i) {
-        ActivateTexture(0, rings[i].TextureID);
+/* draws lights and rings */
+void transparentPass(FrameGraph* graph)
+{
+    ExecuteRenderQueue(&renderQueue, passDebug, passTransparent);
+}
 
-        int size = BindBasics(rings[i].VBO, rings[i].CBO, rings[i].IBO, rings[i].NBO, rings[i].UVBO);
+/* blurs the bright target, only around the emissive bodies */
+void bloomPass(FrameGraph* graph)
+{
+    ApplyBloom(&bloom, lightSettings.bloomQuality, programs[bloomDownProgram], programs[bloomUpProgram],
+            GraphTexture(graph, brightTarget), bloomRect);
+}
 
-        /* Associate program with uniform shader matrices */
-        BindUniform4f("TransformMatrix", currentProgram, rings[i].transformation);
+/* measures the average luminance of the scene, read back frames later */
+void luminancePass(FrameGraph* graph)
+{
+    MeasureExposure(&exposure, programs[luminanceProgram], GraphTexture(graph, sceneTarget));
+}
 
-        //settings for alpha blending
-        glEnable(GL_BLEND);
-        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+/******************************************************************
+ * mergePass
+ * Draws a quad in front of the screen with the scene and the bloom,
+ * tone mapped, into the window or the target of the anti-aliasing.
+ * Linear filtering scales the scene to the window
+ *******************************************************************/
+void mergePass(FrameGraph* graph)
+{
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-        glDrawElements(GL_TRIANGLES, size, GL_UNSIGNED_INT, 0);
+    GLuint currentProgram = programs[bloomResultProgram];
+    StateUseProgram(currentProgram);
 
-        //disabling alpha blending
-        glDisable(GL_BLEND);
+    // bind scene color buffer
+    ActivateTexture(0, GraphTexture(graph, sceneTarget));
+    EnableTexture("scene", currentProgram, 0);
+
+    // bind blur color buffer, half the size of the scene
+    int bloomVisible = GraphResourceNeeded(graph, bloomTarget);
+    ActivateTexture(1, bloomVisible ? GraphTexture(graph, bloomTarget) : 0);
+    EnableTexture("bloomBlur", currentProgram, 1);
+
+    BindUniform1i("bloom", currentProgram, bloomVisible);
+    glUniform4f(glGetUniformLocation(currentProgram, "bloomRect"), (float)bloomRect[0] / renderWidth, (float)bloomRect[1] / renderHeight,
+            (float)(bloomRect[0] + bloomRect[2]) / renderWidth, (float)(bloomRect[1] + bloomRect[3]) / renderHeight);
+    BindUniform1f("exposure", currentProgram, lightSettings.autoExposure ? exposure.value : lightSettings.exposure);
+    DrawFrontScreen();
+}
+
+/* anti-aliases the merged image into the window, scaling it */
+void fxaaPass(FrameGraph* graph)
+{
+    ApplyFXAA(&bloom, lightSettings.antialiasing, programs[fxaaProgram], GraphTexture(graph, toneMappedTarget));
+}
+
+/******************************************************************
+ * buildFrameGraph
+ * Declares the passes of the frame and the targets they use. The
+ * bloom is only read by the merge if something bright is on screen;
+ * otherwise the graph culls the bloom pass, and with it the bright
+ * target the scene passes would write
+ *******************************************************************/
+void buildFrameGraph()
+{
+    FrameGraph* graph = &frameGraph;
+    ResetFrameGraph(graph);
+
+    sceneTarget = CreateGraphTexture(graph, "scene", GL_RGBA16F, renderWidth, renderHeight);
+    brightTarget = CreateGraphTexture(graph, "bright", GL_RGBA16F, renderWidth, renderHeight);
+    depthTarget = CreateGraphTexture(graph, "depth", GL_DEPTH_COMPONENT24, renderWidth, renderHeight);
+    // same format as the bright target, whose texture it takes over
+    // once the bloom has read it
+    toneMappedTarget = CreateGraphTexture(graph, "tone mapped", GL_RGBA16F, renderWidth, renderHeight);
+    bloomTarget = ImportGraphTexture(graph, "bloom", bloom.textures[0]);
+    exposureTarget = ImportGraphTexture(graph, "exposure", exposure.texture);
+
+    // the scene passes attach scene, bright and depth in the order of
+    // the shader outputs; all after the first depth test
+    int pass = AddGraphPass(graph, "opaque", opaquePass);
+    GraphPassWrites(graph, pass, sceneTarget);
+    GraphPassWrites(graph, pass, brightTarget);
+    GraphPassWrites(graph, pass, depthTarget);
+
+    pass = AddGraphPass(graph, "sky", skyPass);
+    GraphPassReads(graph, pass, depthTarget);
+    GraphPassWrites(graph, pass, sceneTarget);
+    GraphPassWrites(graph, pass, depthTarget);
+
+    pass = AddGraphPass(graph, "orbits", orbitPass);
+    GraphPassReads(graph, pass, depthTarget);
+    GraphPassWrites(graph, pass, sceneTarget);
+    GraphPassWrites(graph, pass, brightTarget);
+    GraphPassWrites(graph, pass, depthTarget);
+
+    pass = AddGraphPass(graph, "transparent", transparentPass);
+    GraphPassReads(graph, pass, depthTarget);
+    GraphPassWrites(graph, pass, sceneTarget);
+    GraphPassWrites(graph, pass, brightTarget);
+    GraphPassWrites(graph, pass, depthTarget);
+
+    pass = AddGraphPass(graph, "bloom", bloomPass);
+    GraphPassReads(graph, pass, brightTarget);
+    GraphPassWrites(graph, pass, bloomTarget);
+
+    if (lightSettings.autoExposure) {
+        pass = AddGraphPass(graph, "luminance", luminancePass);
+        GraphPassReads(graph, pass, sceneTarget);
+        GraphPassWrites(graph, pass, exposureTarget);
+        GraphPassKeep(graph, pass);
     }
 
-    // draw back on front
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    pass = AddGraphPass(graph, "merge", mergePass);
+    GraphPassReads(graph, pass, sceneTarget);
 
-    // 2. blur selected bright objects
-    int horizontal = 1, first_iteration = 1;
-    int blurPasses = 5;
-    int currentFrame = 0;
-    currentProgram = programs[blurProgram];
-    glUseProgram(currentProgram);
-    EnableTexture("image", currentProgram, 0);
-    BindUniform1i("bloomFactor", currentProgram, lightSettings.bloomFactor);
-    for (int i = 0; i < blurPasses; i++)
+    // nothing else than the emissive bodies writes a bright color
+    if (lightSettings.bloom && brightScreenRect(BloomRadius(lightSettings.bloomQuality), bloomRect)) {
+        GraphPassReads(graph, pass, bloomTarget);
+    } else {
+        memset(bloomRect, 0, sizeof(bloomRect));
+        SkipBloom();
+    }
+
+    // the anti-aliasing reads the tone mapped image instead of tone
+    // mapping every one of its taps again
+    if (lightSettings.antialiasing != antialiasingOff) {
+        GraphPassWrites(graph, pass, toneMappedTarget);
+        pass = AddGraphPass(graph, "fxaa", fxaaPass);
+        GraphPassReads(graph, pass, toneMappedTarget);
+    } else {
+        SkipFXAA();
+    }
+    GraphPassOutput(graph, pass, winWidth, winHeight);
+
+    CompileFrameGraph(graph);
+}
+
+/******************************************************************
+ *
+ * Display
+ *
+ * This function is called when the content of the window needs to be
+ * drawn/redrawn. It has been specified through 'glutDisplayFunc()';
+ * Enable vertex attributes, create binding between C program and
+ * attribute name in shader, provide data for uniform variables
+ *
+ *******************************************************************/
+void Display()
+{
+    // nothing is written if the frame was already begun by OnIdle
+    beginFrameData(1);
+    ResetGLStateStats();
+    BeginGovernorFrame(&governor);
+    if (lightSettings.autoExposure) {
+        AdaptExposure(&exposure);
+    }
+
+    cullObjects();
+    buildFrameGraph();
+    ResetRenderQueue(&renderQueue);
+
+    // select shader depending on lighting mode
+    int bodyProgram = phongProgram;
+    if (state.DebugMode == 1) {
+        bodyProgram = debugProgram;
+    } else if (lightSettings.mode == 1) {
+        bodyProgram = gouraudProgram;
+    }
+
+    // bodies only write the bright color if it is used
+    int bloomVariant = GraphResourceNeeded(&frameGraph, brightTarget) ? variantBloomOutput : 0;
+
+    // size in pixels of a unit sphere at distance 1
+    float projectedScale = cam.projectionMatrix[5] * renderHeight / 2.;
+    ResetShadingTiers();
+
+    // planets and asteroids are culled on the GPU, when supported
+    gpuDriven = gpuCulling.supported && bodyProgram == phongProgram;
+    selectBeltBands(projectedScale);
+    selectTerrain(projectedScale);
+    if (gpuDriven) {
+        writeGPUCullInstances();
+    }
+
+    // everything of this frame is written to the frame data
+    updateLights();
+    FlushRingFrame(&frameData);
+    StateBindBufferRange(GL_UNIFORM_BUFFER, lightsBlockBinding, frameData.id,
+            RingFrameOffset(&frameData, frameLightsOffset), lightCount*sizeof(GPULight));
+
+    if (gpuDriven) {
+        setSphereCullCommands(lightSettings.rayCastSpheres ? spriteIndexCount : sphereIndexCount);
+        DispatchGPUCulling(programs[cullProgram], &frustum, cam.viewMatrix, projectedScale);
+        countGPUShadingTiers(projectedScale);
+    }
+
+    // queue planets
+    if (gpuDriven) {
+        // all bodies with the sphere mesh in one draw, spread around the origin
+        float center[16];
+        SetIdentityMatrix(center);
+
+        RenderCommand command = {
+            .pass = passOpaque,
+            .program = phongIndirectProgram,
+            .VBO = sphereVBO,
+            .CBO = sphereCBO,
+            .NBO = sphereNBO,
+            .UVBO = sphereUVBO,
+            .IBO = sphereIBO,
+            .indirect = 1,
+            .indirectCount = 1,
+            .variant = bloomVariant,
+            .depth = viewDepth(center),
+        };
+        if (lightSettings.rayCastSpheres) {
+            rayCastSphere(&command);
+        }
+        submitShadingTiers(&command, sphereCullCommand);
+    }
+    for(int i = 0; i < planetsCount; i++)
     {
-        glBindFramebuffer(GL_FRAMEBUFFER, blurBuffer.id[currentFrame]);
-        BindUniform1i("horizontal", currentProgram, horizontal);
-
-        currentFrame = (currentFrame + 1) % blurBuffer.size;
-        horizontal = (horizontal + 1) % 2;
-
-        // bind texture of other framebuffer (or scene if first iteration)
-        glBindTexture(GL_TEXTURE_2D,
-                first_iteration == 1 ?
-                    hdrBuffer.colors[1] :
-                    blurBuffer.colors[currentFrame]
-                    );
-        DrawFrontScreen();
-
-        if (first_iteration == 1) {
-            first_iteration = 0;
+        if (i == terrainBody) {
+            submitTerrain(bodyProgram, bloomVariant);
+            continue;
+        }
+
+        if (gpuDriven) {
+            if (planetCullCommands[i] == sphereCullCommand) {
+                continue;
+            }
+
+            // one multi-draw over the parts, each reads its layer of the array
+            RenderCommand command = {
+                .pass = passOpaque,
+                .program = phongIndirectProgram,
+                .VBO = planets[i].VBO,
+                .CBO = planets[i].CBO,
+                .NBO = planets[i].NBO,
+                .UVBO = planets[i].UVBO,
+                .IBO = planets[i].IBO,
+                .indirect = 1,
+                .indirectCount = planets[i].partsCount,
+                .variant = bloomVariant | (planets[i].isEmissive ? variantEmissive : 0),
+                .depth = viewDepth(planets[i].transformation),
+            };
+            if (lightSettings.rayCastSpheres && planets[i].VBO == sphereVBO) {
+                rayCastSphere(&command);
+            }
+            submitShadingTiers(&command, planetCullCommands[i]);
+            continue;
+        }
+
+        if (!cullSet.visible[i]) {
+            continue;
+        }
+
+        // the parts share the buffers and transformation of the body,
+        // each is drawn from its sub-range of the IBO with its texture,
+        // which unlike the layers of the indirect draws differ
+        for (int j = 0; j < planets[i].partsCount; j++) {
+            RenderCommand command = {
+                .pass = passOpaque,
+                .program = bodyProgram,
+                .texture = planets[i].parts[j].TextureID,
+                .VBO = planets[i].VBO,
+                .CBO = planets[i].CBO,
+                .NBO = planets[i].NBO,
+                .UVBO = planets[i].UVBO,
+                .IBO = planets[i].IBO,
+                .firstIndex = planets[i].parts[j].firstIndex,
+                .indexCount = planets[i].parts[j].indexCount,
+                .transformation = planets[i].transformation,
+                .variant = bloomVariant | (planets[i].isEmissive ? variantEmissive : 0),
+                .depth = viewDepth(planets[i].transformation),
+            };
+            if (lightSettings.rayCastSpheres && planets[i].VBO == sphereVBO && bodyProgram == phongProgram) {
+                rayCastSphere(&command);
+            }
+            selectShadingTier(&command, i, projectedScale);
+            SubmitRenderCommand(&renderQueue, &command);
         }
     }
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
+    // queue asteroids
+    if (gpuDriven) {
+        // the belt orbits the origin
+        float beltCenter[16];
+        SetIdentityMatrix(beltCenter);
+
+        RenderCommand command = {
+            .pass = passOpaque,
+            .program = phongIndirectProgram,
+            .VBO = asteroidVBO,
+            .CBO = asteroidCBO,
+            .NBO = asteroidNBO,
+            .UVBO = asteroidUVBO,
+            .IBO = asteroidIBO,
+            .indirect = 1,
+            .indirectCount = 1,
+            .variant = bloomVariant,
+            .depth = viewDepth(beltCenter),
+        };
+        submitShadingTiers(&command, asteroidCullCommand);
+    }
+    for(int i = 0; i < activeAsteroids && !gpuDriven; i++)
+    {
+        if (!cullSet.visible[cullAsteroidsOffset + i] || asteroidBands[i] != bandMesh) {
+            continue;
+        }
 
-    // 3. render results to front quad
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        RenderCommand command = {
+            .pass = passOpaque,
+            .program = bodyProgram,
+            .texture = asteroidTextureID,
+            .VBO = asteroidVBO,
+            .CBO = asteroidCBO,
+            .NBO = asteroidNBO,
+            .UVBO = asteroidUVBO,
+            .IBO = asteroidIBO,
+            .indexCount = asteroidIndexCount,
+            .transformation = asteroid[i].AsteroidMatrixCombinedTransformation,
+            .variant = bloomVariant,
+            .depth = viewDepth(asteroid[i].AsteroidMatrixCombinedTransformation),
+        };
+        selectShadingTier(&command, cullAsteroidsOffset + i, projectedScale);
+        SubmitRenderCommand(&renderQueue, &command);
+    }
 
-    // draw quad in front of screen, with HDR buffer as texture
-    currentProgram = programs[bloomResultProgram];
-    glUseProgram(currentProgram);
+    // queue lights
+    if (state.DebugMode == 1) {
+        // sun light source is ignored
+        for (int i = 1; i < lightCount; ++i) {
+            // create light position matrix and resize
+            SetTranslation(lights[i].position[0], lights[i].position[1], lights[i].position[2], lights[i].transformation);
 
-    // bind scene color buffer
-    ActivateTexture(0, hdrBuffer.colors[0]);
-    EnableTexture("scene", currentProgram, 0);
+            float scale[16];
+            SetScaleMatrix(.1, .1, .1, scale);
+            MultiplyMatrix(lights[i].transformation, scale, lights[i].transformation);
+
+            RenderCommand command = {
+                .pass = passDebug,
+                .program = simpleProgram,
+                .VBO = lights[i].VBO,
+                .CBO = lights[i].CBO,
+                .IBO = lights[i].IBO,
+                .indexCount = lights[i].indexCount,
+                .transformation = lights[i].transformation,
+                .color = lights[i].color,
+                .depth = viewDepth(lights[i].transformation),
+            };
+            SubmitRenderCommand(&renderQueue, &command);
+        }
+    }
 
-    // bind blur color buffer
-    currentFrame = (currentFrame + 1) % blurBuffer.size;
-    ActivateTexture(1, blurBuffer.colors[currentFrame]);
-    EnableTexture("bloomBlur", currentProgram, 1);
+    // queue rings
+    for (int i = 0; i < ringsCount; ++i) {
+        if (!cullSet.visible[cullRingsOffset + i]) {
+            continue;
+        }
 
-    BindUniform1i("bloom", currentProgram, lightSettings.bloom);
-    BindUniform1f("exposure", currentProgram, .2);
-    DrawFrontScreen();
+        RenderCommand command = {
+            .pass = passTransparent,
+            .program = ringProgram,
+            .texture = rings[i].TextureID,
+            .VBO = rings[i].VBO,
+            .CBO = rings[i].CBO,
+            .NBO = rings[i].NBO,
+            .UVBO = rings[i].UVBO,
+            .IBO = rings[i].IBO,
+            .indexCount = rings[i].indexCount,
+            .transformation = rings[i].transformation,
+            .depth = viewDepth(rings[i].transformation),
+        };
+        SubmitRenderCommand(&renderQueue, &command);
+    }
+
+    SortRenderQueue(&renderQueue);
+    ComputeRenderMatrices(&renderQueue, cam.viewMatrix, cam.projectionMatrix);
+
+    ExecuteFrameGraph(&frameGraph);
+
+    // the frame data can be reused once the GPU is done with this frame
+    EndRingFrame(&frameData);
+
+    // the next frame is drawn with the level fitting the budget
+    int level = governor.level;
+    if (EndGovernorFrame(&governor) != level) {
+        applyGovernorLevel(governor.level);
+    }
 
     /* Swap between front and back buffer */
     glutSwapBuffers();
@@ -544,26 +1249,43 @@ void Display()
 
 /******************************************************************
  * calcOrbitLine
- * This function calculates the orbit lines of every celestial body
- * so that it can be drawn
+ * This function adds the orbit of every celestial body to the orbit
+ * batch; its line is generated by the orbit shader when drawn
  *******************************************************************/
-void calcOrbitLine(GLuint* OVBO, Planet* planet)
+void calcOrbitLine(Planet* planet)
 {
-    GLfloat orbitPoints[orbitDivisions*3] = {0};
+    planet->orbitIndex = AppendOrbit(&orbitBatch, planet->semimajor, planet->semiminor, planet->orbitInclination,
+            planet->orbitTransform, (float[3]){1., 1., 1.});
+}
 
-    int index = 0;
-    for (int i = 0; i < orbitDivisions; i++) {
-        float pos[3];
-        planetPosition(planet, radians(i), pos);
-        // printf("orbit coord %d: [%s]: [%g][%g, %g, %g]\n", i, planet->name, radians(i), pos[0], pos[1], pos[2]);
-        orbitPoints[index++] = pos[0];
-        orbitPoints[index++] = pos[1];
-        orbitPoints[index++] = pos[2];
+/******************************************************************
+ * setupBatch
+ * Merges the parts of a body into one set of buffers, with a sub-range
+ * of the IBO per part: the parts move together, so they share the
+ * buffers and the transformation, and only the texture changes
+ * between their draws. Each part keeps its texture at its own size
+ *******************************************************************/
+void setupBatch(Planet* planet)
+{
+    char* filenames[maxMeshParts];
+    GLsizei indexCounts[maxMeshParts];
+    for (int i = 0; i < planet->partsCount; i++) {
+        filenames[i] = planet->parts[i].filename;
     }
 
-    glGenBuffers(1, OVBO);
-    glBindBuffer(GL_ARRAY_BUFFER, *OVBO);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(orbitPoints), orbitPoints, GL_STATIC_DRAW);
+    planet->indexCount = readMeshFiles(filenames, planet->partsCount, planet->size, &planet->VBO, &planet->CBO,
+            &planet->NBO, &planet->UVBO, &planet->IBO, planet->color, planet->boundingSphere, indexCounts);
+
+    GLsizei firstIndex = 0;
+    for (int i = 0; i < planet->partsCount; i++) {
+        planet->parts[i].firstIndex = firstIndex;
+        planet->parts[i].indexCount = indexCounts[i];
+        firstIndex += indexCounts[i];
+        if (i > 0) {
+            SetupTexture(&planet->parts[i].TextureID, planet->parts[i].textureFilename);
+        }
+    }
+    planet->meshScale = planet->size;
 }
 
 /******************************************************************
@@ -573,37 +1295,130 @@ void calcOrbitLine(GLuint* OVBO, Planet* planet)
  *******************************************************************/
 void setupPlanet(Planet* planet)
 {
-    readMeshFile(planet->filename, planet->size, &planet->VBO, &planet->CBO, &planet->NBO, &planet->UVBO,
-                    &planet->IBO, planet->color);
+    planet->parts[0].filename = planet->filename;
+    planet->parts[0].textureFilename = planet->textureFilename;
+    planet->partsCount = 1;
+    while (planet->partsCount < maxMeshParts && planet->parts[planet->partsCount].filename != NULL) {
+        planet->partsCount++;
+    }
+
+    if (strcmp(planet->filename, sphereFilename) == 0) {
+        // the sphere mesh is loaded once and shared without scaling,
+        // updatePlanet applies the size instead
+        if (sphereIndexCount == 0) {
+            sphereIndexCount = readMeshFile(sphereFilename, 1, &sphereVBO, &sphereCBO, &sphereNBO,
+                    &sphereUVBO, &sphereIBO, (float[3]){1., 1., 1.}, sphereBoundingSphere);
+            spriteIndexCount = createSpriteMesh(&spriteVBO, &spriteCBO, &spriteIBO);
+        }
+        planet->VBO = sphereVBO;
+        planet->CBO = sphereCBO;
+        planet->NBO = sphereNBO;
+        planet->UVBO = sphereUVBO;
+        planet->IBO = sphereIBO;
+        planet->indexCount = sphereIndexCount;
+        memcpy(planet->boundingSphere, sphereBoundingSphere, sizeof(sphereBoundingSphere));
+        planet->meshScale = 1;
+
+        // sphere.obj is a unit sphere, its flat faces stay within 5% of the radius
+        planet->occluderRadius = .95;
+    } else if (planet->partsCount > 1) {
+        setupBatch(planet);
+    } else {
+        planet->indexCount = readMeshFile(planet->filename, planet->size, &planet->VBO, &planet->CBO,
+                        &planet->NBO, &planet->UVBO, &planet->IBO, planet->color, planet->boundingSphere);
+        planet->meshScale = planet->size;
+    }
 
     SetIdentityMatrix(planet->transformation);
     SetIdentityMatrix(planet->orbitTransform);
 
     if (planet->drawOrbit == 1) {
-        calcOrbitLine(&planet->OVBO, planet);
+        calcOrbitLine(planet);
     }
 
     if (planet->hasRing > 0) {
         float color[3] = {1., 1., 1.};
         int ringIndex = planet->hasRing - 1;
-        createQuadMesh(&rings[ringIndex].VBO,
+        rings[ringIndex].indexCount = createQuadMesh(&rings[ringIndex].VBO,
                 &rings[ringIndex].CBO,
                 &rings[ringIndex].NBO,
                 &rings[ringIndex].UVBO,
-                &rings[ringIndex].IBO, color);
+                &rings[ringIndex].IBO, color, rings[ringIndex].boundingSphere);
         SetupTexture(&rings[ringIndex].TextureID, rings[ringIndex].textureFilename);
         SetIdentityMatrix(rings[ringIndex].transformation);
     }
+    // batched bodies have their sub-ranges already
+    if (planet->partsCount == 1) {
+        planet->parts[0].indexCount = planet->indexCount;
+    }
     SetupTexture(&planet->TextureID, planet->textureFilename);
+    planet->parts[0].TextureID = planet->TextureID;
 }
 /******************************************************************
  * setupSkyBox
  *******************************************************************/
 void setupSkyBox() {
-    createCube(&skybox.VBO, &skybox.VAO);
+    glGenVertexArrays(1, &skybox.VAO);
+    glGenQueries(skyQueries, skybox.queries);
     SetUpCubeMapTexture(&skybox.textureID);
 }
 
+/******************************************************************
+ * drawSky
+ * Draws the sky box after the opaque bodies, as a single triangle
+ * covering the screen at the far plane: with GL_LEQUAL, only pixels no
+ * body was drawn on pass the depth test and sample the cube map. The
+ * view direction of every pixel is reconstructed from the inverse view
+ * projection matrix, without the translation of the camera.
+ * The shaded fragments are counted by a query, which is read back
+ * skyQueries frames later so waiting for it never stalls
+ *******************************************************************/
+void drawSky()
+{
+    float rotation[16];
+    memcpy(rotation, cam.viewMatrix, sizeof(rotation));
+    rotation[3] = rotation[7] = rotation[11] = 0.;
+
+    float viewProjection[16];
+    float inverseViewProjection[16];
+    MultiplyMatrix(cam.projectionMatrix, rotation, viewProjection);
+    InvertMatrix(viewProjection, inverseViewProjection);
+
+    GLuint query = skybox.queries[skybox.frame];
+    if (skybox.issued[skybox.frame]) {
+        GLuint available = GL_FALSE;
+        glGetQueryObjectuiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+        if (available) {
+            glGetQueryObjectuiv(query, GL_QUERY_RESULT, &skybox.fragments);
+        }
+    }
+
+    GLuint currentProgram = programs[skyboxProgram];
+    StateUseProgram(currentProgram);
+    StateBindVertexArray(skybox.VAO);
+    StateActiveTexture(0);
+    StateBindTexture(GL_TEXTURE_CUBE_MAP, skybox.textureID);
+    EnableTexture("sky", currentProgram, 0);
+    BindUniform4f("InverseViewProjection", currentProgram, inverseViewProjection);
+
+    StateDepthFunc(GL_LEQUAL);
+    StateDepthMask(GL_FALSE);
+
+    glBeginQuery(GL_SAMPLES_PASSED, query);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    glEndQuery(GL_SAMPLES_PASSED);
+    skybox.issued[skybox.frame] = 1;
+    skybox.frame = (skybox.frame + 1) % skyQueries;
+
+    StateDepthMask(GL_TRUE);
+    StateDepthFunc(GL_LESS);
+}
+
+void printSkyStats()
+{
+    printf("sky: %u fragments shaded, of %d pixels\n", skybox.fragments, renderWidth * renderHeight);
+}
+
 /******************************************************************
 * setupAsteroid
         * This function sets the celestia bodies up by
@@ -670,10 +1485,16 @@ void updatePlanet(Planet* planet, int delta)
     SetIdentityMatrix(temp);
     SetIdentityMatrix(planet->transformation);
 
-    // translate body, if it is a moon, relative to parent
+    // translate body, if it is a moon, relative to parent; without the
+    // part of the parent's scale which replaces the scale of its mesh
     if (planet->isMoon) {
+        Planet* parent = &planets[planet->parent];
+        float meshScale = parent->meshScale / parent->size;
+        SetScaleMatrix(meshScale, meshScale, meshScale, temp);
+        MultiplyMatrix(parent->transformation, temp, planet->transformation);
+
         SetTranslation(planet->moonDistance, 0, 0, temp);
-        MultiplyMatrix(planets[planet->parent].transformation, temp, planet->transformation);
+        MultiplyMatrix(planet->transformation, temp, planet->transformation);
     }
 
     float pos[3];
@@ -691,13 +1512,17 @@ void updatePlanet(Planet* planet, int delta)
 
     }
 
-    // scaling
-    SetScaleMatrix(planet->size, planet->size, planet->size, temp);
+    // scaling; meshes other than the shared sphere are already scaled
+    // by the size once when loaded
+    float scale = planet->size * planet->size / planet->meshScale;
+    SetScaleMatrix(scale, scale, scale, temp);
     MultiplyMatrix(planet->transformation, temp, planet->transformation);
 
     // own axis rotation
     SetRotationY(planet->currentOrbit, temp);
     MultiplyMatrix(planet->transformation, temp, planet->transformation);
+
+    SetGPUCullTransform(planet - planets, planet->transformation);
 }
 
 /******************************************************************
@@ -719,6 +1544,8 @@ void updateAsteroid(Asteroid* asteroid, int delta)
     SetRotationY(asteroidOrbitAngle, asteroid->AsteroidMatrixOrbitRotation);
 
     MultiplyMatrix(asteroid->AsteroidMatrixOrbitRotation, asteroid->AsteroidMatrixCombinedTransformation, asteroid->AsteroidMatrixCombinedTransformation);
+
+    SetGPUCullTransform(asteroid->instanceIndex, asteroid->AsteroidMatrixCombinedTransformation);
 }
 
 
@@ -799,9 +1626,7 @@ void updateCameraView(int delta)
 
     // update projection matrix
     float aspect = winWidth / winHeight;
-    float nearPlane = 1.0;
-    float farPlane = 50.0;
-    SetPerspectiveMatrix(cam.fov, aspect, nearPlane, farPlane, cam.projectionMatrix);
+    SetPerspectiveMatrix(cam.fov, aspect, cam.nearPlane, cam.farPlane, cam.projectionMatrix);
 }
 
 void updateSunLightPosition() {
@@ -816,6 +1641,36 @@ void updateSunLightPosition() {
     /* MultiplyMatrix(planet->transformation, temp, planet->transformation); */
 }
 
+/******************************************************************
+ * updateLights
+ * Writes all lights into the frame data, in view space: the global
+ * lights are read by the Lights uniform block of the lit shaders, the
+ * beacons are assigned to the clusters they reach
+ *******************************************************************/
+void updateLights() {
+    GPULight* data = RingFrameData(&frameData, frameLightsOffset);
+    float* v = cam.viewMatrix;
+
+    for (int i = 0; i < lightCount; i++) {
+        float* p = lights[i].position;
+        GPULight light = {
+            .position = {
+                v[0]*p[0] + v[1]*p[1] + v[2]*p[2] + v[3],
+                v[4]*p[0] + v[5]*p[1] + v[6]*p[2] + v[7],
+                v[8]*p[0] + v[9]*p[1] + v[10]*p[2] + v[11], 1.},
+            .color = {lights[i].color[0], lights[i].color[1], lights[i].color[2], 1.},
+        };
+        data[i] = light;
+    }
+
+    for (int i = 0; i < beaconCount; i++) {
+        float* transformation = asteroid[beaconAsteroid(i)].AsteroidMatrixCombinedTransformation;
+        float position[3] = {transformation[3], transformation[7], transformation[11]};
+        SetPointLightPosition(beaconLights[i], position);
+    }
+    AssignClusterLights(cam.viewMatrix, cam.projectionMatrix, cam.nearPlane, cam.farPlane);
+}
+
 /******************************************************************
 *
 * OnIdle
@@ -826,18 +1681,31 @@ void updateSunLightPosition() {
 *******************************************************************/
 void OnIdle()
 {
+    // the frame time of the governor includes the updates
+    BeginGovernorUpdate(&governor);
+
     /* Determine delta time between two frames to ensure constant animation */
     int newTime = glutGet(GLUT_ELAPSED_TIME);
     int delta = newTime - state.oldTime;
     state.oldTime = newTime;
 
+    // updates write to the frame data of the next frame
+    beginFrameData(0);
+
     for (int i = 0; i < planetsCount; ++i) {
         updatePlanet(&planets[i], (state.AnimationPause == 1) ? 0 : delta);
     }
 
-    for (int j = 0; j < asteroidsCount; ++j) {
+    // asteroids hidden by the governor stand still, except the ones
+    // carrying a beacon light
+    for (int j = 0; j < activeAsteroids; ++j) {
         updateAsteroid(&asteroid[j], (state.AnimationPause == 1) ? 0 : delta);
     }
+    for (int i = 0; i < beaconCount; i++) {
+        if (beaconAsteroid(i) >= activeAsteroids) {
+            updateAsteroid(&asteroid[beaconAsteroid(i)], (state.AnimationPause == 1) ? 0 : delta);
+        }
+    }
 
     updateSunLightPosition();
 
@@ -846,57 +1714,121 @@ void OnIdle()
     glutPostRedisplay();
 }
 
-/* This framebuffer will extract the bright elements from
- * the current frame. Allowing to post process only bright
- * elements on screen
- */
-void initExtractImageBuffer()
+/******************************************************************
+ * resizeRenderTargets
+ * Sets the render size to renderScale times the window size, and
+ * reallocates the bloom levels if it changed; the frame graph picks
+ * up the new size of its targets by itself
+ *******************************************************************/
+void resizeRenderTargets()
 {
-    glGenFramebuffers(hdrBuffer.size, hdrBuffer.id);
-    glBindFramebuffer(GL_FRAMEBUFFER, hdrBuffer.id[0]);
-
-    // 2 color buffers
-    // 1. for normal rendering
-    // 2. only bright elements. in this case, only the sun
-    glGenTextures(hdrBuffer.colorsSize, hdrBuffer.colors);
-    for (int i = 0; i < hdrBuffer.colorsSize; i++) {
-        createAndAttachColorBuffer(&hdrBuffer.colors[i], i);
+    GLint maxSize = 0;
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxSize);
+    int width = clamp(winWidth * renderScale + .5, maxSize, 1);
+    int height = clamp(winHeight * renderScale + .5, maxSize, 1);
+    if (width == renderWidth && height == renderHeight) {
+        return;
     }
+    renderWidth = width;
+    renderHeight = height;
 
-    // add depth support to buffer
-    glGenRenderbuffers(1, &hdrBuffer.depth);
-    glBindRenderbuffer(GL_RENDERBUFFER, hdrBuffer.depth);
-    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT, winWidth, winHeight);
+    ResizeBloom(&bloom, renderWidth, renderHeight);
 
-    // attach
-    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, hdrBuffer.depth);
+    // targets were bound directly
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    InvalidateGLState();
+}
 
+/******************************************************************
+ * Reshape
+ * Called by GLUT whenever the window was resized
+ *******************************************************************/
+void Reshape(int width, int height)
+{
+    winWidth = width > 0 ? width : 1;
+    winHeight = height > 0 ? height : 1;
+    resizeRenderTargets();
+    updateCameraView(0);
+    glutPostRedisplay();
+}
 
-    unsigned int attachments[2] = {GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1};
-    glDrawBuffers(hdrBuffer.colorsSize, attachments);
+void setRenderScale(float scale)
+{
+    renderScale = clamp(scale, 2., .5);
+    resizeRenderTargets();
+    printf("render scale: %g (%dx%d)\n", renderScale, renderWidth, renderHeight);
+}
 
-    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
-        fprintf(stderr, "Extract Image Framebuffer not complete!\n");
-        exit(-1);
+/******************************************************************
+ * applyGovernorLevel
+ * Sets the knobs to the quality of the level, and logs every one
+ * which changes with the frame times which made the governor move
+ *******************************************************************/
+void applyGovernorLevel(int level)
+{
+    GovernorLevel* quality = &governorLevels[level];
+    char* bloomQualities[] = {"low", "medium", "high"};
+
+    printf("governor: level %d, cpu %.2f ms, gpu %.2f ms, budget %.2f ms\n", level,
+            governor.cpuTime, governor.gpuTime, governor.budget);
+    if (lightSettings.bloomQuality != quality->bloomQuality) {
+        printf("governor: bloom quality %s -> %s\n", bloomQualities[lightSettings.bloomQuality],
+                bloomQualities[quality->bloomQuality]);
+        lightSettings.bloomQuality = quality->bloomQuality;
+    }
+    if (lightSettings.reducedShadingRadius != quality->reducedShadingRadius) {
+        printf("governor: reduced shading below %g -> %g pixels\n", lightSettings.reducedShadingRadius,
+                quality->reducedShadingRadius);
+        lightSettings.reducedShadingRadius = quality->reducedShadingRadius;
+    }
+    if (activeAsteroids != quality->asteroids) {
+        printf("governor: asteroids %d -> %d\n", activeAsteroids, quality->asteroids);
+        activeAsteroids = quality->asteroids;
+    }
+    if (renderScale != quality->renderScale) {
+        printf("governor: render scale %g -> %g\n", renderScale, quality->renderScale);
+        setRenderScale(quality->renderScale);
     }
 }
 
-void initBlurFramebuffer()
+/* Turns the governor on or off; off, the defaults are restored */
+void toggleGovernor()
 {
-    glGenFramebuffers(blurBuffer.size, blurBuffer.id);
+    governor.enabled = !governor.enabled;
+    printf("governor %s, budget %.2f ms\n", governor.enabled ? "on" : "off", governor.budget);
+    if (!governor.enabled && governor.level != 0) {
+        governor.level = 0;
+        applyGovernorLevel(0);
+    }
+}
 
-    glGenTextures(blurBuffer.colorsSize, blurBuffer.colors);
-    for (int i = 0; i < blurBuffer.colorsSize; i++) {
-        // its save to use i as an index on the id, because the size its the same
-        glBindFramebuffer(GL_FRAMEBUFFER, blurBuffer.id[i]);
-        createAndAttachColorBuffer(&blurBuffer.colors[i], 0);
+void printGovernorStats()
+{
+    PrintGovernorStats(&governor);
+    printf("governor: %d of %d asteroids drawn\n", activeAsteroids, asteroidsCount);
+}
 
-        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
-            fprintf(stderr, "Blur Framebuffer not complete!\n");
-            exit(-1);
-        }
-    }
+/* Switches between the adapted exposure and the fixed one; the adaption
+ * starts again from the fixed one */
+void toggleAutoExposure()
+{
+    lightSettings.autoExposure = !lightSettings.autoExposure;
+    ResetExposure(&exposure, lightSettings.exposure);
+    printf("auto exposure %s\n", lightSettings.autoExposure ? "on" : "off");
+}
 
+void printTerrainStats()
+{
+    PrintTerrainStats(&terrain);
+}
+
+void printExposureStats()
+{
+    if (lightSettings.autoExposure) {
+        PrintExposureStats(&exposure);
+    } else {
+        printf("exposure: %.3f, fixed\n", lightSettings.exposure);
+    }
 }
 
 /******************************************************************
@@ -914,31 +1846,36 @@ void Initialize()
 {
     setupSkyBox();
 
+    InitOrbitBatch(&orbitBatch);
     for (int i = 0; i < planetsCount; i++) {
         setupPlanet(&planets[i]);
     }
 
     for (int i = 1; i < lightCount; ++i) {
-        createCubeMesh(&lights[i].VBO, &lights[i].CBO, &lights[i].IBO);
+        lights[i].indexCount = createCubeMesh(&lights[i].VBO, &lights[i].CBO, &lights[i].IBO);
     }
 
-    readMeshFile(asteroidFilename, 15, &asteroidVBO, &asteroidCBO, &asteroidNBO, &asteroidUVBO,
-                 &asteroidIBO, asteroidColor);
+    asteroidIndexCount = readMeshFile(asteroidFilename, 15, &asteroidVBO, &asteroidCBO, &asteroidNBO,
+                 &asteroidUVBO, &asteroidIBO, asteroidColor, asteroidBoundingSphere);
 
     SetupTexture(&asteroidTextureID, asteroidTextureFilename);
     for(int j = 0; j < asteroidsCount; j++){
         setupAsteroid(&asteroid[j]);
+        asteroid[j].instanceIndex = planetsCount + j;
     }
 
     /* Enable depth testing */
     glEnable(GL_DEPTH_TEST);
     glDepthFunc(GL_LESS);
 
-    /* Setup shaders and shader program */
-    CreateShaderProgram(phongProgram,
-            "shaders/phong.vs", "shaders/phong.fs", NULL);
-    CreateShaderProgram(gouraudProgram,
-            "shaders/gouraud.vs", "shaders/simple.fs", NULL);
+    /* Setup shaders and shader program; lit programs have variants */
+    char lightDefines[128];
+    sprintf(lightDefines, "#define LIGHT_COUNT %d\n#define CLUSTER_TILES_X %d\n#define CLUSTER_TILES_Y %d\n#define CLUSTER_SLICES %d\n",
+            lightCount, clusterTilesX, clusterTilesY, clusterSlices);
+    CreateVariantProgram(phongProgram,
+            "shaders/phong.vs", "shaders/phong.fs", NULL, lightDefines);
+    CreateVariantProgram(gouraudProgram,
+            "shaders/gouraud.vs", "shaders/simple.fs", NULL, lightDefines);
     CreateShaderProgram(defaultProgram,
             "shaders/textured.vs", "shaders/textured.fs", NULL);
     CreateShaderProgram(simpleProgram,
@@ -947,22 +1884,126 @@ void Initialize()
             "shaders/debug.vs", "shaders/debug.fs", "shaders/debug.gs");
     CreateShaderProgram(ringProgram,
                         "shaders/textured.vs", "shaders/rings.fs", NULL);
-    // blurProgram: blur current fragmentshader
-    CreateShaderProgram(blurProgram,
-                        "shaders/textureCoords.vs", "shaders/blur.fs", NULL);
+    // bloomDownProgram and bloomUpProgram: blur the bright parts, see bloom.h
+    CreateShaderProgram(bloomDownProgram,
+                        "shaders/textureCoords.vs", "shaders/bloomDown.fs", NULL);
+    CreateShaderProgram(bloomUpProgram,
+                        "shaders/textureCoords.vs", "shaders/bloomUp.fs", NULL);
     // bloomResultProgram: merge the result of the two framebuffers used for the bloom effect
     CreateShaderProgram(bloomResultProgram,
                         "shaders/textureCoords.vs", "shaders/bloomMerge.fs", NULL);
+    // fxaaProgram: anti-aliasing of the merged image, see ApplyFXAA
+    CreateShaderProgram(fxaaProgram,
+                        "shaders/textureCoords.vs", "shaders/fxaa.fs", NULL);
+    // luminanceProgram: log luminance of the scene, averaged for the exposure
+    CreateShaderProgram(luminanceProgram,
+                        "shaders/textureCoords.vs", "shaders/luminance.fs", NULL);
     CreateShaderProgram(skyboxProgram,"shaders/sky.vs", "shaders/sky.fs", NULL);
+    CreateShaderProgram(orbitProgram,
+            "shaders/orbit.vs", "shaders/simple.fs", NULL);
+    // impostorProgram and beltPointProgram: the small asteroids, see beltlod.h
+    CreateVariantProgram(impostorProgram,
+            "shaders/impostor.vs", "shaders/impostor.fs", NULL, lightDefines);
+    CreateVariantProgram(beltPointProgram,
+            "shaders/beltPoints.vs", "shaders/beltPoints.fs", NULL, lightDefines);
+    CreateShaderProgram(impostorBakeProgram,
+            "shaders/impostorBake.vs", "shaders/impostorBake.fs", NULL);
+
+    meshPartsCount = 0;
+    for (int i = 0; i < planetsCount; i++) {
+        meshPartsCount += planets[i].partsCount;
+    }
 
-    // initialize frame buffers for HDR
-    initExtractImageBuffer();
+    // every command comes with one per shading tier, see submitShadingTiers
+    if (InitGPUCulling(planetsCount + asteroidsCount, shadingTiers * (meshPartsCount + 1))) {
+        CreateComputeProgram(cullProgram, "shaders/cull.cs");
+        // phong reading the instance buffer, which needs GLSL 4.30
+        char indirectDefines[192];
+        sprintf(indirectDefines, "#version 430\n#define INDIRECT\n%s", lightDefines);
+        CreateVariantProgram(phongIndirectProgram,
+                "shaders/phong.vs", "shaders/phong.fs", NULL, indirectDefines);
+
+        int sphereCount = 0;
+        for (int i = 0; i < planetsCount; i++) {
+            sphereCount += planets[i].VBO == sphereVBO && !planets[i].isEmissive;
+        }
+        sphereCullCommand = addTieredCullCommand(&(MeshPart){.indexCount = sphereIndexCount}, 1, sphereCount);
+
+        // every part gets a layer, the ones of a body follow each other
+        char* textureFilenames[planetsCount * maxMeshParts + 1];
+        int layers = 0;
+        for (int i = 0; i < planetsCount; i++) {
+            // emissive bodies are drawn on their own, with another variant
+            if (planets[i].VBO == sphereVBO && !planets[i].isEmissive) {
+                planetCullCommands[i] = sphereCullCommand;
+            } else {
+                planetCullCommands[i] = addTieredCullCommand(planets[i].parts, planets[i].partsCount, 1);
+            }
+            SetGPUCullMaterial(i, planets[i].color, layers);
+            for (int j = 0; j < planets[i].partsCount; j++) {
+                textureFilenames[layers++] = planets[i].parts[j].textureFilename;
+            }
+        }
+        textureFilenames[layers] = asteroidTextureFilename;
+        SetupTextureArray(&bodyTextureArray, textureFilenames, layers + 1,
+                bodyTextureWidth, bodyTextureHeight);
+
+        asteroidCullCommand = addTieredCullCommand(&(MeshPart){.indexCount = asteroidIndexCount}, 1,
+                asteroidsCount);
+        for (int i = 0; i < asteroidsCount; i++) {
+            SetGPUCullMaterial(planetsCount + i, asteroidColor, layers);
+        }
+    }
 
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    // lit programs read the lights from the frame data
+    int litPrograms[] = {phongProgram, gouraudProgram, phongIndirectProgram, impostorProgram, beltPointProgram};
+    for (int i = 0; i < 5; i++) {
+        if (programs[litPrograms[i]] != 0) {
+            GLuint program = programs[litPrograms[i]];
+            glUniformBlockBinding(program, glGetUniformBlockIndex(program, "Lights"), lightsBlockBinding);
+        }
+    }
+
+    GLsizeiptr alignment = RingAlignment();
+    frameLightsOffset = 0;
+    frameInstancesOffset = (lightCount*sizeof(GPULight) + alignment - 1) / alignment * alignment;
+    frameClustersOffset = frameInstancesOffset + (planetsCount + asteroidsCount)*sizeof(GPUInstance);
+    frameClustersOffset = (frameClustersOffset + alignment - 1) / alignment * alignment;
+    framePointLightsOffset = (frameClustersOffset + ClusterDataSize() + alignment - 1) / alignment * alignment;
+    frameBeltOffset = (framePointLightsOffset + ClusterLightDataSize() + alignment - 1) / alignment * alignment;
+    InitRingBuffer(&frameData, frameBeltOffset + asteroidsCount*sizeof(BeltInstance));
+
+    // views of the asteroid mesh for the impostors; the points size themselves
+    InitBeltLod(&beltLod, asteroidsCount, asteroidBoundingSphere);
+    BakeBeltImpostors(&beltLod, programs[impostorBakeProgram], asteroidTextureID, asteroidVBO, asteroidCBO,
+            asteroidIBO, asteroidNBO, asteroidUVBO, asteroidIndexCount);
+    glEnable(GL_PROGRAM_POINT_SIZE);
+
+    InitClusters(frameData.id);
+    for (int i = 0; i < beaconCount; i++) {
+        float* transformation = asteroid[beaconAsteroid(i)].AsteroidMatrixCombinedTransformation;
+        float position[3] = {transformation[3], transformation[7], transformation[11]};
+        beaconLights[i] = AddPointLight(position, beaconColors[i % 4], beaconRadius);
+    }
 
-    initBlurFramebuffer();
+    InitSphereSet(&cullSet, planetsCount + ringsCount + asteroidsCount);
+    InitSphereSet(&occluderSet, planetsCount);
+    InitRenderQueue(&renderQueue,
+            meshPartsCount + asteroidsCount + ringsCount + lightCount + terrainCacheSlots,
+            setupRenderProgram);
+    InitTerrain(&terrain);
+
+    // the render targets are allocated by the frame graph
+    renderWidth = winWidth * renderScale;
+    renderHeight = winHeight * renderScale;
+    InitBloom(&bloom, renderWidth, renderHeight);
+    InitGovernor(&governor, frameBudget, governorLevelCount);
+    InitExposure(&exposure, lightSettings.exposure);
 
     updateCameraView(0);
+
+    // state was changed directly while loading
+    InvalidateGLState();
 }
 
 
@@ -998,6 +2039,7 @@ int main(int argc, char** argv)
      * handing control over to GLUT */
     glutIdleFunc(OnIdle);
     glutDisplayFunc(Display);
+    glutReshapeFunc(Reshape);
     glutKeyboardFunc(Keyboard);
     glutKeyboardUpFunc(KeyboardUp);
     glutMouseFunc(Mouse);
@@ -3,27 +3,6 @@
 
 /* Indices to vertex attributes; in this case positon, color, normal and uv */
 enum PlanetShaderIndices {vPosition = 0, vColor = 1, vNormal = 2, vUV = 3};
-enum OrbitShaderIndices {oPos = 0};
-enum SkyboxIndices {aPos = 0};
-
-#define CREATE_BUFFER(VARNAME, TYPENAME, BUFFERSCOUNT, COLORSCOUNT) \
-typedef struct __##TYPENAME { \
-    const GLsizei size;               \
-    unsigned int id[BUFFERSCOUNT];    \
-    const GLsizei colorsSize;         \
-    GLuint colors[COLORSCOUNT]; \
-    unsigned int depth;         \
-} TYPENAME; \
-TYPENAME VARNAME = {.size = BUFFERSCOUNT, .colorsSize = COLORSCOUNT};
-
-typedef struct shaderBuffer {
-    GLsizei size;
-    GLuint id;
-
-    GLuint colors[2];
-    unsigned int depth;
-
-} ShaderBuffer;
 
 typedef struct screen {
     // front screen
@@ -37,10 +16,32 @@ typedef struct screen {
 #define defaultProgram 3
 #define debugProgram 4
 #define ringProgram 5
-#define blurProgram 6
+#define bloomDownProgram 6
 #define bloomResultProgram 7
 #define skyboxProgram 8
-GLuint programs[9];
+#define cullProgram 9
+#define phongIndirectProgram 10
+#define orbitProgram 11
+#define bloomUpProgram 12
+#define luminanceProgram 13
+#define impostorProgram 14
+#define beltPointProgram 15
+#define impostorBakeProgram 16
+#define fxaaProgram 17
+GLuint programs[18];
+
+/* Mesh of a body; further ones always move with the first, so they are
+ * merged into the buffers of the body at load time and drawn as
+ * sub-ranges of it, each with its own texture, see setupBatch */
+#define maxMeshParts 2
+
+typedef struct meshPart {
+    char* filename;
+    char* textureFilename;
+    GLuint TextureID;
+    GLsizei firstIndex; // sub-range of the part on the IBO of the body
+    GLsizei indexCount;
+} MeshPart;
 
 typedef struct planet {
     const char* name;
@@ -68,11 +69,19 @@ typedef struct planet {
 
     GLuint TextureID;
     GLuint VBO; // vertex buffer object
-    GLuint CBO; // color buffe object
+    GLuint CBO; // color buffer object
     GLuint NBO; // normal buffer object
     GLuint IBO; // index buffer object
-    GLuint OVBO; // orbit vertex buffer object
+    int orbitIndex; // index on the orbit batch
     GLuint UVBO; // uv buffer object
+    GLsizei indexCount; // number of indices in the IBO
+    float boundingSphere[4]; // center and radius in object space
+    float occluderRadius; // sphere inside of the mesh, 0 if the body does not occlude
+    float meshScale; // scale applied by readMeshFile, 1 for the shared sphere mesh
+    int isEmissive; // not lit, drawn with the emissive shader variant
+
+    MeshPart parts[maxMeshParts]; // parts[0] is filename itself, filled by setupPlanet
+    int partsCount; // 1 for a single mesh
 } Planet;
 
 /*individual transformation settings for all asteroids*/
@@ -87,6 +96,7 @@ typedef struct asteroids {
     float AsteroidMatrixScale[16];
     float AsteroidMatrixCombinedTransformation[16];
 
+    int instanceIndex; // index on the GPU culling instances
 } Asteroid;
 
 typedef struct ring {
@@ -98,24 +108,29 @@ typedef struct ring {
 
     GLuint TextureID;
     GLuint VBO; // vertex buffer object
-    GLuint CBO; // color buffe object
+    GLuint CBO; // color buffer object
     GLuint NBO; // normal buffer object
     GLuint IBO; // index buffer object
     GLuint UVBO; // uv buffer object
+    GLsizei indexCount; // number of indices in the IBO
+    float boundingSphere[4]; // center and radius in object space
 } Ring;
 
+/* Queries counting the shaded sky fragments, one per frame in flight */
+#define skyQueries 3
+
 typedef struct skybox {
-    float transformation[16];
     GLuint textureID;
-    GLuint VBO;
-    GLuint VAO;
-    GLuint size;
+    GLuint VAO; // without any buffers, the vertices are generated in sky.vs
+    GLuint queries[skyQueries];
+    int issued[skyQueries]; // the query has a result to read
+    int frame; // query used by the current frame
+    GLuint fragments; // sky fragments shaded in the last measured frame
 } SkyBox;
 
-#define planetsCount 15
+#define planetsCount 14
 #define ringsCount 2
 #define cubeCount 1
-#define orbitDivisions 360
 
 typedef struct camera {
     float position[3]; // position of the camera on the global world
@@ -128,11 +143,17 @@ typedef struct camera {
     int lookingAt; // 0: free, 1-9: planet n
 
     float fov; // field of view. used to "fake" zoom
+    float nearPlane;
+    float farPlane;
 
     float viewMatrix[16]; // final ViewMatrix of the camera
     float projectionMatrix[16]; // final ProjectionMatrix
 } Camera;
 
+/* FXAA in the bloom merge; low searches the ends of edges with fewer,
+ * longer steps */
+enum Antialiasing {antialiasingOff, antialiasingLow, antialiasingHigh, antialiasingModes};
+
 typedef struct lightSettings {
     float ambientFactor;
     float diffuseFactor;
@@ -140,8 +161,22 @@ typedef struct lightSettings {
     int mode;
     int bloom;
     int bloomFactor;
+    int bloomQuality; // BloomQuality, how wide the bloom is blurred
+    int antialiasing; // Antialiasing of the merge, after tone mapping
+    int autoExposure; // adapt the exposure to the scene, see exposure.h
+    float exposure; // used if not adapted
+    float reducedShadingRadius; // in pixels, smaller bodies get the reduced shading
+    int rayCastSpheres; // spheres ray cast on a quad instead of their mesh, phong only
 } LightSettings;
 
+/* Knobs the performance governor turns, at one of its levels */
+typedef struct governorLevel {
+    int bloomQuality;
+    float reducedShadingRadius;
+    int asteroids; // how many of the asteroids are drawn
+    float renderScale;
+} GovernorLevel;
+
 typedef struct animState {
     int oldTime;
     int i;
@@ -149,17 +184,26 @@ typedef struct animState {
     int DebugMode;
 } AnimState;
 
-// should be in sync with phong.fs
+// global lights, reaching everything; passed to the lit shaders as LIGHT_COUNT
 #define lightCount 3
 typedef struct light {
     float position[3];
     float color[3];
+    float transformation[16]; // debug cube at the light position
 
     GLuint VBO; // vertex buffer object
-    GLuint CBO; // color buffe object
+    GLuint CBO; // color buffer object
     GLuint IBO; // index buffer object
+    GLsizei indexCount; // number of indices in the IBO
 } Light;
 
+/* Layout of a light in the Lights uniform block (std140) */
+#define lightsBlockBinding 0
+typedef struct gpuLight {
+    float position[4];
+    float color[4];
+} GPULight;
+
 // global variables
 extern AnimState state;
 extern Camera cam;
@@ -169,12 +213,26 @@ extern LightSettings lightSettings;
 extern Light lights[lightCount];
 extern ScreenQuad frontScreen;
 
-const float winWidth;
-const float winHeight;
+// size of the window, and of the HDR buffer the scene is drawn into
+extern float winWidth;
+extern float winHeight;
+extern float renderScale;
+extern int renderWidth;
+extern int renderHeight;
 
-void calcOrbitLine(GLuint* OVBO, Planet* planet);
+void calcOrbitLine(Planet* planet);
 void setupPlanet(Planet* planet);
 void planetPosition(Planet* planet, float angle, float* result);
 void updatePlanet(Planet* planet, int delta);
 void updateCameraView(int delta);
+void updateLights();
+void drawSky();
+void setRenderScale(float scale);
+void applyGovernorLevel(int level);
+void toggleGovernor();
+void printGovernorStats();
+void toggleAutoExposure();
+void printExposureStats();
+void printTerrainStats();
+void printSkyStats();
 #endif
@@ -20,6 +20,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <math.h>
 
 #include "OBJParser.h"
 #define WHITESPACE " \t\n\r"
@@ -337,17 +338,8 @@ int obj_parse_obj_file(obj_growable_scene_data *growable_data, char *filename)
 		return 0;
 	}
 
-/*		
-	extreme_dimensions[0].x = INFINITY; extreme_dimensions[0].y = INFINITY; extreme_dimensions[0].z = INFINITY;
-	extreme_dimensions[1].x = -INFINITY; extreme_dimensions[1].y = -INFINITY; extreme_dimensions[1].z = -INFINITY;
-
-			if(v->x < extreme_dimensions[0].x) extreme_dimensions[0].x = v->x;
-			if(v->x > extreme_dimensions[1].x) extreme_dimensions[1].x = v->x;
-			if(v->y < extreme_dimensions[0].y) extreme_dimensions[0].y = v->y;
-			if(v->y > extreme_dimensions[1].y) extreme_dimensions[1].y = v->y;
-			if(v->z < extreme_dimensions[0].z) extreme_dimensions[0].z = v->z;
-			if(v->z > extreme_dimensions[1].z) extreme_dimensions[1].z = v->z;*/
-
+	growable_data->extreme_dimensions[0].e[0] = INFINITY; growable_data->extreme_dimensions[0].e[1] = INFINITY; growable_data->extreme_dimensions[0].e[2] = INFINITY;
+	growable_data->extreme_dimensions[1].e[0] = -INFINITY; growable_data->extreme_dimensions[1].e[1] = -INFINITY; growable_data->extreme_dimensions[1].e[2] = -INFINITY;
 
 	//parser loop
 	while( fgets(current_line, OBJ_LINE_SIZE, obj_file_stream) )
@@ -362,7 +354,14 @@ int obj_parse_obj_file(obj_growable_scene_data *growable_data, char *filename)
 		//parse objects
 		else if( strequal(current_token, "v") ) //process vertex
 		{
-			list_add_item(&growable_data->vertex_list,  obj_parse_vector(), NULL);
+			obj_vector *v = obj_parse_vector();
+			int i;
+			for(i=0; i<3; i++)
+			{
+				if(v->e[i] < growable_data->extreme_dimensions[0].e[i]) growable_data->extreme_dimensions[0].e[i] = v->e[i];
+				if(v->e[i] > growable_data->extreme_dimensions[1].e[i]) growable_data->extreme_dimensions[1].e[i] = v->e[i];
+			}
+			list_add_item(&growable_data->vertex_list, v, NULL);
 		}
 		
 		else if( strequal(current_token, "vn") ) //process vertex normal
@@ -566,6 +565,9 @@ void obj_copy_to_out_storage(obj_scene_data *data_out, obj_growable_scene_data *
 	data_out->light_quad_list = (obj_light_quad**)growable_data->light_quad_list.items;
 	
 	data_out->material_list = (obj_material**)growable_data->material_list.items;
+
+	data_out->extreme_dimensions[0] = growable_data->extreme_dimensions[0];
+	data_out->extreme_dimensions[1] = growable_data->extreme_dimensions[1];
 	
 	data_out->camera = growable_data->camera;
 }
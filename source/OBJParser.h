@@ -103,7 +103,7 @@ typedef struct
 
 typedef struct
 {
-//	vector extreme_dimensions[2];
+	obj_vector extreme_dimensions[2]; // bounding box: min and max corner
 	char scene_filename[OBJ_FILENAME_LENGTH];
 	char material_filename[OBJ_FILENAME_LENGTH];
 	
@@ -154,6 +154,8 @@ typedef struct
 
 	int material_count;
 
+	obj_vector extreme_dimensions[2]; // bounding box: min and max corner
+
 	obj_camera *camera;
 } obj_scene_data;
 
@@ -0,0 +1,562 @@
+#define _POSIX_C_SOURCE 200112L // threads
+
+#include "stdio.h"
+#include "stdlib.h"
+#include "string.h"
+#include "math.h"
+#include "pthread.h"
+#include "GL/glew.h"
+
+#include "source/LoadTexture.h"
+#include "source/Matrix.h"
+
+#include "utils.h"
+#include "terrain.h"
+#include "glstate.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+TerrainStats terrainStats;
+
+/* Normal and the two axes of every cube face, u cross v is the normal,
+ * so the triangles of all faces wind counterclockwise seen from outside */
+static const float faceAxes[6][3][3] = {
+    {{1, 0, 0}, {0, 0, -1}, {0, 1, 0}},
+    {{-1, 0, 0}, {0, 0, 1}, {0, 1, 0}},
+    {{0, 1, 0}, {1, 0, 0}, {0, 0, -1}},
+    {{0, -1, 0}, {1, 0, 0}, {0, 0, 1}},
+    {{0, 0, 1}, {1, 0, 0}, {0, 1, 0}},
+    {{0, 0, -1}, {-1, 0, 0}, {0, 1, 0}},
+};
+
+static unsigned long long patchKey(int body, int face, int level, int x, int y)
+{
+    // never 0, which marks a free slot
+    return 1ULL << 63 | (unsigned long long)body << 40 | (unsigned long long)face << 36
+        | (unsigned long long)level << 32 | (unsigned long long)x << 16 | (unsigned long long)y;
+}
+
+/* Point (u, v) of a cube face, both in -1..1, on the unit sphere; the
+ * cube is spherified so the cells are of similar size all over it */
+static void facePoint(int face, float u, float v, float* point)
+{
+    float cube[3];
+    for (int i = 0; i < 3; i++) {
+        cube[i] = faceAxes[face][0][i] + u * faceAxes[face][1][i] + v * faceAxes[face][2][i];
+    }
+    float x2 = cube[0] * cube[0], y2 = cube[1] * cube[1], z2 = cube[2] * cube[2];
+    point[0] = cube[0] * sqrtf(fmaxf(1. - y2 / 2. - z2 / 2. + y2 * z2 / 3., 0.));
+    point[1] = cube[1] * sqrtf(fmaxf(1. - z2 / 2. - x2 / 2. + z2 * x2 / 3., 0.));
+    point[2] = cube[2] * sqrtf(fmaxf(1. - x2 / 2. - y2 / 2. + x2 * y2 / 3., 0.));
+
+    // points just outside of the face, for the normals, are not on the sphere yet
+    float length = sqrtf(point[0] * point[0] + point[1] * point[1] + point[2] * point[2]);
+    for (int i = 0; i < 3; i++) {
+        point[i] /= length;
+    }
+}
+
+/* Texture coordinates of a direction, mapped like models/sphere.obj */
+static void sphereUV(float* direction, float* uv)
+{
+    uv[0] = .5 - atan2f(direction[2], direction[0]) / (2. * M_PI);
+    uv[1] = asinf(clamp(direction[1], 1., -1.)) / M_PI + .5;
+}
+
+/* Bilinear height of a direction, 0..1 */
+static float sampleHeight(TerrainHeightmap* heightmap, float* direction)
+{
+    float uv[2];
+    sphereUV(direction, uv);
+    float x = uv[0] * heightmap->width - .5;
+    float y = clamp(uv[1] * heightmap->height - .5, heightmap->height - 1, 0.);
+    int x0 = (int)floorf(x), y0 = (int)y;
+    float fx = x - x0, fy = y - y0;
+    int x1 = x0 + 1, y1 = y0 + 1 < heightmap->height ? y0 + 1 : y0;
+    x0 = (x0 % heightmap->width + heightmap->width) % heightmap->width;
+    x1 = (x1 % heightmap->width + heightmap->width) % heightmap->width;
+
+    float* row0 = heightmap->heights + y0 * heightmap->width;
+    float* row1 = heightmap->heights + y1 * heightmap->width;
+    return (row0[x0] * (1. - fx) + row0[x1] * fx) * (1. - fy) + (row1[x0] * (1. - fx) + row1[x1] * fx) * fy;
+}
+
+static void surfacePoint(TerrainHeightmap* heightmap, int face, float u, float v, float* point)
+{
+    facePoint(face, u, v, point);
+    float radius = 1. + terrainHeightScale * sampleHeight(heightmap, point);
+    for (int i = 0; i < 3; i++) {
+        point[i] *= radius;
+    }
+}
+
+/******************************************************************
+ * generatePatch
+ * Vertices of the patch of a job, run by the workers. The outermost
+ * ring of the grid is the skirt: the border again, lowered by
+ * terrainSkirtDepth
+ *******************************************************************/
+static void generatePatch(TerrainJob* job)
+{
+    float size = 2. / (1 << job->level);
+    float cell = size / terrainPatchSize;
+    float u0 = -1. + job->x * size;
+    float v0 = -1. + job->y * size;
+
+    // the longitude jumps at the seam; every patch keeps it continuous
+    // around its center, the texture repeats
+    float center[3], centerUV[2];
+    facePoint(job->face, u0 + size / 2., v0 + size / 2., center);
+    sphereUV(center, centerUV);
+
+    int rowLength = terrainPatchSize + 3;
+    for (int j = 0; j < rowLength; j++) {
+        for (int i = 0; i < rowLength; i++) {
+            int gridI = i == 0 ? 0 : (i == rowLength - 1 ? terrainPatchSize : i - 1);
+            int gridJ = j == 0 ? 0 : (j == rowLength - 1 ? terrainPatchSize : j - 1);
+            int skirt = gridI != i - 1 || gridJ != j - 1;
+            float u = u0 + gridI * cell;
+            float v = v0 + gridJ * cell;
+            int vertex = j * rowLength + i;
+
+            float* position = &job->positions[vertex * 3];
+            surfacePoint(job->heightmap, job->face, u, v, position);
+
+            // central differences along both face axes
+            float left[3], right[3], down[3], up[3], du[3], dv[3];
+            surfacePoint(job->heightmap, job->face, u - cell, v, left);
+            surfacePoint(job->heightmap, job->face, u + cell, v, right);
+            surfacePoint(job->heightmap, job->face, u, v - cell, down);
+            surfacePoint(job->heightmap, job->face, u, v + cell, up);
+            for (int k = 0; k < 3; k++) {
+                du[k] = right[k] - left[k];
+                dv[k] = up[k] - down[k];
+            }
+            float* normal = &job->normals[vertex * 3];
+            CrossProduct(du, dv, normal);
+            NormalizeVector(normal, normal);
+
+            float* uv = &job->uvs[vertex * 2];
+            sphereUV(position, uv);
+            if (uv[0] - centerUV[0] > .5) {
+                uv[0] -= 1.;
+            } else if (uv[0] - centerUV[0] < -.5) {
+                uv[0] += 1.;
+            }
+
+            if (skirt) {
+                float length = sqrtf(position[0] * position[0] + position[1] * position[1]
+                        + position[2] * position[2]);
+                float lowered = (length - terrainSkirtDepth) / length;
+                for (int k = 0; k < 3; k++) {
+                    position[k] *= lowered;
+                }
+            }
+        }
+    }
+}
+
+/* Queued job of the coarsest patch, they cover the most */
+static TerrainJob* nextJob(Terrain* terrain)
+{
+    TerrainJob* next = NULL;
+    for (int i = 0; i < terrainMaxJobs; i++) {
+        TerrainJob* job = &terrain->jobs[i];
+        if (job->state == jobQueued && (next == NULL || job->level < next->level)) {
+            next = job;
+        }
+    }
+    return next;
+}
+
+static void* terrainWorker(void* argument)
+{
+    Terrain* terrain = argument;
+
+    pthread_mutex_lock(&terrain->lock);
+    for (;;) {
+        TerrainJob* job;
+        while ((job = nextJob(terrain)) == NULL) {
+            pthread_cond_wait(&terrain->queued, &terrain->lock);
+        }
+        job->state = jobRunning;
+        pthread_mutex_unlock(&terrain->lock);
+
+        double start = milliseconds();
+        generatePatch(job);
+        double time = milliseconds() - start;
+
+        pthread_mutex_lock(&terrain->lock);
+        job->state = jobDone;
+        terrainStats.generated++;
+        terrainStats.generationTime += time;
+    }
+    return NULL;
+}
+
+/******************************************************************
+ * InitTerrain
+ * Allocates the buffers of all cache slots and starts the workers
+ *******************************************************************/
+void InitTerrain(Terrain* terrain)
+{
+    memset(terrain->heightmaps, 0, sizeof(terrain->heightmaps));
+    terrain->body = -1;
+    terrain->frame = 0;
+    terrain->visibleCount = 0;
+
+    for (int i = 0; i < terrainCacheSlots; i++) {
+        TerrainSlot* slot = &terrain->slots[i];
+        slot->key = 0;
+        slot->lastUsed = -1;
+
+        glGenBuffers(1, &slot->VBO);
+        StateBindBuffer(GL_ARRAY_BUFFER, slot->VBO);
+        glBufferData(GL_ARRAY_BUFFER, terrainPatchVertices * 3 * sizeof(float), NULL, GL_STATIC_DRAW);
+        glGenBuffers(1, &slot->NBO);
+        StateBindBuffer(GL_ARRAY_BUFFER, slot->NBO);
+        glBufferData(GL_ARRAY_BUFFER, terrainPatchVertices * 3 * sizeof(float), NULL, GL_STATIC_DRAW);
+        glGenBuffers(1, &slot->UVBO);
+        StateBindBuffer(GL_ARRAY_BUFFER, slot->UVBO);
+        glBufferData(GL_ARRAY_BUFFER, terrainPatchVertices * 2 * sizeof(float), NULL, GL_STATIC_DRAW);
+    }
+
+    float* colors = malloc(terrainPatchVertices * 3 * sizeof(float));
+    for (int i = 0; i < terrainPatchVertices * 3; i++) {
+        colors[i] = 1.;
+    }
+    glGenBuffers(1, &terrain->CBO);
+    StateBindBuffer(GL_ARRAY_BUFFER, terrain->CBO);
+    glBufferData(GL_ARRAY_BUFFER, terrainPatchVertices * 3 * sizeof(float), colors, GL_STATIC_DRAW);
+    free(colors);
+
+    // two triangles per cell, skirt included
+    unsigned int* indices = malloc(terrainPatchIndices * sizeof(unsigned int));
+    int rowLength = terrainPatchSize + 3;
+    int n = 0;
+    for (int j = 0; j < rowLength - 1; j++) {
+        for (int i = 0; i < rowLength - 1; i++) {
+            unsigned int corner = j * rowLength + i;
+            indices[n++] = corner;
+            indices[n++] = corner + 1;
+            indices[n++] = corner + rowLength + 1;
+            indices[n++] = corner + rowLength + 1;
+            indices[n++] = corner + rowLength;
+            indices[n++] = corner;
+        }
+    }
+    glGenBuffers(1, &terrain->IBO);
+    StateBindBuffer(GL_ELEMENT_ARRAY_BUFFER, terrain->IBO);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, terrainPatchIndices * sizeof(unsigned int), indices, GL_STATIC_DRAW);
+    free(indices);
+
+    for (int i = 0; i < terrainMaxJobs; i++) {
+        terrain->jobs[i].state = jobFree;
+    }
+    pthread_mutex_init(&terrain->lock, NULL);
+    pthread_cond_init(&terrain->queued, NULL);
+    for (int i = 0; i < terrainWorkers; i++) {
+        if (pthread_create(&terrain->workers[i], NULL, terrainWorker, terrain) != 0) {
+            fprintf(stderr, "Could not start the terrain workers\n");
+            exit(-1);
+        }
+    }
+}
+
+/* Brightness of the texture, flat if it cannot be read */
+static TerrainHeightmap* loadHeightmap(char* filename)
+{
+    TerrainHeightmap* heightmap = malloc(sizeof(TerrainHeightmap));
+    TextureDataPtr texture = malloc(sizeof(*texture));
+    if (!LoadTexture(filename, texture)) {
+        heightmap->width = 1;
+        heightmap->height = 1;
+        heightmap->heights = calloc(1, sizeof(float));
+        free(texture);
+        return heightmap;
+    }
+
+    heightmap->width = texture->width;
+    heightmap->height = texture->height;
+    heightmap->heights = malloc(texture->width * texture->height * sizeof(float));
+    for (int i = 0; i < heightmap->width * heightmap->height; i++) {
+        unsigned char* bgr = &texture->data[i * 3];
+        heightmap->heights[i] = (.0722 * bgr[0] + .7152 * bgr[1] + .2126 * bgr[2]) / 255.;
+    }
+    free(texture->data);
+    free(texture);
+    return heightmap;
+}
+
+/* Slot of the patch, -1 if it is not on the GPU; found patches are
+ * kept for this frame */
+static int findSlot(Terrain* terrain, unsigned long long key)
+{
+    terrainStats.lookups++;
+    for (int i = 0; i < terrainCacheSlots; i++) {
+        if (terrain->slots[i].key == key) {
+            terrain->slots[i].lastUsed = terrain->frame;
+            terrainStats.hits++;
+            return i;
+        }
+    }
+    return -1;
+}
+
+/* Queues the patch for the workers, unless it is already or there is no free job */
+static void requestPatch(Terrain* terrain, int face, int level, int x, int y)
+{
+    unsigned long long key = patchKey(terrain->body, face, level, x, y);
+
+    pthread_mutex_lock(&terrain->lock);
+    TerrainJob* empty = NULL;
+    for (int i = 0; i < terrainMaxJobs; i++) {
+        TerrainJob* job = &terrain->jobs[i];
+        if (job->state != jobFree && job->key == key) {
+            pthread_mutex_unlock(&terrain->lock);
+            return;
+        }
+        if (job->state == jobFree && empty == NULL) {
+            empty = job;
+        }
+    }
+
+    if (empty != NULL) {
+        empty->key = key;
+        empty->face = face;
+        empty->level = level;
+        empty->x = x;
+        empty->y = y;
+        empty->heightmap = terrain->heightmaps[terrain->body];
+        empty->state = jobQueued;
+        pthread_cond_signal(&terrain->queued);
+    }
+    pthread_mutex_unlock(&terrain->lock);
+}
+
+/******************************************************************
+ * uploadPatches
+ * Copies generated patches into the least recently used slots; slots
+ * looked up in this frame are kept, a patch without a slot waits
+ *******************************************************************/
+static void uploadPatches(Terrain* terrain)
+{
+    TerrainJob* done[terrainUploadsPerFrame];
+    int count = 0;
+    pthread_mutex_lock(&terrain->lock);
+    for (int i = 0; i < terrainMaxJobs && count < terrainUploadsPerFrame; i++) {
+        if (terrain->jobs[i].state == jobDone) {
+            done[count++] = &terrain->jobs[i];
+        }
+    }
+    pthread_mutex_unlock(&terrain->lock);
+
+    for (int i = 0; i < count; i++) {
+        TerrainSlot* slot = NULL;
+        for (int j = 0; j < terrainCacheSlots; j++) {
+            TerrainSlot* candidate = &terrain->slots[j];
+            if (candidate->lastUsed < terrain->frame && (slot == NULL || candidate->lastUsed < slot->lastUsed)) {
+                slot = candidate;
+            }
+        }
+        if (slot == NULL) {
+            break;
+        }
+
+        TerrainJob* job = done[i];
+        StateBindBuffer(GL_ARRAY_BUFFER, slot->VBO);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(job->positions), job->positions);
+        StateBindBuffer(GL_ARRAY_BUFFER, slot->NBO);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(job->normals), job->normals);
+        StateBindBuffer(GL_ARRAY_BUFFER, slot->UVBO);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(job->uvs), job->uvs);
+        slot->key = job->key;
+        slot->lastUsed = terrain->frame;
+
+        pthread_mutex_lock(&terrain->lock);
+        job->state = jobFree;
+        pthread_mutex_unlock(&terrain->lock);
+    }
+}
+
+/* Camera and frustum of a frame, in the object space of the body */
+typedef struct terrainView {
+    float eye[3];
+    float* transformation;
+    float scale;
+    Frustum* frustum;
+    float projectedScale;
+} TerrainView;
+
+/* Center of the patch on the sphere and the radius around it */
+static void patchBounds(int face, int level, int x, int y, float* center, float* radius)
+{
+    float size = 2. / (1 << level);
+    float u0 = -1. + x * size;
+    float v0 = -1. + y * size;
+    facePoint(face, u0 + size / 2., v0 + size / 2., center);
+
+    *radius = 0;
+    for (int i = 0; i < 4; i++) {
+        float corner[3];
+        facePoint(face, u0 + (i % 2) * size, v0 + (i / 2) * size, corner);
+        float distance = sqrtf((corner[0] - center[0]) * (corner[0] - center[0])
+                + (corner[1] - center[1]) * (corner[1] - center[1])
+                + (corner[2] - center[2]) * (corner[2] - center[2]));
+        *radius = fmaxf(*radius, distance);
+    }
+    *radius += terrainHeightScale;
+}
+
+/* Whether a part of the patch is in front of the horizon and inside
+ * of the frustum. The unit sphere hides a point of height R from an
+ * eye at distance d once their angle exceeds acos(1/d) + acos(1/R);
+ * the patch is tested with its highest terrain and nearest point */
+static int patchVisible(TerrainView* view, float* center, float radius)
+{
+    float eyeDistance = sqrtf(view->eye[0] * view->eye[0] + view->eye[1] * view->eye[1] + view->eye[2] * view->eye[2]);
+    float cosine = (center[0] * view->eye[0] + center[1] * view->eye[1] + center[2] * view->eye[2]) / eyeDistance;
+    float angle = acosf(clamp(cosine, 1., -1.)) - 2. * asinf(fminf(radius / 2., 1.));
+    float horizon = acosf(fminf(1. / eyeDistance, 1.)) + acosf(1. / (1. + terrainHeightScale));
+    if (angle > horizon) {
+        return 0;
+    }
+
+    float* m = view->transformation;
+    float world[3];
+    for (int i = 0; i < 3; i++) {
+        world[i] = m[i * 4] * center[0] + m[i * 4 + 1] * center[1] + m[i * 4 + 2] * center[2] + m[i * 4 + 3];
+    }
+    for (int i = 0; i < 6; i++) {
+        float* plane = view->frustum->planes[i];
+        if (plane[0] * world[0] + plane[1] * world[1] + plane[2] * world[2] + plane[3] < -radius * view->scale) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* Error of the patch on screen: the heights it leaves out, halved by
+ * every level, and how far its cells are from the sphere */
+static float patchPixelError(TerrainView* view, int level, float* center, float radius)
+{
+    float cellAngle = M_PI / 2. / (terrainPatchSize << level);
+    float error = terrainHeightScale / (1 << level) + (1. - cosf(cellAngle / 2.));
+
+    float distance = sqrtf((center[0] - view->eye[0]) * (center[0] - view->eye[0])
+            + (center[1] - view->eye[1]) * (center[1] - view->eye[1])
+            + (center[2] - view->eye[2]) * (center[2] - view->eye[2])) - radius;
+    return error * view->projectedScale / fmaxf(distance, 1e-3);
+}
+
+static void selectPatches(Terrain* terrain, TerrainView* view, int face, int level, int x, int y)
+{
+    float center[3], radius;
+    patchBounds(face, level, x, y, center, &radius);
+    if (!patchVisible(view, center, radius)) {
+        return;
+    }
+
+    // looked up even if its children are drawn, so it is kept to stand
+    // in for them once they are evicted
+    int slot = findSlot(terrain, patchKey(terrain->body, face, level, x, y));
+    if (slot < 0) {
+        requestPatch(terrain, face, level, x, y);
+        terrain->complete = 0;
+        return;
+    }
+
+    // refine only once all visible children are there, until then this
+    // patch stands in; the hidden ones are neither loaded nor waited for
+    if (level < terrainMaxLevel && patchPixelError(view, level, center, radius) > terrainPixelError) {
+        int resident = 1, visible[4];
+        for (int i = 0; i < 4; i++) {
+            int childX = 2 * x + i % 2, childY = 2 * y + i / 2;
+            float childCenter[3], childRadius;
+            patchBounds(face, level + 1, childX, childY, childCenter, &childRadius);
+            visible[i] = patchVisible(view, childCenter, childRadius);
+            if (visible[i] && findSlot(terrain, patchKey(terrain->body, face, level + 1, childX, childY)) < 0) {
+                requestPatch(terrain, face, level + 1, childX, childY);
+                resident = 0;
+            }
+        }
+        if (resident) {
+            for (int i = 0; i < 4; i++) {
+                if (visible[i]) {
+                    selectPatches(terrain, view, face, level + 1, 2 * x + i % 2, 2 * y + i / 2);
+                }
+            }
+            return;
+        }
+    }
+
+    terrain->visible[terrain->visibleCount++] = slot;
+}
+
+/******************************************************************
+ * UpdateTerrain
+ * Uploads the patches the workers finished, and selects the patches
+ * of the body to draw this frame into visible; missing ones are
+ * requested. eye is in world space. Returns 0 if the surface is not
+ * complete yet, the body has to be drawn as before
+ *******************************************************************/
+int UpdateTerrain(Terrain* terrain, int body, char* heightmapFilename, float* transformation,
+        float* eye, Frustum* frustum, float projectedScale)
+{
+    if (body >= terrainMaxBodies) {
+        return 0;
+    }
+    terrain->frame++;
+    terrain->body = body;
+    if (terrain->heightmaps[body] == NULL) {
+        terrain->heightmaps[body] = loadHeightmap(heightmapFilename);
+    }
+
+    uploadPatches(terrain);
+
+    float inverse[16];
+    if (!InvertMatrix(transformation, inverse)) {
+        return 0;
+    }
+    TerrainView view = {
+        .transformation = transformation,
+        .scale = sqrtf(transformation[0] * transformation[0] + transformation[4] * transformation[4]
+                + transformation[8] * transformation[8]),
+        .frustum = frustum,
+        .projectedScale = projectedScale,
+    };
+    for (int i = 0; i < 3; i++) {
+        view.eye[i] = inverse[i * 4] * eye[0] + inverse[i * 4 + 1] * eye[1] + inverse[i * 4 + 2] * eye[2]
+            + inverse[i * 4 + 3];
+    }
+
+    terrain->visibleCount = 0;
+    terrain->complete = 1;
+    for (int face = 0; face < 6; face++) {
+        selectPatches(terrain, &view, face, 0, 0, 0);
+    }
+
+    terrainStats.patches = terrain->complete ? terrain->visibleCount : 0;
+    terrainStats.resident = 0;
+    for (int i = 0; i < terrainCacheSlots; i++) {
+        terrainStats.resident += terrain->slots[i].key != 0;
+    }
+    return terrain->complete;
+}
+
+void PrintTerrainStats(Terrain* terrain)
+{
+    // the workers add to the generation statistics
+    pthread_mutex_lock(&terrain->lock);
+    int generated = terrainStats.generated;
+    double generationTime = terrainStats.generationTime;
+    pthread_mutex_unlock(&terrain->lock);
+
+    printf("terrain: %d patches drawn, %d of %d cache slots used, %.1f%% cache hits\n",
+            terrainStats.patches, terrainStats.resident, terrainCacheSlots,
+            terrainStats.lookups > 0 ? 100. * terrainStats.hits / terrainStats.lookups : 0.);
+    printf("terrain: %d patches generated, %.3f ms each\n", generated,
+            generated > 0 ? generationTime / generated : 0.);
+}
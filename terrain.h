@@ -0,0 +1,101 @@
+#ifndef SOLAR_SYSTEM_TERRAIN
+#define SOLAR_SYSTEM_TERRAIN
+
+#include "pthread.h"
+
+#include "culling.h"
+
+/* Terrain of the planet the camera follows, close up: the unit sphere
+ * is a cube whose faces are split into quadtrees of patches, refined
+ * until the error of a patch is below terrainPixelError pixels on
+ * screen. Patches are generated by worker threads from a heightmap (the
+ * brightness of the planet's texture), and kept in a fixed number of
+ * cache slots on the GPU; a patch whose children are not there yet is
+ * drawn until they are */
+
+#define terrainPatchSize 32 // grid cells along the edge of a patch
+// vertices of a patch, with a skirt around it hiding the cracks to coarser neighbours
+#define terrainPatchVertices ((terrainPatchSize + 3) * (terrainPatchSize + 3))
+#define terrainPatchIndices ((terrainPatchSize + 2) * (terrainPatchSize + 2) * 6)
+
+#define terrainMaxLevel 6
+#define terrainPixelError 2.
+#define terrainHeightScale .02 // height of white in the heightmap, relative to the radius
+#define terrainSkirtDepth .02
+
+#define terrainCacheSlots 256
+#define terrainMaxJobs 32
+#define terrainWorkers 2
+#define terrainUploadsPerFrame 8
+#define terrainMaxBodies 16
+
+/* Brightness of a texture, read by the workers */
+typedef struct terrainHeightmap {
+    float* heights;
+    int width;
+    int height;
+} TerrainHeightmap;
+
+/* Patch on the GPU; key is 0 while the slot is free */
+typedef struct terrainSlot {
+    unsigned long long key;
+    int lastUsed; // frame the patch was last looked up
+    GLuint VBO; // vertex buffer object
+    GLuint NBO; // normal buffer object
+    GLuint UVBO; // uv buffer object
+} TerrainSlot;
+
+enum TerrainJobState {jobFree, jobQueued, jobRunning, jobDone};
+
+/* Patch generated by a worker; the state is guarded by the lock, the
+ * rest belongs to whoever moved it into its current state */
+typedef struct terrainJob {
+    int state;
+    unsigned long long key;
+    int face;
+    int level;
+    int x;
+    int y;
+    TerrainHeightmap* heightmap;
+
+    float positions[terrainPatchVertices * 3];
+    float normals[terrainPatchVertices * 3];
+    float uvs[terrainPatchVertices * 2];
+} TerrainJob;
+
+typedef struct terrain {
+    TerrainHeightmap* heightmaps[terrainMaxBodies]; // loaded once the body is followed
+    int body;
+
+    TerrainSlot slots[terrainCacheSlots];
+    int frame;
+    GLuint CBO; // white, shared by all patches
+    GLuint IBO; // shared by all patches
+
+    TerrainJob jobs[terrainMaxJobs];
+    pthread_mutex_t lock;
+    pthread_cond_t queued;
+    pthread_t workers[terrainWorkers];
+
+    int visible[terrainCacheSlots]; // slots of the patches to draw this frame
+    int visibleCount;
+    int complete; // 0 while a part of the surface has no patch yet
+} Terrain;
+
+typedef struct terrainStats {
+    int patches; // drawn, last frame
+    int resident; // slots holding a patch
+    int lookups; // since the start
+    int hits;
+    int generated; // written by the workers, under the lock
+    double generationTime; // milliseconds, sum over all generated patches
+} TerrainStats;
+
+extern TerrainStats terrainStats;
+
+void InitTerrain(Terrain* terrain);
+int UpdateTerrain(Terrain* terrain, int body, char* heightmapFilename, float* transformation,
+        float* eye, Frustum* frustum, float projectedScale);
+void PrintTerrainStats(Terrain* terrain);
+
+#endif
@@ -0,0 +1,135 @@
+#include "stdio.h"
+#include "GL/glew.h"
+
+#if defined(__SSE__)
+#include <xmmintrin.h>
+#endif
+
+#include "source/Matrix.h"
+#include "utils.h"
+#include "transforms.h"
+
+TransformStats transformStats;
+
+/******************************************************************
+ * multiplyBoth
+ * Computes a * model and b * model at once. Row i of a product is the
+ * sum of the rows of model weighted by row i of the left matrix, so
+ * with SSE every row is built from the same four loaded model rows
+ *******************************************************************/
+static void multiplyBoth(float* a, float* b, float* model, float* resultA, float* resultB)
+{
+#if defined(__SSE__)
+    __m128 rows[4];
+    for (int k = 0; k < 4; k++) {
+        rows[k] = _mm_loadu_ps(model + 4*k);
+    }
+
+    for (int i = 0; i < 4; i++) {
+        __m128 rowA = _mm_mul_ps(_mm_set1_ps(a[4*i]), rows[0]);
+        __m128 rowB = _mm_mul_ps(_mm_set1_ps(b[4*i]), rows[0]);
+        for (int k = 1; k < 4; k++) {
+            rowA = _mm_add_ps(rowA, _mm_mul_ps(_mm_set1_ps(a[4*i + k]), rows[k]));
+            rowB = _mm_add_ps(rowB, _mm_mul_ps(_mm_set1_ps(b[4*i + k]), rows[k]));
+        }
+        _mm_storeu_ps(resultA + 4*i, rowA);
+        _mm_storeu_ps(resultB + 4*i, rowB);
+    }
+#else
+    MultiplyMatrix(a, model, resultA);
+    MultiplyMatrix(b, model, resultB);
+#endif
+}
+
+/* Inverse transpose of the upper 3x3 part of m: the cofactor matrix
+ * divided by the determinant */
+static void normalMatrix(float* m, float* result)
+{
+    float cofactor[9] = {
+        m[5]*m[10] - m[6]*m[9], m[6]*m[8] - m[4]*m[10], m[4]*m[9] - m[5]*m[8],
+        m[2]*m[9] - m[1]*m[10], m[0]*m[10] - m[2]*m[8], m[1]*m[8] - m[0]*m[9],
+        m[1]*m[6] - m[2]*m[5], m[2]*m[4] - m[0]*m[6], m[0]*m[5] - m[1]*m[4],
+    };
+    float determinant = m[0]*cofactor[0] + m[1]*cofactor[1] + m[2]*cofactor[2];
+
+    for (int i = 0; i < 9; i++) {
+        result[i] = cofactor[i] / determinant;
+    }
+}
+
+#if defined(__SSE__)
+/* elements of the upper 3x3 part of a row major 4x4 matrix */
+static const int upper[9] = {0, 1, 2, 4, 5, 6, 8, 9, 10};
+
+/******************************************************************
+ * normalMatrices4
+ * normalMatrix for four objects at once: their upper 3x3 parts are
+ * transposed into structure of arrays, one register per element
+ *******************************************************************/
+static void normalMatrices4(ObjectMatrices* objects)
+{
+    __m128 m[9];
+    for (int e = 0; e < 9; e++) {
+        m[e] = _mm_setr_ps(objects[0].modelView[upper[e]], objects[1].modelView[upper[e]],
+                objects[2].modelView[upper[e]], objects[3].modelView[upper[e]]);
+    }
+
+#define cross(a, b, c, d) _mm_sub_ps(_mm_mul_ps(m[a], m[b]), _mm_mul_ps(m[c], m[d]))
+    __m128 cofactor[9] = {
+        cross(4, 8, 5, 7), cross(5, 6, 3, 8), cross(3, 7, 4, 6),
+        cross(2, 7, 1, 8), cross(0, 8, 2, 6), cross(1, 6, 0, 7),
+        cross(1, 5, 2, 4), cross(2, 3, 0, 5), cross(0, 4, 1, 3),
+    };
+#undef cross
+    __m128 determinant = _mm_add_ps(_mm_mul_ps(m[0], cofactor[0]),
+            _mm_add_ps(_mm_mul_ps(m[1], cofactor[1]), _mm_mul_ps(m[2], cofactor[2])));
+    __m128 inverse = _mm_div_ps(_mm_set1_ps(1.), determinant);
+
+    for (int e = 0; e < 9; e++) {
+        float values[4];
+        _mm_storeu_ps(values, _mm_mul_ps(cofactor[e], inverse));
+        for (int k = 0; k < 4; k++) {
+            objects[k].normal[e] = values[k];
+        }
+    }
+}
+#endif
+
+/******************************************************************
+ * ComputeObjectMatrices
+ * Computes the model view, model view projection and normal matrices
+ * of count objects with the given transformations, in one pass over
+ * all of them: the view projection matrix is shared, and the normal
+ * matrices are computed for 4 objects per iteration with SSE
+ *******************************************************************/
+void ComputeObjectMatrices(float* viewMatrix, float* projectionMatrix,
+        float** transformations, ObjectMatrices* result, int count)
+{
+    double start = milliseconds();
+
+    float viewProjection[16];
+    MultiplyMatrix(projectionMatrix, viewMatrix, viewProjection);
+
+    for (int i = 0; i < count; i++) {
+        multiplyBoth(viewMatrix, viewProjection, transformations[i],
+                result[i].modelView, result[i].modelViewProjection);
+    }
+
+    int i = 0;
+#if defined(__SSE__)
+    for (; i + 4 <= count; i += 4) {
+        normalMatrices4(result + i);
+    }
+#endif
+    for (; i < count; i++) {
+        normalMatrix(result[i].modelView, result[i].normal);
+    }
+
+    transformStats.objects = count;
+    transformStats.time = milliseconds() - start;
+}
+
+void PrintTransformStats()
+{
+    printf("object matrices: %d objects, %.3f ms\n", transformStats.objects, transformStats.time);
+}
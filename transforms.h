@@ -0,0 +1,24 @@
+#ifndef SOLAR_SYSTEM_TRANSFORMS
+#define SOLAR_SYSTEM_TRANSFORMS
+
+/* Matrices of one object for the current camera, computed once per
+ * frame on the CPU so the vertex shaders only transform vertices.
+ * All of them are row major, like the matrices of source/Matrix.h */
+typedef struct objectMatrices {
+    float modelView[16];
+    float modelViewProjection[16];
+    float normal[9]; // inverse transpose of the upper 3x3 part of modelView
+} ObjectMatrices;
+
+typedef struct transformStats {
+    int objects; // matrices computed in the last frame
+    double time; // milliseconds
+} TransformStats;
+
+extern TransformStats transformStats;
+
+void ComputeObjectMatrices(float* viewMatrix, float* projectionMatrix,
+        float** transformations, ObjectMatrices* result, int count);
+void PrintTransformStats();
+
+#endif
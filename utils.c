@@ -1,6 +1,10 @@
+#define _POSIX_C_SOURCE 199309L // clock_gettime
+
 #include "stdio.h"
+#include "string.h"
 #include "GL/glew.h"
 #include "math.h"
+#include "time.h"
 
 #include "source/LoadShader.h"    /* Loading function for shader code */
 #include "source/Matrix.h"        /* Functions for matrix handling */
@@ -8,8 +12,9 @@
 #include "source/LoadTexture.h"   /* Loading function for BMP texture */
 
 #include "solarsystem.h"
+#include "glstate.h"
 
-void createCubeMesh(GLuint* VBO, GLuint* CBO, GLuint* IBO)
+int createCubeMesh(GLuint* VBO, GLuint* CBO, GLuint* IBO)
 {
     GLfloat vertex_buffer_data[] = { /* 8 cube vertices XYZ */
         -1.0, -1.0,  1.0,
@@ -59,6 +64,8 @@ void createCubeMesh(GLuint* VBO, GLuint* CBO, GLuint* IBO)
     glGenBuffers(1, CBO);
     glBindBuffer(GL_ARRAY_BUFFER, *CBO);
     glBufferData(GL_ARRAY_BUFFER, sizeof(color_buffer_data), color_buffer_data, GL_STATIC_DRAW);
+
+    return sizeof(index_buffer_data)/sizeof(unsigned int);
 }
 
 /******************************************************************
@@ -73,10 +80,12 @@ void createCubeMesh(GLuint* VBO, GLuint* CBO, GLuint* IBO)
 *         UVBO = pointer to the UVcoords buffer object to fill
 *         IBO = pointer to the Index buffer object to fill
 *         rgb = 3D vector containing the color of the object (r=x, g=y, b=z)
+*         boundingSphere = center (xyz) and radius enclosing the quad
+* Output: number of indices in the IBO
 *******************************************************************/
 
 
-void createQuadMesh(GLuint* VBO, GLuint* CBO, GLuint* NBO, GLuint* UVBO, GLuint* IBO, float* rgb)
+int createQuadMesh(GLuint* VBO, GLuint* CBO, GLuint* NBO, GLuint* UVBO, GLuint* IBO, float* rgb, float* boundingSphere)
 {
     GLfloat vertex_buffer_data[] = { /* 8 cube vertices XYZ -> size and alignment/position*/
             -1.5, -1.,  -1.5,
@@ -130,217 +139,274 @@ void createQuadMesh(GLuint* VBO, GLuint* CBO, GLuint* NBO, GLuint* UVBO, GLuint*
     glGenBuffers(1, IBO);
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, *IBO);
     glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(index_buffer_data), index_buffer_data, GL_STATIC_DRAW);
+
+    // the quad is centered on the origin
+    boundingSphere[0] = 0.;
+    boundingSphere[1] = 0.;
+    boundingSphere[2] = 0.;
+    boundingSphere[3] = sqrtf(1.5*1.5 + 1. + 1.5*1.5);
+
+    return sizeof(index_buffer_data)/sizeof(unsigned int);
 }
 
-/***************************************************************
-* Create cube mesh with inwards facing faces
-***************************************************************/
+/******************************************************************
+*
+* createSpriteMesh
+*
+* This function creates a quad from -1 to 1 in x and y, whose corners
+* are placed by the vertex shader, e.g. the ray cast spheres of phong.vs
+*
+* Input : VBO = pointer to the Vertex buffer object to fill
+*         CBO = pointer to the Color buffer object to fill
+*         IBO = pointer to the Index buffer object to fill
+* Output: number of indices in the IBO
+*******************************************************************/
+int createSpriteMesh(GLuint* VBO, GLuint* CBO, GLuint* IBO)
+{
+    GLfloat vertex_buffer_data[] = { /* 4 corners XYZ */
+        -1.0, -1.0, 0.0,
+         1.0, -1.0, 0.0,
+         1.0,  1.0, 0.0,
+        -1.0,  1.0, 0.0,
+    };
 
-void createCube(GLuint* VBO, GLuint* VAO) {
-    float points[] = {
-            -10.0f,  10.0f, -10.0f,
-            -10.0f, -10.0f, -10.0f,
-            10.0f, -10.0f, -10.0f,
-            10.0f, -10.0f, -10.0f,
-            10.0f,  10.0f, -10.0f,
-            -10.0f,  10.0f, -10.0f,
-
-            -10.0f, -10.0f,  10.0f,
-            -10.0f, -10.0f, -10.0f,
-            -10.0f,  10.0f, -10.0f,
-            -10.0f,  10.0f, -10.0f,
-            -10.0f,  10.0f,  10.0f,
-            -10.0f, -10.0f,  10.0f,
-
-            10.0f, -10.0f, -10.0f,
-            10.0f, -10.0f,  10.0f,
-            10.0f,  10.0f,  10.0f,
-            10.0f,  10.0f,  10.0f,
-            10.0f,  10.0f, -10.0f,
-            10.0f, -10.0f, -10.0f,
-
-            -10.0f, -10.0f,  10.0f,
-            -10.0f,  10.0f,  10.0f,
-            10.0f,  10.0f,  10.0f,
-            10.0f,  10.0f,  10.0f,
-            10.0f, -10.0f,  10.0f,
-            -10.0f, -10.0f,  10.0f,
-
-            -10.0f,  10.0f, -10.0f,
-            10.0f,  10.0f, -10.0f,
-            10.0f,  10.0f,  10.0f,
-            10.0f,  10.0f,  10.0f,
-            -10.0f,  10.0f,  10.0f,
-            -10.0f,  10.0f, -10.0f,
-
-            -10.0f, -10.0f, -10.0f,
-            -10.0f, -10.0f,  10.0f,
-            10.0f, -10.0f, -10.0f,
-            10.0f, -10.0f, -10.0f,
-            -10.0f, -10.0f,  10.0f,
-            10.0f, -10.0f,  10.0f
+    GLfloat color_buffer_data[] = { /* RGB values for 4 vertices */
+        1.0, 1.0, 1.0,
+        1.0, 1.0, 1.0,
+        1.0, 1.0, 1.0,
+        1.0, 1.0, 1.0,
+    };
+
+    unsigned int index_buffer_data[] = { /* Indices of 2 triangles */
+        0, 1, 2,
+        2, 3, 0,
     };
 
     glGenBuffers(1, VBO);
     glBindBuffer(GL_ARRAY_BUFFER, *VBO);
-    glBufferData(GL_ARRAY_BUFFER, 3 * 36 * sizeof(float), &points, GL_STATIC_DRAW);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(vertex_buffer_data), vertex_buffer_data, GL_STATIC_DRAW);
 
-    glGenVertexArrays(1, VAO);
-    glBindVertexArray(*VAO);
-    glEnableVertexAttribArray(0);
-    glBindBuffer(GL_ARRAY_BUFFER, *VBO);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, NULL);
+    glGenBuffers(1, IBO);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, *IBO);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(index_buffer_data), index_buffer_data, GL_STATIC_DRAW);
+
+    glGenBuffers(1, CBO);
+    glBindBuffer(GL_ARRAY_BUFFER, *CBO);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(color_buffer_data), color_buffer_data, GL_STATIC_DRAW);
+
+    return sizeof(index_buffer_data)/sizeof(unsigned int);
 }
 
 /******************************************************************
 *
-* readMeshFile
+* readMeshFiles
 *
-* This function read the content of an OBJ file and then fill the
-* buffer objects with the data
+* Reads several meshes which always move together, like readMeshFile:
+* all files are merged into one set of buffer objects, the indices of
+* every file following the ones of the file before it
 *
-* Input : filename = name of file.obj
-*         scale = scale factor applied to the vertices
-*         VBO = pointer to the Vertex buffer object to fill
-*         CBO = pointer to the Color buffer object to fill
-*         NBO = pointer to the Normal buffer object to fill
-*         UVBO = pointer to the UVcoords buffer object to fill
-*         IBO = pointer to the Index buffer object to fill
-*         rgb = 3D vector containing the color of the object (r=x, g=y, b=z)
+* Input : filenames = names of the files.obj, count of them
+*         indexCounts = filled with the number of indices of every file,
+*                       may be NULL
+*         boundingSphere = encloses the meshes of all files
+*         the others like readMeshFile, below
+* Output: number of indices in the IBO
 *******************************************************************/
-void readMeshFile(char* filename, float scale, GLuint* VBO, GLuint* CBO, GLuint* NBO, GLuint* UVBO, GLuint* IBO, float* rgb)
+int readMeshFiles(char** filenames, int count, float scale, GLuint* VBO, GLuint* CBO, GLuint* NBO, GLuint* UVBO,
+        GLuint* IBO, float* rgb, float* boundingSphere, GLsizei* indexCounts)
 {
-    int i;
+    int i, file, face;
 
-    /* Structure for loading of OBJ data */
-    obj_scene_data data;
+    /* Structure for loading of OBJ data, one per file */
+    obj_scene_data* data = malloc(count * sizeof(obj_scene_data));
 
-    /* Load first OBJ model */
-    int success = parse_obj_scene(&data, filename);
+    int indx = 0;
+    for (file = 0; file < count; file++) {
+        int success = parse_obj_scene(&data[file], filenames[file]);
 
-    if(!success)
-        printf("Could not load file. Exiting.\n");
+        if(!success)
+            printf("Could not load file. Exiting.\n");
 
-    /*  Copy mesh data from structs into appropriate arrays */
-    int indx = data.face_count;
+        indx += data[file].face_count;
+    }
 
+    /*  Copy mesh data from structs into appropriate arrays */
     unsigned int* index_buffer_data = (unsigned int*) calloc (indx*3, sizeof(unsigned int));
     GLfloat* vertex_buffer_data = (GLfloat*) calloc (indx*9, sizeof(GLfloat));
     GLfloat* normal_buffer_data = (GLfloat*) calloc (indx*9, sizeof(GLfloat));
     GLfloat* color_buffer_data = (GLfloat*) calloc (indx*9, sizeof(GLfloat));
     GLfloat* uv_buffer_data = (GLfloat*) calloc (indx*6, sizeof(GLfloat));
 
-    /* for each triangle... */
-    for(i=0; i<indx; i++)
-    {
-        int offset = i*9;
-        int offset3D = i*9;
-        int offset2D = i*6;
-
-        /* indices of 3 Vertices of the triangle */
-        int idVert1 = (GLushort)(*data.face_list[i]).vertex_index[0];
-        int idVert2  = (GLushort)(*data.face_list[i]).vertex_index[1];
-        int idVert3  = (GLushort)(*data.face_list[i]).vertex_index[2];
-        /* fill VBO for this triangle (x,y,z coords for 3 vertices = 9 values) */
-        vertex_buffer_data[offset3D] = (GLfloat)(*data.vertex_list[idVert1]).e[0]*scale;
-        vertex_buffer_data[offset3D+1] = (GLfloat)(*data.vertex_list[idVert1]).e[1]*scale;
-        vertex_buffer_data[offset3D+2] = (GLfloat)(*data.vertex_list[idVert1]).e[2]*scale;
-        vertex_buffer_data[offset3D+3] = (GLfloat)(*data.vertex_list[idVert2]).e[0]*scale;
-        vertex_buffer_data[offset3D+4] = (GLfloat)(*data.vertex_list[idVert2]).e[1]*scale;
-        vertex_buffer_data[offset3D+5] = (GLfloat)(*data.vertex_list[idVert2]).e[2]*scale;
-        vertex_buffer_data[offset3D+6] = (GLfloat)(*data.vertex_list[idVert3]).e[0]*scale;
-        vertex_buffer_data[offset3D+7] = (GLfloat)(*data.vertex_list[idVert3]).e[1]*scale;
-        vertex_buffer_data[offset3D+8] = (GLfloat)(*data.vertex_list[idVert3]).e[2]*scale;
-
-        /* Normals */
-        int idNorm1 = (GLushort)(*data.face_list[i]).normal_index[0];
-        int idNorm2  = (GLushort)(*data.face_list[i]).normal_index[1];
-        int idNorm3  = (GLushort)(*data.face_list[i]).normal_index[2];
-        /* fill NBO for this triangle */
-        if(  (*data.face_list[i]).normal_index[0] != -1 )
-        {
-            normal_buffer_data[offset3D] = (GLfloat)(*data.vertex_normal_list[idNorm1]).e[0];
-            normal_buffer_data[offset3D+1] = (GLfloat)(*data.vertex_normal_list[idNorm1]).e[1];
-            normal_buffer_data[offset3D+2] = (GLfloat)(*data.vertex_normal_list[idNorm1]).e[2];
-            normal_buffer_data[offset3D+3] = (GLfloat)(*data.vertex_normal_list[idNorm2]).e[0];
-            normal_buffer_data[offset3D+4] = (GLfloat)(*data.vertex_normal_list[idNorm2]).e[1];
-            normal_buffer_data[offset3D+5] = (GLfloat)(*data.vertex_normal_list[idNorm2]).e[2];
-            normal_buffer_data[offset3D+6] = (GLfloat)(*data.vertex_normal_list[idNorm3]).e[0];
-            normal_buffer_data[offset3D+7] = (GLfloat)(*data.vertex_normal_list[idNorm3]).e[1];
-            normal_buffer_data[offset3D+8] = (GLfloat)(*data.vertex_normal_list[idNorm3]).e[2];
-        }
-        else
-        {
-            normal_buffer_data[offset3D] = vertex_buffer_data[offset];
-            normal_buffer_data[offset3D+1] = vertex_buffer_data[offset3D+1];
-            normal_buffer_data[offset3D+2] = vertex_buffer_data[offset3D+2];
-            normal_buffer_data[offset3D+3] = vertex_buffer_data[offset3D+3];
-            normal_buffer_data[offset3D+4] = vertex_buffer_data[offset3D+4];
-            normal_buffer_data[offset3D+5] = vertex_buffer_data[offset3D+5];
-            normal_buffer_data[offset3D+6] = vertex_buffer_data[offset3D+6];
-            normal_buffer_data[offset3D+7] = vertex_buffer_data[offset3D+7];
-            normal_buffer_data[offset3D+8] = vertex_buffer_data[offset3D+8];
-        }
+    float lower[3], upper[3]; // bounding box of all files
+    int first = 0; // first triangle of the file
+    for (file = 0; file < count; file++) {
+        obj_scene_data* mesh = &data[file];
 
-        /* fill UV buffer for this triangle */
-        if( (*data.face_list[i]).texture_index[0] != -1 )
+        /* for each triangle... */
+        for(face=0; face<mesh->face_count; face++)
         {
-            int j;
-            for(j=0; j<3; j++)
+            int i = first + face;
+            int offset = i*9;
+            int offset3D = i*9;
+            int offset2D = i*6;
+
+            /* indices of 3 Vertices of the triangle */
+            int idVert1 = (GLushort)(*mesh->face_list[face]).vertex_index[0];
+            int idVert2  = (GLushort)(*mesh->face_list[face]).vertex_index[1];
+            int idVert3  = (GLushort)(*mesh->face_list[face]).vertex_index[2];
+            /* fill VBO for this triangle (x,y,z coords for 3 vertices = 9 values) */
+            vertex_buffer_data[offset3D] = (GLfloat)(*mesh->vertex_list[idVert1]).e[0]*scale;
+            vertex_buffer_data[offset3D+1] = (GLfloat)(*mesh->vertex_list[idVert1]).e[1]*scale;
+            vertex_buffer_data[offset3D+2] = (GLfloat)(*mesh->vertex_list[idVert1]).e[2]*scale;
+            vertex_buffer_data[offset3D+3] = (GLfloat)(*mesh->vertex_list[idVert2]).e[0]*scale;
+            vertex_buffer_data[offset3D+4] = (GLfloat)(*mesh->vertex_list[idVert2]).e[1]*scale;
+            vertex_buffer_data[offset3D+5] = (GLfloat)(*mesh->vertex_list[idVert2]).e[2]*scale;
+            vertex_buffer_data[offset3D+6] = (GLfloat)(*mesh->vertex_list[idVert3]).e[0]*scale;
+            vertex_buffer_data[offset3D+7] = (GLfloat)(*mesh->vertex_list[idVert3]).e[1]*scale;
+            vertex_buffer_data[offset3D+8] = (GLfloat)(*mesh->vertex_list[idVert3]).e[2]*scale;
+
+            /* Normals */
+            int idNorm1 = (GLushort)(*mesh->face_list[face]).normal_index[0];
+            int idNorm2  = (GLushort)(*mesh->face_list[face]).normal_index[1];
+            int idNorm3  = (GLushort)(*mesh->face_list[face]).normal_index[2];
+            /* fill NBO for this triangle */
+            if(  (*mesh->face_list[face]).normal_index[0] != -1 )
+            {
+                normal_buffer_data[offset3D] = (GLfloat)(*mesh->vertex_normal_list[idNorm1]).e[0];
+                normal_buffer_data[offset3D+1] = (GLfloat)(*mesh->vertex_normal_list[idNorm1]).e[1];
+                normal_buffer_data[offset3D+2] = (GLfloat)(*mesh->vertex_normal_list[idNorm1]).e[2];
+                normal_buffer_data[offset3D+3] = (GLfloat)(*mesh->vertex_normal_list[idNorm2]).e[0];
+                normal_buffer_data[offset3D+4] = (GLfloat)(*mesh->vertex_normal_list[idNorm2]).e[1];
+                normal_buffer_data[offset3D+5] = (GLfloat)(*mesh->vertex_normal_list[idNorm2]).e[2];
+                normal_buffer_data[offset3D+6] = (GLfloat)(*mesh->vertex_normal_list[idNorm3]).e[0];
+                normal_buffer_data[offset3D+7] = (GLfloat)(*mesh->vertex_normal_list[idNorm3]).e[1];
+                normal_buffer_data[offset3D+8] = (GLfloat)(*mesh->vertex_normal_list[idNorm3]).e[2];
+            }
+            else
+            {
+                normal_buffer_data[offset3D] = vertex_buffer_data[offset];
+                normal_buffer_data[offset3D+1] = vertex_buffer_data[offset3D+1];
+                normal_buffer_data[offset3D+2] = vertex_buffer_data[offset3D+2];
+                normal_buffer_data[offset3D+3] = vertex_buffer_data[offset3D+3];
+                normal_buffer_data[offset3D+4] = vertex_buffer_data[offset3D+4];
+                normal_buffer_data[offset3D+5] = vertex_buffer_data[offset3D+5];
+                normal_buffer_data[offset3D+6] = vertex_buffer_data[offset3D+6];
+                normal_buffer_data[offset3D+7] = vertex_buffer_data[offset3D+7];
+                normal_buffer_data[offset3D+8] = vertex_buffer_data[offset3D+8];
+            }
+
+            /* fill UV buffer for this triangle */
+            if( (*mesh->face_list[face]).texture_index[0] != -1 )
             {
-                int idUV = (GLushort)(*data.face_list[i]).texture_index[j];
-                uv_buffer_data[offset2D + j*2 ] = (GLfloat)(*data.vertex_texture_list[idUV]).e[0];
-                uv_buffer_data[offset2D + j*2 + 1] = (GLfloat)(*data.vertex_texture_list[idUV]).e[1];
+                int j;
+                for(j=0; j<3; j++)
+                {
+                    int idUV = (GLushort)(*mesh->face_list[face]).texture_index[j];
+                    uv_buffer_data[offset2D + j*2 ] = (GLfloat)(*mesh->vertex_texture_list[idUV]).e[0];
+                    uv_buffer_data[offset2D + j*2 + 1] = (GLfloat)(*mesh->vertex_texture_list[idUV]).e[1];
+                }
             }
+
+            /* fill CBO for this triangle */
+            color_buffer_data[offset3D] = (GLfloat)(rgb[0]);
+            color_buffer_data[offset3D+1] = (GLfloat)(rgb[1]);
+            color_buffer_data[offset3D+2] = (GLfloat)(rgb[2]);
+            color_buffer_data[offset3D+3] = (GLfloat)(rgb[0]);
+            color_buffer_data[offset3D+4] = (GLfloat)(rgb[1]);
+            color_buffer_data[offset3D+5] = (GLfloat)(rgb[2]);
+            color_buffer_data[offset3D+6] = (GLfloat)(rgb[0]);
+            color_buffer_data[offset3D+7] = (GLfloat)(rgb[1]);
+            color_buffer_data[offset3D+8] = (GLfloat)(rgb[2]);
+
+            /* Fill indices buffer for this triangles (3 indices) */
+            index_buffer_data[i*3] = (unsigned int) i*3;
+            index_buffer_data[i*3+1] = (unsigned int) i*3+1;
+            index_buffer_data[i*3+2] = (unsigned int) i*3+2;
         }
 
-        /* fill CBO for this triangle */
-        color_buffer_data[offset3D] = (GLfloat)(rgb[0]);
-        color_buffer_data[offset3D+1] = (GLfloat)(rgb[1]);
-        color_buffer_data[offset3D+2] = (GLfloat)(rgb[2]);
-        color_buffer_data[offset3D+3] = (GLfloat)(rgb[0]);
-        color_buffer_data[offset3D+4] = (GLfloat)(rgb[1]);
-        color_buffer_data[offset3D+5] = (GLfloat)(rgb[2]);
-        color_buffer_data[offset3D+6] = (GLfloat)(rgb[0]);
-        color_buffer_data[offset3D+7] = (GLfloat)(rgb[1]);
-        color_buffer_data[offset3D+8] = (GLfloat)(rgb[2]);
-
-        /* Fill indices buffer for this triangles (3 indices) */
-        index_buffer_data[i*3] = (unsigned int) i*3;
-        index_buffer_data[i*3+1] = (unsigned int) i*3+1;
-        index_buffer_data[i*3+2] = (unsigned int) i*3+2;
+
+        for (i = 0; i < 3; i++) {
+            if (file == 0 || mesh->extreme_dimensions[0].e[i] < lower[i]) {
+                lower[i] = mesh->extreme_dimensions[0].e[i];
+            }
+            if (file == 0 || mesh->extreme_dimensions[1].e[i] > upper[i]) {
+                upper[i] = mesh->extreme_dimensions[1].e[i];
+            }
+        }
+        if (indexCounts != NULL) {
+            indexCounts[file] = mesh->face_count*3;
+        }
+        first += mesh->face_count;
     }
 
     /* Create buffer objects and load data into buffers*/
     glGenBuffers(1, VBO);
     glBindBuffer(GL_ARRAY_BUFFER, *VBO);
-    glBufferData(GL_ARRAY_BUFFER, data.face_count*9*sizeof(GLfloat), vertex_buffer_data, GL_STATIC_DRAW);
+    glBufferData(GL_ARRAY_BUFFER, indx*9*sizeof(GLfloat), vertex_buffer_data, GL_STATIC_DRAW);
 
     glGenBuffers(1, NBO);
     glBindBuffer(GL_ARRAY_BUFFER, *NBO);
-    glBufferData(GL_ARRAY_BUFFER, data.face_count*9*sizeof(GLfloat), normal_buffer_data, GL_STATIC_DRAW);
+    glBufferData(GL_ARRAY_BUFFER, indx*9*sizeof(GLfloat), normal_buffer_data, GL_STATIC_DRAW);
 
     glGenBuffers(1, CBO);
     glBindBuffer(GL_ARRAY_BUFFER, *CBO);
-    glBufferData(GL_ARRAY_BUFFER, data.face_count*9*sizeof(GLfloat), color_buffer_data, GL_STATIC_DRAW);
+    glBufferData(GL_ARRAY_BUFFER, indx*9*sizeof(GLfloat), color_buffer_data, GL_STATIC_DRAW);
 
     glGenBuffers(1, UVBO);
     glBindBuffer(GL_ARRAY_BUFFER, *UVBO);
-    glBufferData(GL_ARRAY_BUFFER, data.face_count*6*sizeof(GLfloat), uv_buffer_data, GL_STATIC_DRAW);
+    glBufferData(GL_ARRAY_BUFFER, indx*6*sizeof(GLfloat), uv_buffer_data, GL_STATIC_DRAW);
 
     glGenBuffers(1, IBO);
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, *IBO);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, data.face_count*3*sizeof(unsigned int), index_buffer_data, GL_STATIC_DRAW);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indx*3*sizeof(unsigned int), index_buffer_data, GL_STATIC_DRAW);
+
+    /* Sphere around the bounding box */
+    float diagonal = 0.;
+    for (i = 0; i < 3; i++) {
+        float extent = upper[i] - lower[i];
+        boundingSphere[i] = (lower[i] + extent/2.)*scale;
+        diagonal += extent*extent;
+    }
+    boundingSphere[3] = sqrtf(diagonal)/2.*scale;
+
+    free(data);
+    return indx*3;
+}
+
+/******************************************************************
+*
+* readMeshFile
+*
+* This function read the content of an OBJ file and then fill the
+* buffer objects with the data
+*
+* Input : filename = name of file.obj
+*         scale = scale factor applied to the vertices
+*         VBO = pointer to the Vertex buffer object to fill
+*         CBO = pointer to the Color buffer object to fill
+*         NBO = pointer to the Normal buffer object to fill
+*         UVBO = pointer to the UVcoords buffer object to fill
+*         IBO = pointer to the Index buffer object to fill
+*         rgb = 3D vector containing the color of the object (r=x, g=y, b=z)
+*         boundingSphere = center (xyz) and radius enclosing the scaled mesh,
+*                          derived from the bounding box of the vertices
+* Output: number of indices in the IBO, so it does not have to be
+*         queried from the GPU on every draw
+*******************************************************************/
+int readMeshFile(char* filename, float scale, GLuint* VBO, GLuint* CBO, GLuint* NBO, GLuint* UVBO, GLuint* IBO, float* rgb, float* boundingSphere)
+{
+    return readMeshFiles(&filename, 1, scale, VBO, CBO, NBO, UVBO, IBO, rgb, boundingSphere, NULL);
 }
 
 /******************************************************************
  *
  * AddShader
  *
- * This function creates and adds individual shaders
+ * This function creates and adds individual shaders. The defines
+ * (may be NULL) are inserted right after the #version line
  *
  *******************************************************************/
-void AddShader(GLuint ShaderProgram, const char* ShaderCode, GLenum ShaderType)
+void AddShader(GLuint ShaderProgram, const char* ShaderCode, const char* Defines, GLenum ShaderType)
 {
     /* Create shader object */
     GLuint ShaderObj = glCreateShader(ShaderType);
@@ -351,8 +417,27 @@ void AddShader(GLuint ShaderProgram, const char* ShaderCode, GLenum ShaderType)
         exit(0);
     }
 
-    /* Associate shader source code string with shader object */
-    glShaderSource(ShaderObj, 1, &ShaderCode, NULL);
+    /* Split the code after the #version line, which has to come first */
+    const char* Body = ShaderCode;
+    if (strncmp(ShaderCode, "#version", 8) == 0) {
+        Body = strchr(ShaderCode, '\n');
+        Body = Body == NULL ? ShaderCode + strlen(ShaderCode) : Body + 1;
+    }
+
+    /* Defines starting with a #version line replace the one of the
+     * code, for variants needing a newer GLSL version */
+    GLint VersionLength = Body - ShaderCode;
+    if (Defines != NULL && strncmp(Defines, "#version", 8) == 0) {
+        VersionLength = 0;
+    }
+
+    /* Associate shader source code strings with shader object; the
+     * #line keeps the line numbers of compile errors right */
+    char Line[32];
+    snprintf(Line, sizeof(Line), "#line %d\n", Body == ShaderCode ? 1 : 2);
+    const char* Sources[4] = {ShaderCode, Defines == NULL ? "" : Defines, Line, Body};
+    GLint Lengths[4] = {VersionLength, -1, -1, -1};
+    glShaderSource(ShaderObj, 4, Sources, Lengths);
 
     GLint success = 0;
     GLchar InfoLog[1024];
@@ -377,19 +462,19 @@ void AddShader(GLuint ShaderProgram, const char* ShaderCode, GLenum ShaderType)
 
 /******************************************************************
  *
- * CreateShaderProgram
+ * CreateShaderVariant
  *
- * This function creates the shader program; vertex and fragment
- * shaders are loaded and linked into program; final shader program
- * is put into the rendering pipeline
+ * This function creates a shader program; vertex and fragment
+ * shaders are loaded and linked into program. The defines are added
+ * to every shader, to build a specialized variant of the program
  *
  *******************************************************************/
-void CreateShaderProgram(int programIndex, char* vsPath, char* fsPath, char* gsPath)
+GLuint CreateShaderVariant(char* vsPath, char* fsPath, char* gsPath, const char* defines)
 {
     /* Allocate shader object */
-    programs[programIndex] = glCreateProgram();
+    GLuint program = glCreateProgram();
 
-    if (programs[programIndex] == 0)
+    if (program == 0)
     {
         fprintf(stderr, "Error creating shader program\n");
         exit(1);
@@ -400,35 +485,78 @@ void CreateShaderProgram(int programIndex, char* vsPath, char* fsPath, char* gsP
     const char* FragmentShaderString = LoadShader(fsPath);
 
     /* Separately add vertex and fragment shader to program */
-    AddShader(programs[programIndex], VertexShaderString, GL_VERTEX_SHADER);
-    AddShader(programs[programIndex], FragmentShaderString, GL_FRAGMENT_SHADER);
+    AddShader(program, VertexShaderString, defines, GL_VERTEX_SHADER);
+    AddShader(program, FragmentShaderString, defines, GL_FRAGMENT_SHADER);
     if (gsPath != NULL) {
         const char* GeometryShaderString = LoadShader(gsPath);
-        AddShader(programs[programIndex], GeometryShaderString, GL_GEOMETRY_SHADER);
+        AddShader(program, GeometryShaderString, defines, GL_GEOMETRY_SHADER);
     }
 
     GLint Success = 0;
     GLchar ErrorLog[1024];
 
     /* Link shader code into executable shader program */
-    glLinkProgram(programs[programIndex]);
+    glLinkProgram(program);
 
     /* Check results of linking step */
-    glGetProgramiv(programs[programIndex], GL_LINK_STATUS, &Success);
+    glGetProgramiv(program, GL_LINK_STATUS, &Success);
     if (Success == 0)
     {
-        glGetProgramInfoLog(programs[programIndex], sizeof(ErrorLog), NULL, ErrorLog);
+        glGetProgramInfoLog(program, sizeof(ErrorLog), NULL, ErrorLog);
         fprintf(stderr, "Error linking shader program: '%s'\n", ErrorLog);
         exit(1);
     }
 
-    /* Check if shader program can be executed */
-    glValidateProgram(programs[programIndex]);
-    glGetProgramiv(programs[programIndex], GL_VALIDATE_STATUS, &Success);
-    if (!Success)
+    /* Not validated here: with all samplers still on unit 0, programs
+     * mixing sampler types (e.g. the cluster buffers) would be rejected */
+
+    return program;
+}
+
+/******************************************************************
+ *
+ * CreateShaderProgram
+ *
+ * Creates the program without any defines; final shader program
+ * is put into the rendering pipeline
+ *
+ *******************************************************************/
+void CreateShaderProgram(int programIndex, char* vsPath, char* fsPath, char* gsPath)
+{
+    programs[programIndex] = CreateShaderVariant(vsPath, fsPath, gsPath, NULL);
+}
+
+/******************************************************************
+ *
+ * CreateComputeProgram
+ *
+ * Same as CreateShaderProgram, for a program with a single compute
+ * shader. Needs OpenGL 4.3
+ *
+ *******************************************************************/
+void CreateComputeProgram(int programIndex, char* csPath)
+{
+    programs[programIndex] = glCreateProgram();
+
+    if (programs[programIndex] == 0)
+    {
+        fprintf(stderr, "Error creating shader program\n");
+        exit(1);
+    }
+
+    const char* ComputeShaderString = LoadShader(csPath);
+    AddShader(programs[programIndex], ComputeShaderString, NULL, GL_COMPUTE_SHADER);
+
+    GLint Success = 0;
+    GLchar ErrorLog[1024];
+
+    glLinkProgram(programs[programIndex]);
+
+    glGetProgramiv(programs[programIndex], GL_LINK_STATUS, &Success);
+    if (Success == 0)
     {
         glGetProgramInfoLog(programs[programIndex], sizeof(ErrorLog), NULL, ErrorLog);
-        fprintf(stderr, "Invalid shader program: '%s'\n", ErrorLog);
+        fprintf(stderr, "Error linking compute program: '%s'\n", ErrorLog);
         exit(1);
     }
 }
@@ -488,6 +616,64 @@ void SetupTexture(GLuint *TextureID, char* filename)
     /* Note: MIP mapping not visible due to fixed, i.e. static camera */
 }
 
+/******************************************************************
+ *
+ * SetupTextureArray
+ *
+ * Loads several bitmaps into the layers of one 2D array texture, so
+ * objects with different textures can be drawn by the same call.
+ * Every image is scaled to the size of the layers by a blit
+ *
+ * Input: TextureID = id of the array texture to setup
+ *        filenames = paths to bitmap files, one per layer
+ *******************************************************************/
+void SetupTextureArray(GLuint *TextureID, char** filenames, int count, int width, int height)
+{
+    glGenTextures(1, TextureID);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, *TextureID);
+    glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA8, width, height, count, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+
+    GLuint framebuffers[2];
+    glGenFramebuffers(2, framebuffers);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffers[0]);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, framebuffers[1]);
+
+    for (int i = 0; i < count; i++) {
+        TextureDataPtr Texture = malloc(sizeof(*Texture));
+        if (!LoadTexture(filenames[i], Texture))
+        {
+            printf("Error loading texture. Exiting.\n");
+            exit(-1);
+        }
+
+        GLuint image;
+        glGenTextures(1, &image);
+        glBindTexture(GL_TEXTURE_2D, image);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, Texture->width, Texture->height, 0,
+                GL_BGR, GL_UNSIGNED_BYTE, Texture->data);
+
+        glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, image, 0);
+        glFramebufferTextureLayer(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, *TextureID, 0, i);
+        glBlitFramebuffer(0, 0, Texture->width, Texture->height, 0, 0, width, height,
+                GL_COLOR_BUFFER_BIT, GL_LINEAR);
+
+        glDeleteTextures(1, &image);
+        free(Texture->data);
+        free(Texture);
+    }
+
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glDeleteFramebuffers(2, framebuffers);
+
+    /* Same parameters as SetupTexture */
+    glBindTexture(GL_TEXTURE_2D_ARRAY, *TextureID);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+}
+
 /***************************************************************
 * Setup texture for cubemap, returns cube map texture ID
 ***************************************************************/
@@ -556,6 +742,13 @@ void BindUniform4f(char* name, GLuint program, float* mat)
     glUniformMatrix4fv(uniform, 1, GL_TRUE, mat);
 }
 
+/* A 3x3 row major matrix, ignored if the program does not use it */
+void BindUniformMatrix3f(char* name, GLuint program, float* mat)
+{
+    GLint uniform = glGetUniformLocation(program, name);
+    glUniformMatrix3fv(uniform, 1, GL_TRUE, mat);
+}
+
 /* A vector is saved in a buffer at the GPU */
 void BindUniform3f(char* name, GLuint program, float* vec)
 {
@@ -579,39 +772,46 @@ void BindUniform1i(char* name, GLuint program, int val)
 
 /*
  *  VBO vertex buffer object
- *  CBO color buffe object
+ *  CBO color buffer object
  *  NBO normal buffer object
  *  IBO index buffer object
  *  UVBO uv buffer object
  */
-int BindBasics(GLuint VBO, GLuint CBO, GLuint IBO, GLuint NBO, GLuint UVBO)
+void BindBuffers(GLuint VBO, GLuint CBO, GLuint IBO, GLuint NBO, GLuint UVBO)
 {
     /* Bind buffer with vertex data of currently active object */
     glEnableVertexAttribArray(vPosition);
-    glBindBuffer(GL_ARRAY_BUFFER, VBO);
+    StateBindBuffer(GL_ARRAY_BUFFER, VBO);
     glVertexAttribPointer(vPosition, 3, GL_FLOAT, GL_FALSE, 0, 0);
 
     /* Bind color buffer */
     glEnableVertexAttribArray(vColor);
-    glBindBuffer(GL_ARRAY_BUFFER, CBO);
+    StateBindBuffer(GL_ARRAY_BUFFER, CBO);
     glVertexAttribPointer(vColor, 3, GL_FLOAT,GL_FALSE, 0, 0);
 
     /* Bind normal buffer */
     if (NBO != 0) {
         glEnableVertexAttribArray(vNormal);
-        glBindBuffer(GL_ARRAY_BUFFER, NBO);
+        StateBindBuffer(GL_ARRAY_BUFFER, NBO);
         glVertexAttribPointer(vNormal, 3, GL_FLOAT,GL_FALSE, 0, 0);
     }
 
     /* Bind uv buffer */
     if (UVBO != 0) {
         glEnableVertexAttribArray(vUV);
-        glBindBuffer(GL_ARRAY_BUFFER, UVBO);
+        StateBindBuffer(GL_ARRAY_BUFFER, UVBO);
         glVertexAttribPointer(vUV, 2, GL_FLOAT,GL_FALSE, 0, 0);
     }
 
     /* Bind index buffer */
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, IBO);
+    StateBindBuffer(GL_ELEMENT_ARRAY_BUFFER, IBO);
+}
+
+/* Same as BindBuffers, but also queries the number of indices of the
+ * bound mesh. Avoid it on hot paths, the query is a round trip to the driver */
+int BindBasics(GLuint VBO, GLuint CBO, GLuint IBO, GLuint NBO, GLuint UVBO)
+{
+    BindBuffers(VBO, CBO, IBO, NBO, UVBO);
 
     GLint size;
     glGetBufferParameteriv(GL_ELEMENT_ARRAY_BUFFER, GL_BUFFER_SIZE, &size);
@@ -636,6 +836,43 @@ void printMatrix(float* mat)
     }
 }
 
+/******************************************************************
+ * InvertMatrix
+ * Inverse of a 4x4 matrix by cofactor expansion. Works for row and
+ * column major storage alike, since the inverse of the transpose is the
+ * transpose of the inverse. Returns 0 if the matrix is singular
+ *******************************************************************/
+int InvertMatrix(float* m, float* result)
+{
+    float inv[16];
+    inv[0] = m[5]*m[10]*m[15] - m[5]*m[11]*m[14] - m[9]*m[6]*m[15] + m[9]*m[7]*m[14] + m[13]*m[6]*m[11] - m[13]*m[7]*m[10];
+    inv[4] = -m[4]*m[10]*m[15] + m[4]*m[11]*m[14] + m[8]*m[6]*m[15] - m[8]*m[7]*m[14] - m[12]*m[6]*m[11] + m[12]*m[7]*m[10];
+    inv[8] = m[4]*m[9]*m[15] - m[4]*m[11]*m[13] - m[8]*m[5]*m[15] + m[8]*m[7]*m[13] + m[12]*m[5]*m[11] - m[12]*m[7]*m[9];
+    inv[12] = -m[4]*m[9]*m[14] + m[4]*m[10]*m[13] + m[8]*m[5]*m[14] - m[8]*m[6]*m[13] - m[12]*m[5]*m[10] + m[12]*m[6]*m[9];
+    inv[1] = -m[1]*m[10]*m[15] + m[1]*m[11]*m[14] + m[9]*m[2]*m[15] - m[9]*m[3]*m[14] - m[13]*m[2]*m[11] + m[13]*m[3]*m[10];
+    inv[5] = m[0]*m[10]*m[15] - m[0]*m[11]*m[14] - m[8]*m[2]*m[15] + m[8]*m[3]*m[14] + m[12]*m[2]*m[11] - m[12]*m[3]*m[10];
+    inv[9] = -m[0]*m[9]*m[15] + m[0]*m[11]*m[13] + m[8]*m[1]*m[15] - m[8]*m[3]*m[13] - m[12]*m[1]*m[11] + m[12]*m[3]*m[9];
+    inv[13] = m[0]*m[9]*m[14] - m[0]*m[10]*m[13] - m[8]*m[1]*m[14] + m[8]*m[2]*m[13] + m[12]*m[1]*m[10] - m[12]*m[2]*m[9];
+    inv[2] = m[1]*m[6]*m[15] - m[1]*m[7]*m[14] - m[5]*m[2]*m[15] + m[5]*m[3]*m[14] + m[13]*m[2]*m[7] - m[13]*m[3]*m[6];
+    inv[6] = -m[0]*m[6]*m[15] + m[0]*m[7]*m[14] + m[4]*m[2]*m[15] - m[4]*m[3]*m[14] - m[12]*m[2]*m[7] + m[12]*m[3]*m[6];
+    inv[10] = m[0]*m[5]*m[15] - m[0]*m[7]*m[13] - m[4]*m[1]*m[15] + m[4]*m[3]*m[13] + m[12]*m[1]*m[7] - m[12]*m[3]*m[5];
+    inv[14] = -m[0]*m[5]*m[14] + m[0]*m[6]*m[13] + m[4]*m[1]*m[14] - m[4]*m[2]*m[13] - m[12]*m[1]*m[6] + m[12]*m[2]*m[5];
+    inv[3] = -m[1]*m[6]*m[11] + m[1]*m[7]*m[10] + m[5]*m[2]*m[11] - m[5]*m[3]*m[10] - m[9]*m[2]*m[7] + m[9]*m[3]*m[6];
+    inv[7] = m[0]*m[6]*m[11] - m[0]*m[7]*m[10] - m[4]*m[2]*m[11] + m[4]*m[3]*m[10] + m[8]*m[2]*m[7] - m[8]*m[3]*m[6];
+    inv[11] = -m[0]*m[5]*m[11] + m[0]*m[7]*m[9] + m[4]*m[1]*m[11] - m[4]*m[3]*m[9] - m[8]*m[1]*m[7] + m[8]*m[3]*m[5];
+    inv[15] = m[0]*m[5]*m[10] - m[0]*m[6]*m[9] - m[4]*m[1]*m[10] + m[4]*m[2]*m[9] + m[8]*m[1]*m[6] - m[8]*m[2]*m[5];
+
+    float determinant = m[0]*inv[0] + m[1]*inv[4] + m[2]*inv[8] + m[3]*inv[12];
+    if (determinant == 0) {
+        return 0;
+    }
+
+    for (int i = 0; i < 16; i++) {
+        result[i] = inv[i] / determinant;
+    }
+    return 1;
+}
+
 /*******************************************************************
  * LookAt calculates the view matrix. Similar to the glm::LookAt function
  * first it creates a new matrix, with the basis of the camera, then multiplies it
@@ -702,21 +939,12 @@ float clamp(float val, float max, float min)
     return val;
 }
 
-void createAndAttachColorBuffer(GLuint* id, int i)
+/* Monotonic time in milliseconds, for measuring durations */
+double milliseconds()
 {
-    glBindTexture(GL_TEXTURE_2D, *id);
-
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, winWidth, winHeight, 0, GL_RGBA, GL_FLOAT, NULL);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-    // we clamp to the edge as the blur filter would otherwise
-    // sample repeated texture values!
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-
-    // attach
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + i, GL_TEXTURE_2D, *id, 0);
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000. + now.tv_nsec / 1000000.;
 }
 
 void DrawFrontScreen()
@@ -733,10 +961,10 @@ void DrawFrontScreen()
         glGenVertexArrays(1, &frontScreen.VAO); // create "array"
         glGenBuffers(1, &frontScreen.VBO); // generate new buffer
 
-        glBindVertexArray(frontScreen.VAO); // make "array" active
+        StateBindVertexArray(frontScreen.VAO); // make "array" active
 
         // bind buffer
-        glBindBuffer(GL_ARRAY_BUFFER, frontScreen.VBO); // make buffer active
+        StateBindBuffer(GL_ARRAY_BUFFER, frontScreen.VBO); // make buffer active
         glBufferData(GL_ARRAY_BUFFER, sizeof(quadVertices), &quadVertices, GL_STATIC_DRAW); // bind data to buffer
 
         // bind position vertex attribute
@@ -748,9 +976,9 @@ void DrawFrontScreen()
         glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)(3 * sizeof(float)));
     }
 
-    glBindVertexArray(frontScreen.VAO);
+    StateBindVertexArray(frontScreen.VAO);
     glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
-    glBindVertexArray(0);
+    StateBindVertexArray(0);
 }
 
 void EnableTexture(char* name, GLuint program, int index)
@@ -763,6 +991,6 @@ void EnableTexture(char* name, GLuint program, int index)
 }
 void ActivateTexture(int index, GLuint TextureId)
 {
-    glActiveTexture(GL_TEXTURE0+index);
-    glBindTexture(GL_TEXTURE_2D, TextureId);
+    StateActiveTexture(index);
+    StateBindTexture(GL_TEXTURE_2D, TextureId);
 }
@@ -1,24 +1,32 @@
 #ifndef SOLAR_SYSTEM_HELPERS
 #define SOLAR_SYSTEM_HELPERS
 
-void createCubeMesh(GLuint* VBO, GLuint* CBO, GLuint* IBO);
-void createQuadMesh(GLuint* VBO, GLuint* CBO, GLuint* NBO, GLuint* UVBO, GLuint* IBO, float* rgb);
-void createCube(GLuint* VBO, GLuint* VAO);
-void readMeshFile(char* filename, float scale, GLuint* VBO, GLuint* CBO, GLuint* NBO, GLuint* UVBO, GLuint* IBO, float* rgb);
-void AddShader(GLuint ShaderProgram, const char* ShaderCode, GLenum ShaderType);
+int createCubeMesh(GLuint* VBO, GLuint* CBO, GLuint* IBO);
+int createQuadMesh(GLuint* VBO, GLuint* CBO, GLuint* NBO, GLuint* UVBO, GLuint* IBO, float* rgb, float* boundingSphere);
+int createSpriteMesh(GLuint* VBO, GLuint* CBO, GLuint* IBO);
+int readMeshFile(char* filename, float scale, GLuint* VBO, GLuint* CBO, GLuint* NBO, GLuint* UVBO, GLuint* IBO, float* rgb, float* boundingSphere);
+int readMeshFiles(char** filenames, int count, float scale, GLuint* VBO, GLuint* CBO, GLuint* NBO, GLuint* UVBO,
+        GLuint* IBO, float* rgb, float* boundingSphere, GLsizei* indexCounts);
+void AddShader(GLuint ShaderProgram, const char* ShaderCode, const char* Defines, GLenum ShaderType);
+GLuint CreateShaderVariant(char* vsPath, char* fsPath, char* gsPath, const char* defines);
 void CreateShaderProgram(int programIndex, char* vsPath, char* fsPath, char* gsPath);
+void CreateComputeProgram(int programIndex, char* csPath);
 void SetupTexture(GLuint *TextureID, char* filename);
+void SetupTextureArray(GLuint *TextureID, char** filenames, int count, int width, int height);
 void SetUpCubeMapTexture(GLuint *TextureID);
 void BindUniform4f(char* name, GLuint program, float* mat);
+void BindUniformMatrix3f(char* name, GLuint program, float* mat);
 void BindUniform3f(char* name, GLuint program, float* vec);
 void BindUniform1f(char* name, GLuint program, float val);
 void BindUniform1i(char* name, GLuint program, int val);
+void BindBuffers(GLuint VBO, GLuint CBO, GLuint IBO, GLuint NBO, GLuint UVBO);
 int BindBasics(GLuint VBO, GLuint CBO, GLuint IBO, GLuint NBO, GLuint UVBO);
 void printMatrix(float* mat);
 void LookAt(float* position, float* target, float* uup, float* result);
+int InvertMatrix(float* m, float* result);
 float clamp(float val, float max, float min);
+double milliseconds();
 
-void createAndAttachColorBuffer(GLuint* id, int i);
 void DrawFrontScreen();
 void EnableTexture(char* name, GLuint program, int index);
 void ActivateTexture(int index, GLuint TextureId);